@@ -0,0 +1,795 @@
+/**
+ *      __            ____
+ *     / /__ _  __   / __/                      __  
+ *    / //_/(_)/ /_ / /  ___   ____ ___  __ __ / /_ 
+ *   / ,<  / // __/_\ \ / _ \ / __// _ \/ // // __/ 
+ *  /_/|_|/_/ \__//___// .__//_/   \___/\_,_/ \__/  
+ *                    /_/   github.com/KitSprout    
+ * 
+ *  @file    kserial_bench.c
+ *  @author  KitSprout
+ *  @brief   kserial benchmark, one csv line (or json object with -j) per result :
+ *           bench,case,type,payload,mb_s,pkt_s,p50_us,p99_us,p999_us,max_us
+ *           throughput rows leave the latency columns empty, latency rows the rates.
+ *           mb_s counts whole frames, payload + 8 bytes of framing.
+ * 
+ *  gcc -O2 -I. bench/kserial_bench.c kserial.c kserial_transport.c kserial_capture.c kserial_demux.c \
+ *      -o kserial_bench -lpthread -DKSERIAL_SERIAL_ENABLE=0 -DKSERIAL_RECV_TREAD_ENABLE=0
+ *
+ *  kserial_bench [-j] [-t seconds] [-n samples] [-r capture]
+ *  -r replays a kserial_capture file as fast as possible through kserial_read_ctx instead.
+ */
+
+/* Includes --------------------------------------------------------------------------------*/
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include "kserial.h"
+#include "kserial_transport.h"
+#include "kserial_capture.h"
+
+/* Define ----------------------------------------------------------------------------------*/
+
+#define BENCH_BUFFER_SIZE                               (16 * 1024 * 1024)
+#define BENCH_FRAME_SIZE                                (4 * 1024 * 1024)
+#define BENCH_RING_SIZE                                 (64 * 1024)
+#define BENCH_LOOPBACK_SIZE                             (1024 * 1024)
+#define BENCH_PAYLOAD_LENS                              (4)
+
+/* Macro -----------------------------------------------------------------------------------*/
+/* Typedef ---------------------------------------------------------------------------------*/
+
+typedef struct
+{
+    const char *bench;
+    const char *name;
+    uint32_t type;
+    uint32_t payload;
+    double mbps;
+    double pps;
+    double latency[4];      // p50, p99, p99.9, max in us, latency[3] < 0 for throughput rows
+
+} bench_result_t;
+
+typedef struct
+{
+    kserial_ctx_t *ctx;
+    volatile uint32_t running;
+
+} bench_echo_t;
+
+/* Variables -------------------------------------------------------------------------------*/
+
+static const char BENCH_ISA_STRING[4][8] = {"auto", "scalar", "sse2", "avx2"};
+static const uint32_t BENCH_PAYLOAD[BENCH_PAYLOAD_LENS] = {0, 16, 256, KSERIAL_MAX_DATA_BYTES};
+static const char BENCH_UNPACK_MODE[3][8] = {"copy", "view", "arena"};
+static const kserial_pool_conf_t BENCH_POOL = {BENCH_RING_SIZE, 1024, {1024, 1024, 1024, 1024}};
+
+static uint32_t json = 0;
+static double seconds = 0.1;
+static uint32_t samples = 2000;
+
+static uint8_t *buffer;
+static uint8_t *scratch;
+static kserial_packet_t *packet;
+static uint8_t data[KSERIAL_MAX_DATA_BYTES];
+
+/* Prototypes ------------------------------------------------------------------------------*/
+/* Functions -------------------------------------------------------------------------------*/
+
+/**
+ *  @brief  bench_time
+ */
+static double bench_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ *  @brief  bench_report
+ */
+static void bench_report(const bench_result_t *r)
+{
+    const char *type = (r->type < KSERIAL_TYPE_LENS) ? KS_TYPE_STRING[r->type] : "";
+
+    if (json)
+    {
+        printf("{\"bench\":\"%s\",\"case\":\"%s\",\"type\":\"%s\",\"payload\":%u", r->bench, r->name, type, r->payload);
+        if (r->latency[3] < 0)
+        {
+            printf(",\"mb_s\":%.2f,\"pkt_s\":%.0f}\n", r->mbps, r->pps);
+        }
+        else
+        {
+            printf(",\"p50_us\":%.2f,\"p99_us\":%.2f,\"p999_us\":%.2f,\"max_us\":%.2f}\n",
+                r->latency[0], r->latency[1], r->latency[2], r->latency[3]);
+        }
+    }
+    else
+    {
+        printf("%s,%s,%s,%u,", r->bench, r->name, type, r->payload);
+        if (r->latency[3] < 0)
+        {
+            printf("%.2f,%.0f,,,,\n", r->mbps, r->pps);
+        }
+        else
+        {
+            printf(",,%.2f,%.2f,%.2f,%.2f\n", r->latency[0], r->latency[1], r->latency[2], r->latency[3]);
+        }
+    }
+    fflush(stdout);
+}
+
+/**
+ *  @brief  bench_throughput
+ */
+static void bench_throughput(const char *bench, const char *name, uint32_t type, uint32_t payload, uint64_t nbyte, uint64_t count, double elapsed)
+{
+    bench_result_t r = {bench, name, type, payload, nbyte / elapsed / 1e6, count / elapsed, {0, 0, 0, -1}};
+    bench_report(&r);
+}
+
+/**
+ *  @brief  bench_lens
+ *  Element count of a payload, the largest whole number of elements that fits.
+ */
+static uint32_t bench_lens(uint32_t type, uint32_t payload)
+{
+    uint32_t typesize = KS_TYPE_SIZE[type];
+    return (typesize > 1) ? (payload / typesize) : payload;
+}
+
+/**
+ *  @brief  bench_fill_frames
+ *  Back to back frames of one type and payload size, return bytes written.
+ */
+static uint32_t bench_fill_frames(uint8_t *pbuf, uint32_t size, uint32_t type, uint32_t lens, uint32_t *count)
+{
+    uint8_t param[2] = {0};
+    uint32_t nbyte = 0;
+
+    *count = 0;
+    while ((nbyte + KSERIAL_MAX_DATA_BYTES + 8) <= size)
+    {
+        param[0] = *count;
+        nbyte += kserial_pack(&pbuf[nbyte], param, type, lens, data);
+        (*count)++;
+    }
+    return nbyte;
+}
+
+/**
+ *  @brief  bench_pack
+ */
+static void bench_pack(uint32_t type, uint32_t payload)
+{
+    uint32_t lens = bench_lens(type, payload);
+    uint8_t param[2] = {0};
+    uint64_t nbyte = 0;
+    uint64_t count = 0;
+    uint32_t offset;
+    double start = bench_time();
+    double elapsed;
+
+    do
+    {
+        offset = 0;
+        while ((offset + KSERIAL_MAX_DATA_BYTES + 8) <= BENCH_FRAME_SIZE)
+        {
+            offset += kserial_pack(&buffer[offset], param, type, lens, data);
+            count++;
+        }
+        nbyte += offset;
+        elapsed = bench_time() - start;
+    }
+    while (elapsed < seconds);
+    bench_throughput("pack", "", type, payload, nbyte, count, elapsed);
+}
+
+/**
+ *  @brief  bench_unpack
+ */
+static void bench_unpack(uint32_t type, uint32_t payload, uint32_t nbyte, uint32_t count)
+{
+    uint8_t param[2];
+    uint32_t ptype;
+    uint32_t pbyte;
+    uint32_t offset;
+    uint64_t loops = 0;
+    double start = bench_time();
+    double elapsed;
+
+    do
+    {
+        offset = 0;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            kserial_unpack(&buffer[offset], param, &ptype, &pbyte, scratch);
+            offset += pbyte + 8;
+        }
+        loops++;
+        elapsed = bench_time() - start;
+    }
+    while (elapsed < seconds);
+    bench_throughput("unpack", "", type, payload, (uint64_t)nbyte * loops, (uint64_t)count * loops, elapsed);
+}
+
+/**
+ *  @brief  bench_unpack_buffer
+ */
+static void bench_unpack_buffer(uint32_t type, uint32_t payload, uint32_t nbyte, uint32_t mode)
+{
+    uint32_t count = 0;
+    uint32_t used;
+    uint64_t total = 0;
+    uint64_t loops = 0;
+    double start = bench_time();
+    double elapsed;
+
+    do
+    {
+        switch (mode)
+        {
+            case KSERIAL_PACKET_VIEW:
+                used = kserial_unpack_buffer_view(buffer, nbyte, packet, &count);
+                break;
+            case KSERIAL_PACKET_ARENA:
+                used = kserial_unpack_buffer_arena(buffer, nbyte, packet, &count, scratch, BENCH_BUFFER_SIZE);
+                break;
+            default:
+                used = kserial_unpack_buffer(buffer, nbyte, packet, &count);
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    free(packet[i].data);
+                }
+                break;
+        }
+        total += used;
+        loops++;
+        elapsed = bench_time() - start;
+    }
+    while (elapsed < seconds);
+    bench_throughput("unpack_buffer", BENCH_UNPACK_MODE[mode], type, payload, total, (uint64_t)count * loops, elapsed);
+}
+
+/**
+ *  @brief  bench_recv_packet
+ */
+static void bench_recv_packet(kserial_ctx_t *ctx, uint32_t type, uint32_t payload, uint32_t nbyte)
+{
+    uint8_t param[2];
+    uint32_t ptype;
+    uint32_t lens;
+    uint64_t count = 0;
+    uint64_t loops = 0;
+    double start = bench_time();
+    double elapsed;
+
+    do
+    {
+        for (uint32_t i = 0; i < nbyte; i++)
+        {
+            if (kserial_recv_packet_ctx(ctx, buffer[i], param, scratch, &lens, &ptype) == KS_OK)
+            {
+                count++;
+            }
+        }
+        loops++;
+        elapsed = bench_time() - start;
+    }
+    while (elapsed < seconds);
+    bench_throughput("recv_packet", "", type, payload, (uint64_t)nbyte * loops, count, elapsed);
+}
+
+/**
+ *  @brief  bench_read
+ *  Batched send through a loopback, kserial_read_ctx on the other side in the mode of rx,
+ *  packets are released after every read.
+ */
+static void bench_read(const char *name, kserial_ctx_t *tx, kserial_ctx_t *rx, uint32_t type, uint32_t payload)
+{
+    uint32_t lens = bench_lens(type, payload);
+    uint32_t nbyte = ((KS_TYPE_SIZE[type] > 1) ? (lens * KS_TYPE_SIZE[type]) : lens) + 8;
+    uint32_t batch = (BENCH_LOOPBACK_SIZE / 2) / nbyte;
+    uint64_t count = 0;
+    uint32_t received;
+    uint32_t nread;
+    double start;
+    double elapsed;
+
+    if (batch > (BENCH_BUFFER_SIZE / 8))
+    {
+        batch = BENCH_BUFFER_SIZE / 8;
+    }
+    for (uint32_t i = 0; i < batch; i++)
+    {
+        packet[i].param[0] = i;
+        packet[i].param[1] = 0;
+        packet[i].type = type;
+        packet[i].lens = lens;
+        packet[i].nbyte = nbyte - 8;
+        packet[i].data = data;
+    }
+    start = bench_time();
+    do
+    {
+        kserial_send_packets_ctx(tx, packet, batch);
+        received = 0;
+        while (received < batch)
+        {
+            nread = kserial_read_ctx(rx);
+            if ((nread == 0) && (kserial_wait_ctx(rx, 100) == KS_TIMEOUT))
+            {
+                break;
+            }
+            for (uint32_t i = 0; i < nread; i++)
+            {
+                kserial_release_packet(&rx->ks, &rx->ks.packet[i]);
+            }
+            received += nread;
+        }
+        count += received;
+        elapsed = bench_time() - start;
+    }
+    while (elapsed < seconds);
+    bench_throughput("read", name, type, payload, count * nbyte, count, elapsed);
+}
+
+/**
+ *  @brief  bench_decode
+ *  kserial_decode_as of one packet to float and double, per instruction set.
+ */
+static void bench_decode(uint32_t type, uint32_t payload)
+{
+    kserial_packet_t pk = {0};
+    char label[32];
+    uint64_t count;
+    double start;
+    double elapsed;
+
+    pk.type = type;
+    pk.lens = bench_lens(type, payload);
+    pk.nbyte = pk.lens * KS_TYPE_SIZE[type];
+    pk.data = data;
+    for (uint32_t isa = KSERIAL_SIMD_NONE; isa <= KSERIAL_SIMD_AVX2; isa++)
+    {
+        if (kserial_simd_select(isa) != isa)
+        {
+            continue;
+        }
+        for (uint32_t target = KS_F32; target <= KS_F64; target++)
+        {
+            count = 0;
+            start = bench_time();
+            do
+            {
+                for (uint32_t i = 0; i < 256; i++)
+                {
+                    kserial_decode_as(&pk, target, scratch, KSERIAL_MAX_DATA_BYTES);
+                }
+                count += 256;
+                elapsed = bench_time() - start;
+            }
+            while (elapsed < seconds);
+            snprintf(label, sizeof(label), "%s-%s", BENCH_ISA_STRING[isa], KS_TYPE_STRING[target]);
+            bench_throughput("decode", label, type, payload, count * (pk.nbyte + 8), count, elapsed);
+        }
+    }
+    kserial_simd_select(KSERIAL_SIMD_AUTO);
+}
+
+/**
+ *  @brief  bench_delta
+ *  kserial_pack_delta and kserial_unpack_delta of a random walk of +-3 counts, unpack per
+ *  instruction set. mb_s counts the plain frame the same samples would need.
+ */
+static void bench_delta(uint32_t type)
+{
+    uint8_t packet[KSERIAL_MAX_DATA_BYTES + 8];
+    uint32_t typesize = KS_TYPE_SIZE[type];
+    uint32_t lens = KSERIAL_MAX_DATA_BYTES / typesize;
+    uint32_t nbyte;
+    uint32_t count;
+    uint32_t srctype;
+    int64_t value = 0;
+    kserial_packet_t pk;
+    char label[32];
+    double start;
+    double elapsed;
+
+    for (uint32_t i = 0; i < lens; i++)
+    {
+        value += (rand() % 7) - 3;
+        memcpy(&data[i * typesize], &value, typesize);
+    }
+    count = 0;
+    start = bench_time();
+    do
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            nbyte = kserial_pack_delta(packet, NULL, type, lens, data);
+        }
+        count += 256;
+        elapsed = bench_time() - start;
+    }
+    while (elapsed < seconds);
+    bench_throughput("delta", "pack", type, lens * typesize, (uint64_t)count * (lens * typesize + 8), count, elapsed);
+
+    kserial_unpack_buffer_view(packet, nbyte, &pk, &count);
+    for (uint32_t isa = KSERIAL_SIMD_NONE; isa <= KSERIAL_SIMD_SSE2; isa++)
+    {
+        if (kserial_simd_select(isa) != isa)
+        {
+            continue;
+        }
+        count = 0;
+        start = bench_time();
+        do
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                kserial_unpack_delta(&pk, &srctype, scratch, lens);
+            }
+            count += 256;
+            elapsed = bench_time() - start;
+        }
+        while (elapsed < seconds);
+        snprintf(label, sizeof(label), "%s-unpack", BENCH_ISA_STRING[isa]);
+        bench_throughput("delta", label, type, lens * typesize, (uint64_t)count * (lens * typesize + 8), count, elapsed);
+    }
+    kserial_simd_select(KSERIAL_SIMD_AUTO);
+}
+
+/**
+ *  @brief  bench_fill_noise
+ *  Uniform random bytes, 'K','S' pairs show up at the natural rate of 1 / 65536.
+ */
+static uint32_t bench_fill_noise(uint8_t *pbuf, uint32_t size)
+{
+    for (uint32_t i = 0; i < size; i++)
+    {
+        pbuf[i] = rand();
+    }
+    return size;
+}
+
+/**
+ *  @brief  bench_fill_mixed
+ *  Valid packets of 16 ~ 256 bytes interleaved with garbage bursts of 0 ~ 255 bytes.
+ */
+static uint32_t bench_fill_mixed(uint8_t *pbuf, uint32_t size)
+{
+    uint8_t param[2] = {0};
+    uint32_t lens;
+    uint32_t count = 0;
+    uint32_t nbyte = 0;
+
+    while ((nbyte + 2 * 256 + 8) < size)
+    {
+        lens = rand() & 0xFF;
+        for (uint32_t i = 0; i < lens; i++)
+        {
+            pbuf[nbyte++] = rand();
+        }
+        lens = 16 + (rand() % (256 - 16 + 1));
+        param[0] = count++;
+        nbyte += kserial_pack(&pbuf[nbyte], param, KS_U8, lens, data);
+    }
+    return nbyte;
+}
+
+/**
+ *  @brief  bench_resync
+ */
+static void bench_resync(const char *name, uint32_t nbyte)
+{
+    char label[32];
+    double start;
+    double elapsed;
+    uint32_t count;
+    uint32_t loops;
+
+    for (uint32_t isa = KSERIAL_SIMD_NONE; isa <= KSERIAL_SIMD_AVX2; isa++)
+    {
+        if (kserial_simd_select(isa) != isa)
+        {
+            continue;
+        }
+        loops = 0;
+        start = bench_time();
+        do
+        {
+            kserial_unpack_buffer_view(buffer, nbyte, packet, &count);
+            loops++;
+            elapsed = bench_time() - start;
+        }
+        while (elapsed < seconds);
+        snprintf(label, sizeof(label), "%s-%s", name, BENCH_ISA_STRING[isa]);
+        bench_throughput("resync", label, KS_U8, 0, (uint64_t)nbyte * loops, (uint64_t)count * loops, elapsed);
+    }
+    kserial_simd_select(KSERIAL_SIMD_AUTO);
+}
+
+/**
+ *  @brief  bench_echo_thread
+ *  Send every packet straight back.
+ */
+static void *bench_echo_thread(void *arg)
+{
+    bench_echo_t *echo = (bench_echo_t *)arg;
+    kserial_packet_t *pk;
+    uint32_t count;
+
+    while (echo->running)
+    {
+        count = kserial_read_ctx(echo->ctx);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            pk = &echo->ctx->ks.packet[i];
+            kserial_send_packet_ctx(echo->ctx, pk->param, pk->data, pk->lens, pk->type);
+        }
+        if (count == 0)
+        {
+            kserial_wait_ctx(echo->ctx, 1);
+        }
+    }
+    return NULL;
+}
+
+/**
+ *  @brief  bench_compare
+ */
+static int bench_compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ *  @brief  bench_latency
+ *  Round trip of one packet at a time through an echo thread, the caller yields while waiting.
+ */
+static void bench_latency(const char *name, kserial_ctx_t *tx, kserial_ctx_t *rx, uint32_t payload)
+{
+    bench_result_t r = {"latency", name, KS_U8, payload, 0, 0, {0}};
+    bench_echo_t echo = {rx, 1};
+    uint64_t *rtt = (uint64_t *)malloc(samples * sizeof(uint64_t));
+    uint8_t param[2] = {0};
+    uint64_t start;
+    uint32_t n = 0;
+    pthread_t thread;
+
+    if ((rtt == NULL) || (pthread_create(&thread, NULL, bench_echo_thread, &echo) != 0))
+    {
+        free(rtt);
+        return;
+    }
+    for (n = 0; n < samples; n++)
+    {
+        param[0] = n;
+        start = kserial_now_ctx(tx);
+        kserial_send_packet_ctx(tx, param, data, payload, KS_U8);
+        while (kserial_read_ctx(tx) == 0)
+        {
+            if ((kserial_now_ctx(tx) - start) > 1000000000ULL)
+            {
+                break;
+            }
+            sched_yield();
+        }
+        rtt[n] = kserial_now_ctx(tx) - start;
+    }
+    echo.running = 0;
+    pthread_join(thread, NULL);
+
+    qsort(rtt, samples, sizeof(uint64_t), bench_compare);
+    r.latency[0] = rtt[samples / 2] / 1e3;
+    r.latency[1] = rtt[(uint64_t)samples * 99 / 100] / 1e3;
+    r.latency[2] = rtt[(uint64_t)samples * 999 / 1000] / 1e3;
+    r.latency[3] = rtt[samples - 1] / 1e3;
+    bench_report(&r);
+    free(rtt);
+}
+
+/**
+ *  @brief  bench_replay
+ *  Recorded traffic through the live read path, no timing.
+ */
+static uint32_t bench_replay(const char *path)
+{
+    static uint8_t ring[BENCH_RING_SIZE + KSERIAL_MAX_DATA_BYTES];
+    static kserial_packet_t pks[1024];
+    kserial_capture_view_t view;
+    kserial_replay_t replay;
+    kserial_ctx_t ctx;
+    const char *name = strrchr(path, '/');
+    uint64_t nbyte = 0;
+    uint64_t count = 0;
+    uint32_t n;
+    double start;
+    double elapsed;
+
+    if (kserial_capture_map(&view, path) != KS_OK)
+    {
+        fprintf(stderr, "cannot map %s\n", path);
+        return KS_ERROR;
+    }
+    start = bench_time();
+    do
+    {
+        kserial_replay_init(&replay, &view, 0);
+        kserial_ctx_init(&ctx, &kserial_transport_replay, &replay, ring, BENCH_RING_SIZE, pks, 1024);
+        ctx.ks.mode = KSERIAL_PACKET_VIEW;
+        while (((n = kserial_read_ctx(&ctx)) != 0) || !kserial_replay_done(&replay))
+        {
+            count += n;
+        }
+        nbyte += view.datasize;
+        elapsed = bench_time() - start;
+    }
+    while (elapsed < seconds);
+    bench_throughput("replay", (name != NULL) ? (name + 1) : path, KSERIAL_TYPE_LENS, 0, nbyte, count, elapsed);
+    kserial_capture_unmap(&view);
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  bench_ctx_pair
+ */
+static uint32_t bench_ctx_pair(kserial_ctx_t ctx[2], const kserial_transport_t *transport, void *handle0, void *handle1)
+{
+    static uint8_t ring[2][BENCH_RING_SIZE + KSERIAL_MAX_DATA_BYTES];
+    static kserial_packet_t pks[2][1024];
+    void *handle[2] = {handle0, handle1};
+
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        if (kserial_ctx_init(&ctx[i], transport, handle[i], ring[i], BENCH_RING_SIZE, pks[i], 1024) != KS_OK)
+        {
+            return KS_ERROR;
+        }
+        ctx[i].ks.mode = KSERIAL_PACKET_VIEW;
+    }
+    return KS_OK;
+}
+
+/**
+ *  @brief  main
+ */
+int main(int argc, char **argv)
+{
+    static kserial_ctx_t ctx[2];
+    static kserial_ctx_t pctx;
+    kserial_pool_t pool;
+    const char *replay = NULL;
+    kserial_loopback_t *lb;
+    kserial_fd_t pty[2];
+    uint32_t nbyte;
+    uint32_t count;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0)
+        {
+            json = 1;
+        }
+        else if ((strcmp(argv[i], "-t") == 0) && ((i + 1) < argc))
+        {
+            seconds = atof(argv[++i]);
+        }
+        else if ((strcmp(argv[i], "-n") == 0) && ((i + 1) < argc))
+        {
+            samples = atoi(argv[++i]);
+        }
+        else if ((strcmp(argv[i], "-r") == 0) && ((i + 1) < argc))
+        {
+            replay = argv[++i];
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-j] [-t seconds] [-n samples] [-r capture]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (samples == 0)
+    {
+        samples = 1;
+    }
+
+    srand(1);
+    buffer = (uint8_t *)malloc(BENCH_BUFFER_SIZE);
+    scratch = (uint8_t *)malloc(BENCH_BUFFER_SIZE);
+    packet = (kserial_packet_t *)malloc((BENCH_BUFFER_SIZE / 8) * sizeof(kserial_packet_t));
+    lb = kserial_loopback_create(BENCH_LOOPBACK_SIZE);
+    if ((buffer == NULL) || (scratch == NULL) || (packet == NULL) || (lb == NULL))
+    {
+        return 1;
+    }
+    for (uint32_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = rand();
+    }
+    if (!json)
+    {
+        printf("bench,case,type,payload,mb_s,pkt_s,p50_us,p99_us,p999_us,max_us\n");
+    }
+    if (replay != NULL)
+    {
+        return (bench_replay(replay) == KS_OK) ? 0 : 1;
+    }
+
+    // throughput, every type code and payload size
+    bench_ctx_pair(ctx, &kserial_transport_loopback, kserial_loopback_port(lb, 0), kserial_loopback_port(lb, 1));
+    if ((kserial_pool_init(&pool, &BENCH_POOL, NULL, 0) != KS_OK) ||
+        (kserial_ctx_init_pool(&pctx, &kserial_transport_loopback, kserial_loopback_port(lb, 1), &pool) != KS_OK))
+    {
+        return 1;
+    }
+    for (uint32_t type = 0; type < KSERIAL_TYPE_LENS; type++)
+    {
+        for (uint32_t i = 0; i < BENCH_PAYLOAD_LENS; i++)
+        {
+            bench_pack(type, BENCH_PAYLOAD[i]);
+            nbyte = bench_fill_frames(buffer, BENCH_FRAME_SIZE, type, bench_lens(type, BENCH_PAYLOAD[i]), &count);
+            bench_unpack(type, BENCH_PAYLOAD[i], nbyte, count);
+            for (uint32_t mode = KSERIAL_PACKET_COPY; mode <= KSERIAL_PACKET_ARENA; mode++)
+            {
+                bench_unpack_buffer(type, BENCH_PAYLOAD[i], nbyte, mode);
+            }
+            bench_recv_packet(&ctx[1], type, BENCH_PAYLOAD[i], nbyte);
+            bench_read("loopback", &ctx[0], &ctx[1], type, BENCH_PAYLOAD[i]);
+            ctx[1].ks.mode = KSERIAL_PACKET_COPY;
+            bench_read("loopback_copy", &ctx[0], &ctx[1], type, BENCH_PAYLOAD[i]);
+            ctx[1].ks.mode = KSERIAL_PACKET_VIEW;
+            bench_read("loopback_pool", &ctx[0], &pctx, type, BENCH_PAYLOAD[i]);
+        }
+        if (KS_TYPE_SIZE[type] != 0)
+        {
+            bench_decode(type, KSERIAL_MAX_DATA_BYTES);
+        }
+    }
+    bench_delta(KS_I16);
+    bench_delta(KS_I32);
+
+    // corrupted streams
+    nbyte = bench_fill_noise(buffer, BENCH_BUFFER_SIZE);
+    bench_resync("noise", nbyte);
+    nbyte = bench_fill_mixed(buffer, BENCH_BUFFER_SIZE);
+    bench_resync("mixed", nbyte);
+
+    // end to end round trip
+    for (uint32_t i = 0; i < BENCH_PAYLOAD_LENS; i++)
+    {
+        bench_ctx_pair(ctx, &kserial_transport_loopback, kserial_loopback_port(lb, 0), kserial_loopback_port(lb, 1));
+        bench_latency("loopback", &ctx[0], &ctx[1], BENCH_PAYLOAD[i]);
+    }
+    if (kserial_pty_open(&pty[0], &pty[1]) == KS_OK)
+    {
+        for (uint32_t i = 0; i < BENCH_PAYLOAD_LENS; i++)
+        {
+            bench_ctx_pair(ctx, &kserial_transport_fd, &pty[0], &pty[1]);
+            bench_latency("pty", &ctx[0], &ctx[1], BENCH_PAYLOAD[i]);
+        }
+        kserial_fd_close(&pty[0]);
+        kserial_fd_close(&pty[1]);
+    }
+
+    kserial_pool_deinit(&pool);
+    kserial_loopback_destroy(lb);
+    free(packet);
+    free(scratch);
+    free(buffer);
+
+    return 0;
+}
+
+/*************************************** END OF FILE ****************************************/
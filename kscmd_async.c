@@ -0,0 +1,185 @@
+/**
+ *      __            ____
+ *     / /__ _  __   / __/                      __  
+ *    / //_/(_)/ /_ / /  ___   ____ ___  __ __ / /_ 
+ *   / ,<  / // __/_\ \ / _ \ / __// _ \/ // // __/ 
+ *  /_/|_|/_/ \__//___// .__//_/   \___/\_,_/ \__/  
+ *                    /_/   github.com/KitSprout    
+ * 
+ *  @file    kscmd_async.c
+ *  @author  KitSprout
+ *  @brief   pipelined asynchronous commands
+ *           Requests are sent immediately and kept in submit order. A received packet
+ *           completes the oldest request whose (type, P1, P2) match, so several commands
+ *           can be in flight. Time is a caller supplied millisecond tick.
+ */
+
+/* Includes --------------------------------------------------------------------------------*/
+#include <string.h>
+#include "kscmd_async.h"
+
+/* Define ----------------------------------------------------------------------------------*/
+/* Macro -----------------------------------------------------------------------------------*/
+/* Typedef ---------------------------------------------------------------------------------*/
+/* Variables -------------------------------------------------------------------------------*/
+/* Prototypes ------------------------------------------------------------------------------*/
+/* Functions -------------------------------------------------------------------------------*/
+
+/**
+ *  @brief  kscmd_async_remove
+ */
+static void kscmd_async_remove(kscmd_async_t *as, uint32_t index)
+{
+    as->count--;
+    memmove(&as->pending[index], &as->pending[index + 1], (as->count - index) * sizeof(kscmd_request_t *));
+}
+
+/**
+ *  @brief  kscmd_async_complete
+ */
+static void kscmd_async_complete(kscmd_request_t *req, uint32_t status)
+{
+    req->status = status;
+    if (req->callback != NULL)
+    {
+        req->callback(req->user, status, (status == KS_OK) ? &req->response : NULL);
+    }
+}
+
+/**
+ *  @brief  kscmd_async_init
+ *  pending : table of size outstanding requests
+ */
+void kscmd_async_init(kscmd_async_t *as, kserial_ctx_t *ctx, kscmd_request_t **pending, uint32_t size)
+{
+    as->ctx = ctx;
+    as->size = size;
+    as->count = 0;
+    as->pending = pending;
+    as->unmatched = NULL;
+    as->user = NULL;
+}
+
+/**
+ *  @brief  kscmd_async_submit
+ *  Send the command and register req, it must stay alive until completed or cancelled.
+ *  Return KS_BUSY when the pending table is full.
+ */
+uint32_t kscmd_async_submit(kscmd_async_t *as, kscmd_request_t *req, uint32_t now)
+{
+    if (as->count >= as->size)
+    {
+        return KS_BUSY;
+    }
+    req->status = KS_BUSY;
+    req->deadline = now + req->timeout;
+    as->pending[as->count++] = req;
+    kserial_send_packet_ctx(as->ctx, req->param, req->pdata, req->lens, req->type);
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kscmd_async_cancel
+ */
+uint32_t kscmd_async_cancel(kscmd_async_t *as, kscmd_request_t *req)
+{
+    for (uint32_t i = 0; i < as->count; i++)
+    {
+        if (as->pending[i] == req)
+        {
+            kscmd_async_remove(as, i);
+            req->status = KS_ERROR;
+            return KS_OK;
+        }
+    }
+    return KS_ERROR;
+}
+
+/**
+ *  @brief  kscmd_async_dispatch
+ *  Complete the oldest matching request with pk, return KS_ERROR if nothing matched.
+ */
+uint32_t kscmd_async_dispatch(kscmd_async_t *as, const kserial_packet_t *pk)
+{
+    kscmd_request_t *req;
+    uint32_t nbyte;
+    uint32_t typesize;
+
+    for (uint32_t i = 0; i < as->count; i++)
+    {
+        req = as->pending[i];
+        if (kscmd_check_response(pk, req->match, req->type, req->param) != KS_OK)
+        {
+            continue;
+        }
+        kscmd_async_remove(as, i);
+        nbyte = (pk->nbyte > req->rsize) ? req->rsize : pk->nbyte;
+        if (req->rdata == NULL)
+        {
+            nbyte = 0;
+        }
+        if (nbyte != 0)
+        {
+            memcpy(req->rdata, pk->data, nbyte);
+        }
+        typesize = KS_TYPE_SIZE[pk->type & 0x0F];
+        req->response = *pk;
+        req->response.data = (nbyte != 0) ? req->rdata : NULL;   // only the copied bytes
+        req->response.nbyte = nbyte;
+        req->response.lens = (typesize > 1) ? (nbyte / typesize) : nbyte;
+        kscmd_async_complete(req, KS_OK);
+        return KS_OK;
+    }
+    return KS_ERROR;
+}
+
+/**
+ *  @brief  kscmd_async_expire
+ *  Time out requests past their deadline, return the number of requests still pending.
+ */
+uint32_t kscmd_async_expire(kscmd_async_t *as, uint32_t now)
+{
+    kscmd_request_t *req;
+    uint32_t i = 0;
+
+    while (i < as->count)
+    {
+        req = as->pending[i];
+        if ((int32_t)(now - req->deadline) >= 0)
+        {
+            kscmd_async_remove(as, i);
+            kscmd_async_complete(req, KS_TIMEOUT);
+        }
+        else
+        {
+            i++;
+        }
+    }
+    return as->count;
+}
+
+/**
+ *  @brief  kscmd_async_poll
+ *  Read the context, complete matching requests and hand other packets to as->unmatched,
+ *  then expire. Return the number of requests still pending.
+ */
+uint32_t kscmd_async_poll(kscmd_async_t *as, uint32_t now)
+{
+    kserial_t *ks = &as->ctx->ks;
+    uint32_t count;
+
+    count = kserial_read_ctx(as->ctx);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if ((kscmd_async_dispatch(as, &ks->packet[i]) != KS_OK) && (as->unmatched != NULL))
+        {
+            as->unmatched(as->user, &ks->packet[i]);
+        }
+        kserial_release_packet(ks, &ks->packet[i]);
+    }
+
+    return kscmd_async_expire(as, now);
+}
+
+/*************************************** END OF FILE ****************************************/
@@ -0,0 +1,83 @@
+/**
+ *      __            ____
+ *     / /__ _  __   / __/                      __  
+ *    / //_/(_)/ /_ / /  ___   ____ ___  __ __ / /_ 
+ *   / ,<  / // __/_\ \ / _ \ / __// _ \/ // // __/ 
+ *  /_/|_|/_/ \__//___// .__//_/   \___/\_,_/ \__/  
+ *                    /_/   github.com/KitSprout    
+ * 
+ *  @file    kscmd_async.h
+ *  @author  KitSprout
+ *  @brief   pipelined asynchronous commands
+ * 
+ */
+
+/* Define to prevent recursive inclusion ---------------------------------------------------*/
+#ifndef __KSCMD_ASYNC_H
+#define __KSCMD_ASYNC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes --------------------------------------------------------------------------------*/
+#include "kserial.h"
+
+/* Define ----------------------------------------------------------------------------------*/
+/* Macro -----------------------------------------------------------------------------------*/
+/* Typedef ---------------------------------------------------------------------------------*/
+
+typedef void (*pkscmd_callback_t)(void *user, uint32_t status, const kserial_packet_t *response);
+
+typedef struct
+{
+    // command
+    uint32_t type;
+    uint8_t param[2];
+    void *pdata;
+    uint32_t lens;
+
+    // response
+    uint32_t match;             // KSCMD_MATCH_xxx
+    uint32_t timeout;           // ms
+    void *rdata;                // response payload, up to rsize bytes
+    uint32_t rsize;
+    pkscmd_callback_t callback;
+    void *user;
+
+    // future, status is KS_BUSY while outstanding, then KS_OK or KS_TIMEOUT
+    uint32_t status;
+    kserial_packet_t response;  // data, nbyte and lens cover the bytes copied to rdata
+    uint32_t deadline;
+
+} kscmd_request_t;
+
+typedef struct
+{
+    kserial_ctx_t *ctx;
+    uint32_t size;
+    uint32_t count;
+    kscmd_request_t **pending;  // in submit order
+
+    pkserial_handler_t unmatched;
+    void *user;
+
+} kscmd_async_t;
+
+/* Extern ----------------------------------------------------------------------------------*/
+/* Functions -------------------------------------------------------------------------------*/
+
+void        kscmd_async_init(kscmd_async_t *as, kserial_ctx_t *ctx, kscmd_request_t **pending, uint32_t size);
+uint32_t    kscmd_async_submit(kscmd_async_t *as, kscmd_request_t *req, uint32_t now);
+uint32_t    kscmd_async_cancel(kscmd_async_t *as, kscmd_request_t *req);
+uint32_t    kscmd_async_dispatch(kscmd_async_t *as, const kserial_packet_t *pk);
+uint32_t    kscmd_async_expire(kscmd_async_t *as, uint32_t now);
+uint32_t    kscmd_async_poll(kscmd_async_t *as, uint32_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/*************************************** END OF FILE ****************************************/
@@ -24,31 +24,100 @@
 /* Includes --------------------------------------------------------------------------------*/
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
 #include "kserial.h"
+#if KSERIAL_SIMD_ENABLE && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KSERIAL_SIMD_X86
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
 
 /* Define ----------------------------------------------------------------------------------*/
+
+/* frame parser state, named after the byte it waits for */
+#define KSERIAL_STATE_HK                                (0U)
+#define KSERIAL_STATE_HS                                (1U)
+#define KSERIAL_STATE_TP                                (2U)
+#define KSERIAL_STATE_LN                                (3U)
+#define KSERIAL_STATE_P1                                (4U)
+#define KSERIAL_STATE_P2                                (5U)
+#define KSERIAL_STATE_CK                                (6U)
+#define KSERIAL_STATE_DN                                (7U)
+#define KSERIAL_STATE_ER                                (8U)
+
+/* payload words are little endian on the wire */
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define KSERIAL_BIG_ENDIAN
+#endif
+
 /* Macro -----------------------------------------------------------------------------------*/
+
+/* single writer, a relaxed load and store instead of a locked add */
+#define KSERIAL_COUNT(__COUNTER, __N)                                                       \
+    atomic_store_explicit(&(__COUNTER), atomic_load_explicit(&(__COUNTER), memory_order_relaxed) + (__N), memory_order_relaxed)
+
+#define KSERIAL_DECODE_SCALAR(__LOAD)                                                       \
+    if (type == KS_F32)                                                                     \
+    {                                                                                       \
+        for (; i < lens; i++) { ((float *)pdata)[i] = (float)(__LOAD); }                    \
+    }                                                                                       \
+    else                                                                                    \
+    {                                                                                       \
+        for (; i < lens; i++) { ((double *)pdata)[i] = (double)(__LOAD); }                  \
+    }
+
 /* Typedef ---------------------------------------------------------------------------------*/
+
+typedef uint32_t (*pkserial_find_sync_t)(const uint8_t *buffer, uint32_t lens);
+
 /* Variables -------------------------------------------------------------------------------*/
 
 const char KSERIAL_VERSION[] = KSERIAL_VERSION_DEFINE;
 
-#if KSERIAL_SEND_ENABLE
-static uint8_t sbuffer[KS_MAX_SEND_BUFFER_SIZE] = {0};
-#endif
-#if KSERIAL_RECV_ENABLE
-static uint8_t rbuffer[KS_MAX_RECV_BUFFER_SIZE] = {0};
+#if KSERIAL_SERIAL_ENABLE
+static uint32_t kserial_serial_send(void *handle, const void *data, uint32_t lens);
+static uint32_t kserial_serial_recv(void *handle, void *data, uint32_t lens);
+static void     kserial_serial_flush(void *handle);
+static uint32_t kserial_serial_wait(void *handle, uint32_t timeout);
+
+const kserial_transport_t kserial_transport_serial =
+{
+    .send = kserial_serial_send,
+    .sendv = NULL,
+    .recv = kserial_serial_recv,
+    .flush = kserial_serial_flush,
+    .wait = kserial_serial_wait,
+    .now = NULL,
+    .fd = NULL,
+    .setbaud = NULL
+};
+
+// default context of the api without _ctx suffix
+static kserial_ctx_t ksctx =
+{
+    .transport = &kserial_transport_serial,
+    .handle = NULL
+};
+#else
+static kserial_ctx_t ksctx = {0};
 #endif
 
-#if KSERIAL_RECV_TREAD_ENABLE
-static uint8_t pkbuffer[KSERIAL_RECV_PACKET_BUFFER_LENS] = {0};
+#if KSERIAL_RECV_TREAD_ENABLE && KSERIAL_RECV_STATIC_ENABLE
+static uint8_t pkbuffer[KSERIAL_RECV_PACKET_BUFFER_LENS + KSERIAL_MAX_DATA_BYTES] = {0};
 static kserial_packet_t kspacket[KSERIAL_MAX_PACKET_LENS] = {0};
 kserial_t ks =
 {
     .size = KSERIAL_RECV_PACKET_BUFFER_LENS,
-    .count = 0,
+    .head = 0,
+    .tail = 0,
     .buffer = pkbuffer,
-    .packet = kspacket
+    .packet = kspacket,
+    .pksize = KSERIAL_MAX_PACKET_LENS,
+    .mode = KSERIAL_RECV_PACKET_MODE,
+    .index = 0,
+    .arena = NULL,
+    .arenasize = 0,
+    .pool = NULL
 };
 #endif
 
@@ -77,8 +146,164 @@ const char KS_TYPE_FORMATE[KSERIAL_TYPE_LENS][8] =
 };
 
 /* Prototypes ------------------------------------------------------------------------------*/
+
+static uint32_t kserial_find_sync_auto(const uint8_t *buffer, uint32_t lens);
+
 /* Functions -------------------------------------------------------------------------------*/
 
+// shared by every context, written by kserial_simd_select and read relaxed, a stale value
+// still names a valid implementation
+static _Atomic(pkserial_find_sync_t) kserial_find_sync_isa = kserial_find_sync_auto;
+static atomic_uint kserial_simd_isa = KSERIAL_SIMD_AUTO;
+#ifdef KSERIAL_SIMD_X86
+static atomic_uint kserial_simd_f16c = 0;
+#endif
+
+/**
+ *  @brief  kserial_find_sync_scalar
+ */
+static uint32_t kserial_find_sync_scalar(const uint8_t *buffer, uint32_t lens)
+{
+    for (uint32_t i = 0; i < lens; i++)
+    {
+        if ((buffer[i] == 'K') && (((i + 1) == lens) || (buffer[i + 1] == 'S')))
+        {
+            return i;
+        }
+    }
+    return lens;
+}
+
+#ifdef KSERIAL_SIMD_X86
+/**
+ *  @brief  kserial_find_sync_sse2
+ *  Compare 16 'K' candidates against the following 'S' per step.
+ */
+__attribute__((target("sse2")))
+static uint32_t kserial_find_sync_sse2(const uint8_t *buffer, uint32_t lens)
+{
+    const __m128i hk = _mm_set1_epi8('K');
+    const __m128i hs = _mm_set1_epi8('S');
+    uint32_t i = 0;
+    uint32_t mask;
+
+    for (; (i + 17) <= lens; i += 16)
+    {
+        __m128i k = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&buffer[i]), hk);
+        __m128i s = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&buffer[i + 1]), hs);
+        mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(k, s));
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + kserial_find_sync_scalar(&buffer[i], lens - i);
+}
+
+/**
+ *  @brief  kserial_find_sync_avx2
+ *  Compare 32 'K' candidates against the following 'S' per step.
+ */
+__attribute__((target("avx2")))
+static uint32_t kserial_find_sync_avx2(const uint8_t *buffer, uint32_t lens)
+{
+    const __m256i hk = _mm256_set1_epi8('K');
+    const __m256i hs = _mm256_set1_epi8('S');
+    uint32_t i = 0;
+    uint32_t mask;
+
+    for (; (i + 33) <= lens; i += 32)
+    {
+        __m256i k = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&buffer[i]), hk);
+        __m256i s = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&buffer[i + 1]), hs);
+        mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(k, s));
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + kserial_find_sync_sse2(&buffer[i], lens - i);
+}
+#endif
+
+/**
+ *  @brief  kserial_simd_select
+ *  Select the sync search and decode instruction set, an unsupported one falls back to the
+ *  next lower. Return the instruction set in use.
+ *  Call once at init before any reader runs, without a call the first reader picks the best
+ *  instruction set of this cpu.
+ */
+uint32_t kserial_simd_select(uint32_t isa)
+{
+    pkserial_find_sync_t find;
+#ifdef KSERIAL_SIMD_X86
+    uint32_t eax, ebx, ecx, edx;
+
+    __builtin_cpu_init();
+    atomic_store_explicit(&kserial_simd_f16c,
+                          (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_F16C)) ? 1 : 0, memory_order_relaxed);
+    if ((isa == KSERIAL_SIMD_AUTO) || (isa > KSERIAL_SIMD_AVX2))
+    {
+        isa = KSERIAL_SIMD_AVX2;
+    }
+    if ((isa == KSERIAL_SIMD_AVX2) && !__builtin_cpu_supports("avx2"))
+    {
+        isa = KSERIAL_SIMD_SSE2;
+    }
+    if ((isa == KSERIAL_SIMD_SSE2) && !__builtin_cpu_supports("sse2"))
+    {
+        isa = KSERIAL_SIMD_NONE;
+    }
+    if (isa == KSERIAL_SIMD_AVX2)
+    {
+        find = kserial_find_sync_avx2;
+    }
+    else if (isa == KSERIAL_SIMD_SSE2)
+    {
+        find = kserial_find_sync_sse2;
+    }
+    else
+    {
+        find = kserial_find_sync_scalar;
+    }
+#else
+    isa = KSERIAL_SIMD_NONE;
+    find = kserial_find_sync_scalar;
+#endif
+    atomic_store_explicit(&kserial_find_sync_isa, find, memory_order_relaxed);
+    atomic_store_explicit(&kserial_simd_isa, isa, memory_order_relaxed);
+    return isa;
+}
+
+/**
+ *  @brief  kserial_simd_current
+ */
+static inline uint32_t kserial_simd_current(void)
+{
+    uint32_t isa = atomic_load_explicit(&kserial_simd_isa, memory_order_relaxed);
+
+    return (isa == KSERIAL_SIMD_AUTO) ? kserial_simd_select(KSERIAL_SIMD_AUTO) : isa;
+}
+
+/**
+ *  @brief  kserial_find_sync_auto
+ *  First call, pick the best instruction set of this cpu.
+ */
+static uint32_t kserial_find_sync_auto(const uint8_t *buffer, uint32_t lens)
+{
+    kserial_simd_select(KSERIAL_SIMD_AUTO);
+    return atomic_load_explicit(&kserial_find_sync_isa, memory_order_relaxed)(buffer, lens);
+}
+
+/**
+ *  @brief  kserial_find_sync
+ *  Return the offset of the first 'K' followed by 'S' (or by the end of buffer), lens if none.
+ */
+uint32_t kserial_find_sync(const uint8_t *buffer, uint32_t lens)
+{
+    return atomic_load_explicit(&kserial_find_sync_isa, memory_order_relaxed)(buffer, lens);
+}
+
 /**
  *  @brief  kserial_get_typesize
  */
@@ -178,15 +403,11 @@ void kserial_get_bytesdata(const uint8_t *packet, void *pdata, uint32_t nbyte)
 }
 
 /**
- *  @brief  kserial_pack
+ *  @brief  kserial_pack_header
  */
-uint32_t kserial_pack(uint8_t *packet, const void *param, uint32_t type, uint32_t lens, const void *pdata)
+static void kserial_pack_header(uint8_t *packet, const void *param, uint32_t type, uint32_t databytes)
 {
-    uint32_t databytes;  // in bytes
     uint32_t checksum = 0;
-    uint32_t typesize = kserial_get_typesize(type);
-
-    databytes = (typesize > 1) ? (lens * typesize) : (lens);
 
     packet[0] = 'K';                                // header 'K'
     packet[1] = 'S';                                // header 'S'
@@ -208,6 +429,19 @@ uint32_t kserial_pack(uint8_t *packet, const void *param, uint32_t type, uint32_
         checksum += packet[i];
     }
     packet[6] = checksum;                           // checksum
+}
+
+/**
+ *  @brief  kserial_pack
+ */
+uint32_t kserial_pack(uint8_t *packet, const void *param, uint32_t type, uint32_t lens, const void *pdata)
+{
+    uint32_t databytes;  // in bytes
+    uint32_t typesize = kserial_get_typesize(type);
+
+    databytes = (typesize > 1) ? (lens * typesize) : (lens);
+
+    kserial_pack_header(packet, param, type, databytes);
 
     if (pdata != NULL)
     {
@@ -241,255 +475,2462 @@ uint32_t kserial_unpack(const uint8_t *packet, void *param, uint32_t *type, uint
 }
 
 /**
- *  @brief  kserial_unpack_buffer
+ *  @brief  kserial_load16
  */
-uint32_t kserial_unpack_buffer(const uint8_t *buffer, uint32_t buffersize, kserial_packet_t *ksp, uint32_t *count)
+static inline uint16_t kserial_load16(const uint8_t *p)
 {
-    uint32_t status;
-    uint32_t offset = 0;
-    uint32_t newindex = 0;
-    uint32_t typesize;
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+#ifdef KSERIAL_BIG_ENDIAN
+    v = __builtin_bswap16(v);
+#endif
+    return v;
+}
 
-    *count = 0;
+/**
+ *  @brief  kserial_load32
+ */
+static inline uint32_t kserial_load32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#ifdef KSERIAL_BIG_ENDIAN
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+/**
+ *  @brief  kserial_load64
+ */
+static inline uint64_t kserial_load64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#ifdef KSERIAL_BIG_ENDIAN
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+/**
+ *  @brief  kserial_f16_to_f32
+ *  IEEE 754 binary16 to binary32, subnormal, inf and nan included.
+ */
+static float kserial_f16_to_f32(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t expo = (h >> 10) & 0x1F;
+    uint32_t mant = h & 0x03FF;
+    uint32_t bits;
+    float f;
 
-    while ((buffersize - offset) > 7)   // min packet bytes = 8
+    if (expo == 0x1F)
     {
-        status = kserial_check(&buffer[offset], ksp[*count].param, &ksp[*count].type, &ksp[*count].nbyte);
-        if (status == KS_OK)
+        bits = sign | 0x7F800000 | (mant << 13);
+    }
+    else if (expo != 0)
+    {
+        bits = sign | ((expo + 112) << 23) | (mant << 13);
+    }
+    else if (mant == 0)
+    {
+        bits = sign;
+    }
+    else
+    {
+        f = (float)mant * 5.9604644775390625e-8f;   // mant * 2^-24
+        return (sign != 0) ? -f : f;
+    }
+    memcpy(&f, &bits, sizeof(f));
+
+    return f;
+}
+
+/**
+ *  @brief  kserial_f32_from_bits
+ */
+static inline float kserial_f32_from_bits(uint32_t bits)
+{
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+/**
+ *  @brief  kserial_f64_from_bits
+ */
+static inline double kserial_f64_from_bits(uint64_t bits)
+{
+    double f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+#ifdef KSERIAL_SIMD_X86
+/**
+ *  @brief  kserial_decode_avx2
+ *  Convert 8 elements per step, return the number converted, the tail is left to the caller.
+ *  U32, U64, I64 and F64 sources are not handled here.
+ */
+__attribute__((target("avx2,f16c")))
+static uint32_t kserial_decode_avx2(const uint8_t *src, uint32_t srctype, uint32_t type, void *pdata, uint32_t lens)
+{
+    uint32_t isint = (srctype != KS_F16) && (srctype != KS_F32);
+    uint32_t i = 0;
+    __m256i vi = _mm256_setzero_si256();
+    __m256 vf = _mm256_setzero_ps();
+
+    if ((srctype == KS_U32) || (srctype == KS_U64) || (srctype == KS_I64) || (srctype == KS_F64) ||
+        ((srctype == KS_F16) && !atomic_load_explicit(&kserial_simd_f16c, memory_order_relaxed)))
+    {
+        return 0;
+    }
+    for (; (i + 8) <= lens; i += 8)
+    {
+        switch (srctype)
         {
-            if ((offset + ksp[*count].nbyte + 8) > buffersize)
-            {
-                break;
-            }
-            ksp[*count].data = (void *)malloc(ksp[*count].nbyte * sizeof(uint8_t));
-            kserial_get_bytesdata(&buffer[offset], ksp[*count].data, ksp[*count].nbyte);
-            typesize = kserial_get_typesize(ksp[*count].type);
-            if (typesize > 1)
-            {
-                ksp[*count].lens = ksp[*count].nbyte / typesize;
-            }
-            offset += ksp[*count].nbyte + 8;
-            newindex = offset - 1;
-            (*count)++;
+            case KS_U8:  vi = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)&src[i]));          break;
+            case KS_I8:  vi = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)&src[i]));          break;
+            case KS_U16: vi = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)&src[2 * i]));     break;
+            case KS_I16: vi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)&src[2 * i]));     break;
+            case KS_I32: vi = _mm256_loadu_si256((const __m256i *)&src[4 * i]);                         break;
+            case KS_F16: vf = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)&src[2 * i]));           break;
+            default:     vf = _mm256_loadu_ps((const float *)&src[4 * i]);                              break;
+        }
+        if (type == KS_F32)
+        {
+            _mm256_storeu_ps(&((float *)pdata)[i], isint ? _mm256_cvtepi32_ps(vi) : vf);
+        }
+        else if (isint)
+        {
+            _mm256_storeu_pd(&((double *)pdata)[i], _mm256_cvtepi32_pd(_mm256_castsi256_si128(vi)));
+            _mm256_storeu_pd(&((double *)pdata)[i + 4], _mm256_cvtepi32_pd(_mm256_extracti128_si256(vi, 1)));
         }
         else
         {
-            offset++;
+            _mm256_storeu_pd(&((double *)pdata)[i], _mm256_cvtps_pd(_mm256_castps256_ps128(vf)));
+            _mm256_storeu_pd(&((double *)pdata)[i + 4], _mm256_cvtps_pd(_mm256_extractf128_ps(vf, 1)));
         }
     }
-    // TODO: fix return
-    return (newindex + 1);
+
+    return i;
 }
+#endif
 
 /**
- *  @brief  kserial_send_packet
+ *  @brief  kserial_decode_as
+ *  Convert the payload of pk (U8 ~ I64, F16, F32, F64, little endian) to type KS_F32 or
+ *  KS_F64 in pdata, at most lens elements. Return the number of elements written,
+ *  0 for raw (R0 ~ R4) payloads or another target type.
  */
-uint32_t kserial_send_packet(void *param, void *pdata, uint32_t lens, uint32_t type)
+uint32_t kserial_decode_as(const kserial_packet_t *pk, uint32_t type, void *pdata, uint32_t lens)
 {
-#if KSERIAL_SEND_ENABLE
-    uint32_t nbytes;
-    nbytes = kserial_pack(sbuffer, param, type, lens, pdata);
-    kserial_send(sbuffer, nbytes);
-    // TODO: fix return
-    return nbytes;
-#else
-    return KS_ERROR;
+    const uint8_t *src = (const uint8_t *)pk->data;
+    uint32_t typesize;
+    uint32_t i = 0;
+
+    if (((type != KS_F32) && (type != KS_F64)) || (pk->type >= KSERIAL_TYPE_LENS))
+    {
+        return 0;
+    }
+    typesize = kserial_get_typesize(pk->type);
+    if ((typesize == 0) || (src == NULL))
+    {
+        return 0;
+    }
+    if (lens > (pk->nbyte / typesize))
+    {
+        lens = pk->nbyte / typesize;
+    }
+
+#ifdef KSERIAL_SIMD_X86
+    if (kserial_simd_current() == KSERIAL_SIMD_AVX2)
+    {
+        i = kserial_decode_avx2(src, pk->type, type, pdata, lens);
+    }
 #endif
+
+    switch (pk->type)
+    {
+        case KS_U8:  KSERIAL_DECODE_SCALAR(src[i]);                                             break;
+        case KS_I8:  KSERIAL_DECODE_SCALAR((int8_t)src[i]);                                     break;
+        case KS_U16: KSERIAL_DECODE_SCALAR(kserial_load16(&src[2 * i]));                        break;
+        case KS_I16: KSERIAL_DECODE_SCALAR((int16_t)kserial_load16(&src[2 * i]));               break;
+        case KS_U32: KSERIAL_DECODE_SCALAR(kserial_load32(&src[4 * i]));                        break;
+        case KS_I32: KSERIAL_DECODE_SCALAR((int32_t)kserial_load32(&src[4 * i]));               break;
+        case KS_U64: KSERIAL_DECODE_SCALAR(kserial_load64(&src[8 * i]));                        break;
+        case KS_I64: KSERIAL_DECODE_SCALAR((int64_t)kserial_load64(&src[8 * i]));               break;
+        case KS_F16: KSERIAL_DECODE_SCALAR(kserial_f16_to_f32(kserial_load16(&src[2 * i])));    break;
+        case KS_F32: KSERIAL_DECODE_SCALAR(kserial_f32_from_bits(kserial_load32(&src[4 * i]))); break;
+        case KS_F64: KSERIAL_DECODE_SCALAR(kserial_f64_from_bits(kserial_load64(&src[8 * i]))); break;
+        default:                                                                                break;
+    }
+
+    return lens;
 }
 
 /**
- *  @brief  kserial_recv_packet
+ *  @brief  kserial_delta_load
  */
-uint32_t kserial_recv_packet(uint8_t input, void *param, void *pdata, uint32_t *lens, uint32_t *type)
+static inline uint64_t kserial_delta_load(const void *pdata, uint32_t typesize, uint32_t index)
 {
-#if KSERIAL_RECV_ENABLE
-    static uint32_t index = 0;
-    static uint32_t bytes = 0;
-    static uint32_t point = 0;
+    switch (typesize)
+    {
+        case 1:  return ((const uint8_t *)pdata)[index];
+        case 2:  return ((const uint16_t *)pdata)[index];
+        case 4:  return ((const uint32_t *)pdata)[index];
+        default: return ((const uint64_t *)pdata)[index];
+    }
+}
 
-    uint32_t state;
-    uint32_t typesize;
+/**
+ *  @brief  kserial_delta_store
+ */
+static inline void kserial_delta_store(void *pdata, uint32_t typesize, uint32_t index, uint64_t value)
+{
+    switch (typesize)
+    {
+        case 1:  ((uint8_t *)pdata)[index] = (uint8_t)value;    break;
+        case 2:  ((uint16_t *)pdata)[index] = (uint16_t)value;  break;
+        case 4:  ((uint32_t *)pdata)[index] = (uint32_t)value;  break;
+        default: ((uint64_t *)pdata)[index] = value;            break;
+    }
+}
+
+/**
+ *  @brief  kserial_delta_encode
+ *  Return the bytes written to dst, 0 when more than limit bytes are needed.
+ */
+static uint32_t kserial_delta_encode(uint8_t *dst, uint32_t limit, const void *pdata, uint32_t typesize, uint32_t lens)
+{
+    uint32_t bits = typesize * 8;
+    uint64_t mask = (bits == 64) ? UINT64_MAX : ((1ULL << bits) - 1);
+    uint64_t prev = 0;
+    uint64_t value;
+    uint64_t delta;
+    uint32_t nbyte = 0;
+
+    for (uint32_t i = 0; i < lens; i++)
+    {
+        value = kserial_delta_load(pdata, typesize, i);
+        // difference in the element width, sign extended, then zig-zag
+        delta = (value - prev) & mask;
+        if ((delta >> (bits - 1)) & 1)
+        {
+            delta |= ~mask;
+        }
+        delta = (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+        do
+        {
+            if (nbyte >= limit)
+            {
+                return 0;
+            }
+            dst[nbyte++] = (uint8_t)((delta & 0x7F) | ((delta > 0x7F) ? 0x80 : 0x00));
+            delta >>= 7;
+        }
+        while (delta);
+        prev = value;
+    }
+
+    return nbyte;
+}
+
+/**
+ *  @brief  kserial_pack_delta
+ *  Pack an integer array (U8 ~ I64) as R4, the payload is the original type followed by the
+ *  zig-zag varint of each difference to the previous element, the first to 0. A plain packet is
+ *  packed when that is not shorter, packet holds min(lens * typesize, KSERIAL_MAX_DATA_BYTES) + 8
+ *  bytes. Return the packet bytes, 0 if neither fits in one frame.
+ */
+uint32_t kserial_pack_delta(uint8_t *packet, const void *param, uint32_t type, uint32_t lens, const void *pdata)
+{
+    uint32_t typesize = kserial_get_typesize(type);
+    uint32_t raw = lens * typesize;
+    uint32_t limit;
+    uint32_t nbyte = 0;
+
+    if ((type <= KS_I64) && (lens != 0))
+    {
+        // payload strictly shorter than the plain one, byte 0 is the type
+        limit = (raw > KSERIAL_MAX_DATA_BYTES) ? (KSERIAL_MAX_DATA_BYTES - 1) : ((raw > 2) ? (raw - 2) : 0);
+        nbyte = kserial_delta_encode(&packet[8], limit, pdata, typesize, lens);
+    }
+    if (nbyte == 0)
+    {
+        return ((typesize == 0) || (raw > KSERIAL_MAX_DATA_BYTES)) ? 0 : kserial_pack(packet, param, type, lens, pdata);
+    }
+    nbyte++;
+    kserial_pack_header(packet, param, KS_R4, nbyte);
+    packet[7] = type;
+    packet[7 + nbyte] = '\r';
+
+    return (nbyte + 8);
+}
+
+#ifdef KSERIAL_SIMD_X86
+/**
+ *  @brief  kserial_delta_sse2
+ *  Expand blocks of 16 one-byte varints with a prefix sum, stop at the first longer varint.
+ *  Return the number of elements written, *pos and *prev are advanced.
+ */
+__attribute__((target("sse2")))
+static uint32_t kserial_delta_sse2(const uint8_t *src, uint32_t nbyte, uint32_t *pos, void *pdata, uint32_t typesize, uint32_t lens, uint64_t *prev)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v, w, d;
+    uint32_t i = 0;
+
+    while (((*pos + 16) <= nbyte) && ((i + 16) <= lens))
+    {
+        v = _mm_loadu_si128((const __m128i *)&src[*pos]);
+        if (_mm_movemask_epi8(v) != 0)
+        {
+            break;
+        }
+        if (typesize == 1)
+        {
+            d = _mm_xor_si128(_mm_and_si128(_mm_srli_epi16(v, 1), _mm_set1_epi8(0x7F)), _mm_sub_epi8(zero, _mm_and_si128(v, _mm_set1_epi8(1))));
+            d = _mm_add_epi8(d, _mm_slli_si128(d, 1));
+            d = _mm_add_epi8(d, _mm_slli_si128(d, 2));
+            d = _mm_add_epi8(d, _mm_slli_si128(d, 4));
+            d = _mm_add_epi8(d, _mm_slli_si128(d, 8));
+            d = _mm_add_epi8(d, _mm_set1_epi8((char)*prev));
+            _mm_storeu_si128((__m128i *)&((uint8_t *)pdata)[i], d);
+            *prev = (uint8_t)(_mm_extract_epi16(d, 7) >> 8);
+        }
+        else if (typesize == 2)
+        {
+            for (uint32_t k = 0; k < 2; k++)
+            {
+                w = (k == 0) ? _mm_unpacklo_epi8(v, zero) : _mm_unpackhi_epi8(v, zero);
+                d = _mm_xor_si128(_mm_srli_epi16(w, 1), _mm_sub_epi16(zero, _mm_and_si128(w, _mm_set1_epi16(1))));
+                d = _mm_add_epi16(d, _mm_slli_si128(d, 2));
+                d = _mm_add_epi16(d, _mm_slli_si128(d, 4));
+                d = _mm_add_epi16(d, _mm_slli_si128(d, 8));
+                d = _mm_add_epi16(d, _mm_set1_epi16((short)*prev));
+                _mm_storeu_si128((__m128i *)&((uint16_t *)pdata)[i + 8 * k], d);
+                *prev = (uint16_t)_mm_extract_epi16(d, 7);
+            }
+        }
+        else
+        {
+            for (uint32_t k = 0; k < 4; k++)
+            {
+                w = (k < 2) ? _mm_unpacklo_epi8(v, zero) : _mm_unpackhi_epi8(v, zero);
+                w = (k & 1) ? _mm_unpackhi_epi16(w, zero) : _mm_unpacklo_epi16(w, zero);
+                d = _mm_xor_si128(_mm_srli_epi32(w, 1), _mm_sub_epi32(zero, _mm_and_si128(w, _mm_set1_epi32(1))));
+                d = _mm_add_epi32(d, _mm_slli_si128(d, 4));
+                d = _mm_add_epi32(d, _mm_slli_si128(d, 8));
+                d = _mm_add_epi32(d, _mm_set1_epi32((int)*prev));
+                _mm_storeu_si128((__m128i *)&((uint32_t *)pdata)[i + 4 * k], d);
+                *prev = (uint32_t)_mm_cvtsi128_si32(_mm_shuffle_epi32(d, 0xFF));
+            }
+        }
+        i += 16;
+        *pos += 16;
+    }
 
-    rbuffer[point] = input;
-    if (point > 6)
+    return i;
+}
+#endif
+
+/**
+ *  @brief  kserial_unpack_delta
+ *  Expand an R4 packet of kserial_pack_delta into pdata, at most lens elements of the original
+ *  type returned in type. Return the number of elements, 0 if pk is not a delta packet.
+ */
+uint32_t kserial_unpack_delta(const kserial_packet_t *pk, uint32_t *type, void *pdata, uint32_t lens)
+{
+    const uint8_t *src = (const uint8_t *)pk->data;
+    uint32_t typesize;
+    uint32_t bits;
+    uint32_t pos = 1;
+    uint32_t shift;
+    uint32_t i = 0;
+    uint64_t mask;
+    uint64_t prev = 0;
+    uint64_t delta;
+#ifdef KSERIAL_SIMD_X86
+    uint32_t isa;
+#endif
+
+    if ((pk->type != KS_R4) || (pk->nbyte == 0) || (src == NULL) || (src[0] > KS_I64))
+    {
+        return 0;
+    }
+    *type = src[0];
+    typesize = kserial_get_typesize(*type);
+    bits = typesize * 8;
+    mask = (bits == 64) ? UINT64_MAX : ((1ULL << bits) - 1);
+#ifdef KSERIAL_SIMD_X86
+    isa = kserial_simd_current();
+#endif
+
+    while ((pos < pk->nbyte) && (i < lens))
+    {
+#ifdef KSERIAL_SIMD_X86
+        if ((isa != KSERIAL_SIMD_NONE) && (typesize < 8) && !(src[pos] & 0x80))
+        {
+            i += kserial_delta_sse2(src, pk->nbyte, &pos, (uint8_t *)pdata + i * typesize, typesize, lens - i, &prev);
+            if ((pos >= pk->nbyte) || (i >= lens))
+            {
+                break;
+            }
+        }
+#endif
+        delta = 0;
+        shift = 0;
+        do
+        {
+            if ((pos >= pk->nbyte) || (shift >= 64))
+            {   // truncated varint
+                return i;
+            }
+            delta |= (uint64_t)(src[pos] & 0x7F) << shift;
+            shift += 7;
+        }
+        while (src[pos++] & 0x80);
+        delta = (delta >> 1) ^ (0 - (delta & 1));
+        prev = (prev + delta) & mask;
+        kserial_delta_store(pdata, typesize, i++, prev);
+    }
+
+    return i;
+}
+
+/**
+ *  @brief  kserial_ring_copy
+ */
+static void kserial_ring_copy(void *pdata, const uint8_t *ring, uint32_t size, uint32_t start, uint32_t nbyte)
+{
+    uint32_t part = size - start;
+
+    if (nbyte <= part)
+    {
+        memcpy(pdata, &ring[start], nbyte);
+    }
+    else
+    {
+        memcpy(pdata, &ring[start], part);
+        memcpy(&((uint8_t*)pdata)[part], ring, nbyte - part);
+    }
+}
+
+/**
+ *  @brief  kserial_ring_write
+ */
+static void kserial_ring_write(uint8_t *ring, uint32_t size, uint32_t start, const void *pdata, uint32_t nbyte)
+{
+    uint32_t part = size - start;
+
+    if (nbyte <= part)
+    {
+        memcpy(&ring[start], pdata, nbyte);
+    }
+    else
+    {
+        memcpy(&ring[start], pdata, part);
+        memcpy(ring, &((const uint8_t*)pdata)[part], nbyte - part);
+    }
+}
+
+/**
+ *  @brief  kserial_parse
+ *  Advance the frame state machine over ring[index & mask] until tail, index and tail are free running.
+ *  Return KS_OK with the frame at ps->start when ER is accepted, KS_BUSY when all input is consumed.
+ *  Every byte is examined once, payload bytes are skipped, only a rejected checksum or terminator
+ *  rewinds to the byte after the rejected 'K' to resynchronise, each discarded byte is counted once in st.
+ */
+static uint32_t kserial_parse(kserial_parser_t *ps, kserial_counters_t *st, const uint8_t *ring, uint32_t mask, uint32_t tail)
+{
+    uint8_t input;
+    uint32_t end;
+    uint32_t lens;
+    uint32_t skip;
+
+    while (ps->index != tail)
+    {
+        if (ps->state == KSERIAL_STATE_HK)
+        {   // jump to the next 'K','S' candidate in the contiguous part of the ring
+            lens = tail - ps->index;
+            if ((lens - 1) > (mask - (ps->index & mask)))
+            {
+                lens = mask - (ps->index & mask) + 1;
+            }
+            skip = atomic_load_explicit(&kserial_find_sync_isa, memory_order_relaxed)(&ring[ps->index & mask], lens);
+            ps->index += skip;
+            KSERIAL_COUNT(st->skipped, skip);
+            if (skip == lens)
+            {
+                continue;
+            }
+        }
+        if (ps->state == KSERIAL_STATE_DN)
+        {
+            end = ps->start + 7 + ps->nbyte;
+            if ((end - ps->index) > (tail - ps->index))
+            {
+                ps->index = tail;
+                break;
+            }
+            ps->index = end;
+            ps->state = KSERIAL_STATE_ER;
+            continue;
+        }
+
+        input = ring[ps->index & mask];
+        switch (ps->state)
+        {
+            case KSERIAL_STATE_HK:
+            {
+                if (input == 'K')
+                {
+                    ps->start = ps->index;
+                    ps->state = KSERIAL_STATE_HS;
+                }
+                else
+                {
+                    KSERIAL_COUNT(st->skipped, 1);
+                }
+                break;
+            }
+            case KSERIAL_STATE_HS:
+            {
+                if (input == 'S')
+                {
+                    ps->state = KSERIAL_STATE_TP;
+                }
+                else if (input == 'K')
+                {
+                    ps->start = ps->index;
+                    KSERIAL_COUNT(st->skipped, 1);
+                }
+                else
+                {
+                    ps->state = KSERIAL_STATE_HK;
+                    KSERIAL_COUNT(st->skipped, 2);
+                }
+                break;
+            }
+            case KSERIAL_STATE_TP:
+            {
+                ps->type = input >> 4;
+                ps->nbyte = (uint32_t)(input & 0x0F) << 8;
+                ps->checksum = input;
+                ps->state = KSERIAL_STATE_LN;
+                break;
+            }
+            case KSERIAL_STATE_LN:
+            {
+                ps->nbyte |= input;
+                ps->checksum += input;
+                ps->state = KSERIAL_STATE_P1;
+                break;
+            }
+            case KSERIAL_STATE_P1:
+            {
+                ps->param[0] = input;
+                ps->checksum += input;
+                ps->state = KSERIAL_STATE_P2;
+                break;
+            }
+            case KSERIAL_STATE_P2:
+            {
+                ps->param[1] = input;
+                ps->checksum += input;
+                ps->state = KSERIAL_STATE_CK;
+                break;
+            }
+            case KSERIAL_STATE_CK:
+            {
+                if ((ps->checksum & 0xFF) != input)
+                {
+                    KSERIAL_COUNT(st->checksum, 1);
+                    KSERIAL_COUNT(st->skipped, 1);
+                    ps->index = ps->start + 1;
+                    ps->state = KSERIAL_STATE_HK;
+                    continue;
+                }
+                ps->state = (ps->nbyte) ? KSERIAL_STATE_DN : KSERIAL_STATE_ER;
+                break;
+            }
+            case KSERIAL_STATE_ER:
+            {
+                if (input != '\r')
+                {
+                    KSERIAL_COUNT(st->terminator, 1);
+                    KSERIAL_COUNT(st->skipped, 1);
+                    ps->index = ps->start + 1;
+                    ps->state = KSERIAL_STATE_HK;
+                    continue;
+                }
+                ps->index++;
+                ps->state = KSERIAL_STATE_HK;
+                return KS_OK;
+            }
+            default:
+            {
+                ps->state = KSERIAL_STATE_HK;
+                break;
+            }
+        }
+        ps->index++;
+    }
+
+    return KS_BUSY;
+}
+
+#if KSERIAL_TIMESTAMP_ENABLE
+/**
+ *  @brief  kserial_mark_time
+ *  Clock of the read that delivered the byte at free-running index, 0 if no read is recorded.
+ */
+static uint64_t kserial_mark_time(const kserial_t *ks, uint32_t index)
+{
+    const kserial_mark_t *mk;
+
+    for (uint32_t i = ks->markhead; i != ks->marktail; i++)
+    {
+        mk = &ks->mark[i & (KSERIAL_TIME_MARKS - 1)];
+        if ((int32_t)(mk->end - index) > 0)
+        {
+            return mk->time;
+        }
+    }
+    return 0;
+}
+#endif
+
+/**
+ *  @brief  kserial_parse_packet
+ *  Parse the next frame of ks into pk, the payload is stored according to ks->mode.
+ *  Return KS_BUSY when no complete frame is left or the arena is full,
+ *  frames larger than the whole arena are dropped and counted as skipped.
+ */
+static uint32_t kserial_parse_packet(kserial_t *ks, kserial_packet_t *pk, uint32_t mask, uint32_t *used)
+{
+    kserial_parser_t *ps = &ks->parser;
+    uint32_t start;
+    uint32_t nbyte;
+    uint32_t typesize;
+#if KSERIAL_SEQUENCE_ENABLE
+    uint32_t stamped;
+#endif
+
+    while (1)
+    {
+        if (kserial_parse(ps, &ks->stats, ks->buffer, mask, ks->tail) != KS_OK)
+        {
+            return KS_BUSY;
+        }
+        start = (ps->start + 7) & mask;
+        nbyte = ps->nbyte;
+        typesize = kserial_get_typesize(ps->type);
+#if KSERIAL_SEQUENCE_ENABLE
+        // numeric frames end with the sequence number once it is negotiated
+        stamped = (ks->seq != NULL) && (typesize != 0) && (nbyte >= 2);
+        if (stamped)
+        {
+            nbyte -= 2;
+        }
+#endif
+        if ((ks->mode != KSERIAL_PACKET_ARENA) || (nbyte <= ks->arenasize))
+        {
+            break;
+        }
+        // never fits the arena, drop the frame instead of waiting for space
+        KSERIAL_COUNT(ks->stats.skipped, ps->nbyte + 8);
+    }
+    if (ks->mode == KSERIAL_PACKET_VIEW)
+    {
+        if ((start + nbyte) > ks->size)
+        {   // unwrap into the spare bytes behind the ring
+            memcpy(&ks->buffer[ks->size], ks->buffer, start + nbyte - ks->size);
+        }
+        pk->data = &ks->buffer[start];
+    }
+    else if (ks->mode == KSERIAL_PACKET_ARENA)
+    {
+        if ((*used + nbyte) > ks->arenasize)
+        {   // parse again after the arena is released
+            ps->index = ps->start;
+            return KS_BUSY;
+        }
+        pk->data = &ks->arena[*used];
+        kserial_ring_copy(pk->data, ks->buffer, ks->size, start, nbyte);
+        *used += nbyte;
+    }
+    else if (ks->mode == KSERIAL_PACKET_POOL)
+    {
+        pk->data = NULL;
+        if (nbyte != 0)
+        {
+            pk->data = kserial_pool_alloc(ks->pool, nbyte);
+            if (pk->data == NULL)
+            {   // every fitting slab is held, parse again after packets are released
+                ps->index = ps->start;
+                return KS_BUSY;
+            }
+            kserial_ring_copy(pk->data, ks->buffer, ks->size, start, nbyte);
+        }
+    }
+    else
+    {
+        pk->data = (void *)malloc(nbyte * sizeof(uint8_t));
+        kserial_ring_copy(pk->data, ks->buffer, ks->size, start, nbyte);
+    }
+    pk->param[0] = ps->param[0];
+    pk->param[1] = ps->param[1];
+    pk->type = ps->type;
+    pk->nbyte = nbyte;
+    pk->lens = (typesize > 1) ? (pk->nbyte / typesize) : pk->nbyte;
+#if KSERIAL_TIMESTAMP_ENABLE
+    pk->tfirst = kserial_mark_time(ks, ps->start);
+    pk->tlast = kserial_mark_time(ks, ps->index - 1);
+#endif
+#if KSERIAL_SEQUENCE_ENABLE
+    pk->seq = 0;
+    if (stamped)
+    {
+        pk->seq = ks->buffer[(start + nbyte) & mask] | (ks->buffer[(start + nbyte + 1) & mask] << 8);
+        kserial_seq_update(ks->seq, pk);
+    }
+#endif
+    KSERIAL_COUNT(ks->stats.frames, 1);
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_unpack_frames
+ *  Return the number of bytes consumed, the remaining bytes belong to an incomplete packet.
+ */
+static uint32_t kserial_unpack_frames(const uint8_t *buffer, uint32_t buffersize, kserial_packet_t *ksp, uint32_t *count,
+                                      uint32_t mode, uint8_t *arena, uint32_t arenasize)
+{
+    kserial_t ks = {0};
+    uint32_t used = 0;
+
+    // linear buffer, parse with an identity mask
+    ks.size = buffersize;
+    ks.tail = buffersize;
+    ks.buffer = (uint8_t *)buffer;
+    ks.mode = mode;
+    ks.arena = arena;
+    ks.arenasize = arenasize;
+
+    *count = 0;
+    while (kserial_parse_packet(&ks, &ksp[*count], 0xFFFFFFFF, &used) == KS_OK)
+    {
+        (*count)++;
+    }
+
+    return (ks.parser.state == KSERIAL_STATE_HK) ? ks.parser.index : ks.parser.start;
+}
+
+/**
+ *  @brief  kserial_unpack_buffer
+ *  Payload of each packet is malloc'ed, release with kserial_get_packetdata.
+ */
+uint32_t kserial_unpack_buffer(const uint8_t *buffer, uint32_t buffersize, kserial_packet_t *ksp, uint32_t *count)
+{
+    return kserial_unpack_frames(buffer, buffersize, ksp, count, KSERIAL_PACKET_COPY, NULL, 0);
+}
+
+/**
+ *  @brief  kserial_unpack_buffer_view
+ *  Packet data points into buffer, valid as long as buffer is not modified.
+ */
+uint32_t kserial_unpack_buffer_view(const uint8_t *buffer, uint32_t buffersize, kserial_packet_t *ksp, uint32_t *count)
+{
+    return kserial_unpack_frames(buffer, buffersize, ksp, count, KSERIAL_PACKET_VIEW, NULL, 0);
+}
+
+/**
+ *  @brief  kserial_unpack_buffer_arena
+ *  Packet data is placed back to back in arena, stop unpacking when the arena is full.
+ *  Frames with more payload than arenasize are consumed and dropped.
+ */
+uint32_t kserial_unpack_buffer_arena(const uint8_t *buffer, uint32_t buffersize, kserial_packet_t *ksp, uint32_t *count, uint8_t *arena, uint32_t arenasize)
+{
+    return kserial_unpack_frames(buffer, buffersize, ksp, count, KSERIAL_PACKET_ARENA, arena, arenasize);
+}
+
+#if KSERIAL_RECV_ENABLE
+/**
+ *  @brief  kserial_unpack_ring
+ *  Continue parsing where the previous read stopped, frames may wrap across the end of the ring.
+ */
+static void kserial_unpack_ring(kserial_t *ks)
+{
+    kserial_parser_t *ps = &ks->parser;
+    uint32_t used = 0;
+
+    while ((ks->pkcnt < ks->pksize) && (kserial_parse_packet(ks, &ks->packet[ks->pkcnt], ks->size - 1, &used) == KS_OK))
+    {
+#if KSERIAL_TAP_ENABLE
+        if ((ks->tap != NULL) && (ks->tap->frame != NULL))
+        {
+            ks->tap->frame(ks->tap->user, &ks->packet[ks->pkcnt], ks->tail - ps->start, ps->index - ps->start);
+        }
+#endif
+        ks->pkcnt++;
+    }
+    // keep the frame being parsed
+    ks->index = (ps->state == KSERIAL_STATE_HK) ? ps->index : ps->start;
+}
+#endif
+
+#if KSERIAL_SERIAL_ENABLE
+/**
+ *  @brief  kserial_serial_send
+ */
+static uint32_t kserial_serial_send(void *handle, const void *data, uint32_t lens)
+{
+#if KSERIAL_SEND_ENABLE
+    if (handle == NULL)
+    {
+        kserial_send((uint8_t *)data, lens);
+    }
+    else
+    {
+        serial_send_data((serial_t *)handle, (uint8_t *)data, lens);
+    }
+    return lens;
+#else
+    return 0;
+#endif
+}
+
+/**
+ *  @brief  kserial_serial_recv
+ */
+static uint32_t kserial_serial_recv(void *handle, void *data, uint32_t lens)
+{
+#if KSERIAL_RECV_ENABLE
+    if (handle == NULL)
+    {
+        return kserial_recv((uint8_t *)data, lens);
+    }
+    return serial_recv_data((serial_t *)handle, (uint8_t *)data, lens);
+#else
+    return 0;
+#endif
+}
+
+/**
+ *  @brief  kserial_serial_flush
+ */
+static void kserial_serial_flush(void *handle)
+{
+#if KSERIAL_RECV_ENABLE
+    if (handle == NULL)
+    {
+        kserial_flush_recv();
+    }
+    else
+    {
+        serial_flush((serial_t *)handle);
+    }
+#endif
+}
+
+/**
+ *  @brief  kserial_serial_wait
+ *  serial.h has no readiness notification, sleep one tick at most.
+ */
+static uint32_t kserial_serial_wait(void *handle, uint32_t timeout)
+{
+    (void)handle;
+    kserial_delay((timeout > 1) ? 1 : timeout);
+    return KS_OK;
+}
+#endif
+
+/**
+ *  @brief  kserial_pool_align
+ */
+static uint32_t kserial_pool_align(uint32_t bytes)
+{
+    return (bytes + 7U) & ~7U;
+}
+
+/**
+ *  @brief  kserial_pool_bytes
+ *  Bytes of the block carved by kserial_pool_init: packet table, ring and slabs.
+ */
+uint32_t kserial_pool_bytes(const kserial_pool_conf_t *conf)
+{
+    uint32_t bytes;
+
+    bytes = kserial_pool_align(conf->pksize * sizeof(kserial_packet_t));
+    bytes += kserial_pool_align(conf->size + KSERIAL_MAX_DATA_BYTES);
+    for (uint32_t i = 0; i < KSERIAL_POOL_CLASSES; i++)
+    {
+        bytes += conf->slabs[i] * KSERIAL_POOL_SLAB_SIZE(i);
+    }
+    return bytes;
+}
+
+/**
+ *  @brief  kserial_pool_init
+ *  Carve memory into the packet table, the receive ring and one free list per slab class.
+ *  memory : NULL to allocate the block once here, else bytes from kserial_pool_bytes, 8-byte aligned
+ *  The largest class with slabs must hold KSERIAL_MAX_DATA_BYTES, or a frame no slab can ever
+ *  take would stall the parser for good.
+ */
+uint32_t kserial_pool_init(kserial_pool_t *pool, const kserial_pool_conf_t *conf, void *memory, uint32_t bytes)
+{
+    uint32_t need = kserial_pool_bytes(conf);
+    uint32_t largest = 0;
+    kserial_slab_t *sb;
+    uint8_t *block;
+    uint8_t *slab;
+
+    for (uint32_t i = 0; i < KSERIAL_POOL_CLASSES; i++)
+    {
+        if (conf->slabs[i] != 0)
+        {
+            largest = KSERIAL_POOL_SLAB_SIZE(i);
+        }
+    }
+    if (((conf->size & (conf->size - 1)) != 0) || (conf->size < (KSERIAL_MAX_DATA_BYTES + 8)) || (conf->pksize == 0) ||
+        (largest < KSERIAL_MAX_DATA_BYTES))
+    {
+        return KS_ERROR;
+    }
+    memset(pool, 0, sizeof(kserial_pool_t));
+    if (memory == NULL)
+    {
+        memory = malloc(need);
+        if (memory == NULL)
+        {
+            return KS_ERROR;
+        }
+        pool->memory = memory;
+    }
+    else if (bytes < need)
+    {
+        return KS_ERROR;
+    }
+    block = (uint8_t *)memory;
+
+    pool->pksize = conf->pksize;
+    pool->packet = (kserial_packet_t *)block;
+    block += kserial_pool_align(conf->pksize * sizeof(kserial_packet_t));
+    pool->size = conf->size;
+    pool->buffer = block;
+    block += kserial_pool_align(conf->size + KSERIAL_MAX_DATA_BYTES);
+
+    for (uint32_t i = 0; i < KSERIAL_POOL_CLASSES; i++)
+    {
+        sb = &pool->slab[i];
+        sb->size = KSERIAL_POOL_SLAB_SIZE(i);
+        sb->count = conf->slabs[i];
+        sb->avail = conf->slabs[i];
+        sb->base = block;
+        sb->next = NULL;
+        for (uint32_t n = sb->count; n > 0; n--)
+        {   // link back to front, the first slab is handed out first
+            slab = &block[(n - 1) * sb->size];
+            memcpy(slab, &sb->next, sizeof(void *));
+            sb->next = slab;
+        }
+        block += sb->count * sb->size;
+    }
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_pool_deinit
+ */
+void kserial_pool_deinit(kserial_pool_t *pool)
+{
+    free(pool->memory);
+    memset(pool, 0, sizeof(kserial_pool_t));
+}
+
+/**
+ *  @brief  kserial_pool_alloc
+ *  Smallest free slab holding nbyte, a larger class when that one is empty.
+ *  Return NULL when no slab is left.
+ */
+void *kserial_pool_alloc(kserial_pool_t *pool, uint32_t nbyte)
+{
+    kserial_slab_t *sb;
+    void *data;
+
+    for (uint32_t i = 0; i < KSERIAL_POOL_CLASSES; i++)
+    {
+        sb = &pool->slab[i];
+        if ((sb->size >= nbyte) && (sb->next != NULL))
+        {
+            data = sb->next;
+            memcpy(&sb->next, data, sizeof(void *));
+            sb->avail--;
+            return data;
+        }
+    }
+    pool->fail++;
+
+    return NULL;
+}
+
+/**
+ *  @brief  kserial_pool_free
+ */
+void kserial_pool_free(kserial_pool_t *pool, void *data)
+{
+    uintptr_t addr = (uintptr_t)data;
+    kserial_slab_t *sb;
+
+    if (data == NULL)
+    {
+        return;
+    }
+    for (uint32_t i = 0; i < KSERIAL_POOL_CLASSES; i++)
+    {
+        sb = &pool->slab[i];
+        if ((addr >= (uintptr_t)sb->base) && (addr < ((uintptr_t)sb->base + sb->count * sb->size)))
+        {
+            memcpy(data, &sb->next, sizeof(void *));
+            sb->next = data;
+            sb->avail++;
+            return;
+        }
+    }
+}
+
+/**
+ *  @brief  kserial_ctx_init
+ *  buffer holds size + KSERIAL_MAX_DATA_BYTES bytes, size must be a power of two.
+ */
+uint32_t kserial_ctx_init(kserial_ctx_t *ctx, const kserial_transport_t *transport, void *handle,
+                          uint8_t *buffer, uint32_t size, kserial_packet_t *packet, uint32_t pksize)
+{
+    if (((size & (size - 1)) != 0) || (size < (KSERIAL_MAX_DATA_BYTES + 8)))
+    {
+        return KS_ERROR;
+    }
+    memset(ctx, 0, sizeof(kserial_ctx_t));
+    ctx->transport = transport;
+    ctx->handle = handle;
+    ctx->ks.size = size;
+    ctx->ks.buffer = buffer;
+    ctx->ks.packet = packet;
+    ctx->ks.pksize = pksize;
+    ctx->ks.mode = KSERIAL_PACKET_COPY;
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_ctx_init_pool
+ *  Receive ring and packet table come from pool, payloads are pool slabs.
+ */
+uint32_t kserial_ctx_init_pool(kserial_ctx_t *ctx, const kserial_transport_t *transport, void *handle, kserial_pool_t *pool)
+{
+    if (kserial_ctx_init(ctx, transport, handle, pool->buffer, pool->size, pool->packet, pool->pksize) != KS_OK)
+    {
+        return KS_ERROR;
+    }
+    ctx->ks.mode = KSERIAL_PACKET_POOL;
+    ctx->ks.pool = pool;
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_set_transport
+ *  Transport of the api without _ctx suffix.
+ */
+void kserial_set_transport(const kserial_transport_t *transport, void *handle)
+{
+    ksctx.transport = transport;
+    ksctx.handle = handle;
+}
+
+/**
+ *  @brief  kserial_wait_ctx
+ *  Wait up to timeout ms for input, return KS_TIMEOUT if nothing arrived.
+ */
+uint32_t kserial_wait_ctx(kserial_ctx_t *ctx, uint32_t timeout)
+{
+    if ((ctx->transport == NULL) || (ctx->transport->wait == NULL))
+    {
+        return KS_ERROR;
+    }
+    return ctx->transport->wait(ctx->handle, timeout);
+}
+
+/**
+ *  @brief  kserial_now_ctx
+ *  Monotonic time in ns, 0 if the transport has no clock.
+ */
+uint64_t kserial_now_ctx(kserial_ctx_t *ctx)
+{
+    if ((ctx->transport == NULL) || (ctx->transport->now == NULL))
+    {
+        return 0;
+    }
+    return ctx->transport->now(ctx->handle);
+}
+
+/**
+ *  @brief  kserial_set_baudrate_ctx
+ *  Switch the local port of ctx, KS_ERROR if the transport cannot.
+ */
+uint32_t kserial_set_baudrate_ctx(kserial_ctx_t *ctx, uint32_t baudrate)
+{
+    if ((ctx->transport == NULL) || (ctx->transport->setbaud == NULL))
+    {
+        return KS_ERROR;
+    }
+    return ctx->transport->setbaud(ctx->handle, baudrate);
+}
+
+#if KSERIAL_SEND_ENABLE
+/**
+ *  @brief  kserial_ctx_trylock
+ *  Frames go out whole, a read thread granting credit must not interleave with the caller.
+ */
+static uint32_t kserial_ctx_trylock(kserial_ctx_t *ctx)
+{
+#if KSERIAL_CREDIT_ENABLE
+    return (atomic_exchange_explicit(&ctx->sending, 1, memory_order_acquire) == 0) ? KS_OK : KS_BUSY;
+#else
+    (void)ctx;
+    return KS_OK;
+#endif
+}
+
+/**
+ *  @brief  kserial_ctx_lock
+ *  Only a grant competes with the caller, it holds the transport for one short write.
+ */
+static void kserial_ctx_lock(kserial_ctx_t *ctx)
+{
+    while (kserial_ctx_trylock(ctx) != KS_OK)
+    {
+    }
+}
+
+/**
+ *  @brief  kserial_ctx_unlock
+ */
+static void kserial_ctx_unlock(kserial_ctx_t *ctx)
+{
+#if KSERIAL_CREDIT_ENABLE
+    atomic_store_explicit(&ctx->sending, 0, memory_order_release);
+#else
+    (void)ctx;
+#endif
+}
+
+/**
+ *  @brief  kserial_ctx_write
+ */
+static void kserial_ctx_write(kserial_ctx_t *ctx, uint8_t *data, uint32_t lens)
+{
+    if (ctx->transport != NULL)
+    {
+        kserial_ctx_lock(ctx);
+        ctx->transport->send(ctx->handle, data, lens);
+        kserial_ctx_unlock(ctx);
+    }
+}
+
+/**
+ *  @brief  kserial_ctx_writev
+ *  One vectored write when the transport has sendv, else one write per segment.
+ *  Return the bytes written, the transport stopped early when less than requested.
+ */
+static uint32_t kserial_ctx_writev(kserial_ctx_t *ctx, const kserial_iovec_t *iov, uint32_t count)
+{
+    uint32_t nbyte = 0;
+    uint32_t ret;
+
+    if (ctx->transport == NULL)
+    {
+        return 0;
+    }
+    kserial_ctx_lock(ctx);
+    if (ctx->transport->sendv != NULL)
+    {
+        nbyte = ctx->transport->sendv(ctx->handle, iov, count);
+    }
+    else
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            ret = ctx->transport->send(ctx->handle, iov[i].data, iov[i].lens);
+            nbyte += ret;
+            if (ret < iov[i].lens)
+            {
+                break;
+            }
+        }
+    }
+    kserial_ctx_unlock(ctx);
+
+    return nbyte;
+}
+#endif
+
+#if KSERIAL_RECV_ENABLE
+/**
+ *  @brief  kserial_ctx_read
+ */
+static uint32_t kserial_ctx_read(kserial_ctx_t *ctx, uint8_t *data, uint32_t lens)
+{
+    if (ctx->transport == NULL)
+    {
+        return 0;
+    }
+    return ctx->transport->recv(ctx->handle, data, lens);
+}
+
+/**
+ *  @brief  kserial_ctx_flush
+ */
+static void kserial_ctx_flush(kserial_ctx_t *ctx)
+{
+    if ((ctx->transport != NULL) && (ctx->transport->flush != NULL))
+    {
+        ctx->transport->flush(ctx->handle);
+    }
+}
+#endif
+
+/**
+ *  @brief  kserial_send_packet_ctx
+ */
+uint32_t kserial_send_packet_ctx(kserial_ctx_t *ctx, void *param, void *pdata, uint32_t lens, uint32_t type)
+{
+#if KSERIAL_SEND_ENABLE
+    uint32_t nbytes;
+    nbytes = kserial_pack(ctx->sbuffer, param, type, lens, pdata);
+    kserial_ctx_write(ctx, ctx->sbuffer, nbytes);
+    // TODO: fix return
+    return nbytes;
+#else
+    return KS_ERROR;
+#endif
+}
+
+/**
+ *  @brief  kserial_send_delta_ctx
+ *  Send an integer array with kserial_pack_delta, return KS_ERROR if it does not fit one frame.
+ */
+uint32_t kserial_send_delta_ctx(kserial_ctx_t *ctx, void *param, void *pdata, uint32_t lens, uint32_t type)
+{
+#if KSERIAL_SEND_ENABLE
+    uint32_t nbytes;
+    nbytes = kserial_pack_delta(ctx->sbuffer, param, type, lens, pdata);
+    if (nbytes == 0)
+    {
+        return KS_ERROR;
+    }
+    kserial_ctx_write(ctx, ctx->sbuffer, nbytes);
+    return nbytes;
+#else
+    return KS_ERROR;
+#endif
+}
+
+/**
+ *  @brief  kserial_send_delta
+ */
+uint32_t kserial_send_delta(void *param, void *pdata, uint32_t lens, uint32_t type)
+{
+    return kserial_send_delta_ctx(&ksctx, param, pdata, lens, type);
+}
+
+/**
+ *  @brief  kserial_send_packet
+ */
+uint32_t kserial_send_packet(void *param, void *pdata, uint32_t lens, uint32_t type)
+{
+    return kserial_send_packet_ctx(&ksctx, param, pdata, lens, type);
+}
+
+/**
+ *  @brief  kserial_send_packets_ctx
+ *  Send count packets (param, type, lens, data) without copying payload, headers and trailers
+ *  are built in ctx->sbuffer, a trailer and the next header share one segment.
+ *  Return the number of bytes written, which falls short when the transport stops early,
+ *  KS_ERROR without sending anything when a payload exceeds KSERIAL_MAX_DATA_BYTES.
+ */
+uint32_t kserial_send_packets_ctx(kserial_ctx_t *ctx, const kserial_packet_t *pks, uint32_t count)
+{
+#if KSERIAL_SEND_ENABLE
+    kserial_iovec_t iov[2 * KSERIAL_SEND_BATCH_LENS + 1];
+    uint8_t *side = ctx->sbuffer;
+    uint32_t batch;
+    uint32_t written = 0;
+    uint32_t segment;
+    uint32_t offset;
+    uint32_t nbytes;
+    uint32_t niov;
+    uint32_t typesize;
+
+    for (uint32_t i = 0; i < count; i++)
+    {   // the 12-bit length would spill into the type nibble
+        typesize = kserial_get_typesize(pks[i].type);
+        if ((pks[i].data != NULL) && (pks[i].lens > (KSERIAL_MAX_DATA_BYTES / ((typesize > 1) ? typesize : 1))))
+        {
+            return KS_ERROR;
+        }
+    }
+    for (uint32_t n = 0; n < count; n += KSERIAL_SEND_BATCH_LENS)
+    {
+        niov = 0;
+        segment = 0;
+        offset = 0;
+        batch = 0;
+        for (uint32_t i = n; (i < count) && (i < (n + KSERIAL_SEND_BATCH_LENS)); i++)
+        {
+            typesize = kserial_get_typesize(pks[i].type);
+            nbytes = (typesize > 1) ? (pks[i].lens * typesize) : (pks[i].lens);
+            if (pks[i].data == NULL)
+            {
+                nbytes = 0;
+            }
+            // header only, the payload goes out from the caller buffer
+            kserial_pack_header(&side[offset], pks[i].param, pks[i].type, nbytes);
+            offset += 7;
+            if (nbytes != 0)
+            {
+                iov[niov].data = &side[segment];
+                iov[niov].lens = offset - segment;
+                niov++;
+                iov[niov].data = pks[i].data;
+                iov[niov].lens = nbytes;
+                niov++;
+                segment = offset;
+            }
+            side[offset++] = '\r';
+            batch += nbytes + 8;
+        }
+        iov[niov].data = &side[segment];
+        iov[niov].lens = offset - segment;
+        niov++;
+        nbytes = kserial_ctx_writev(ctx, iov, niov);
+        written += nbytes;
+        if (nbytes < batch)
+        {
+            break;
+        }
+    }
+
+    return written;
+#else
+    return KS_ERROR;
+#endif
+}
+
+/**
+ *  @brief  kserial_send_packets
+ */
+uint32_t kserial_send_packets(const kserial_packet_t *pks, uint32_t count)
+{
+    return kserial_send_packets_ctx(&ksctx, pks, count);
+}
+
+/**
+ *  @brief  kserial_send_packetv_ctx
+ *  Send one packet whose payload is gathered from iov, the segments are not copied.
+ *  Return the frame bytes, KS_ERROR when the payload is too long or count too large.
+ */
+uint32_t kserial_send_packetv_ctx(kserial_ctx_t *ctx, void *param, uint32_t type, const kserial_iovec_t *iov, uint32_t count)
+{
+#if KSERIAL_SEND_ENABLE
+    kserial_iovec_t vec[KSERIAL_SEND_BATCH_LENS + 2];
+    uint32_t nbytes = 0;
+
+    if (count > KSERIAL_SEND_BATCH_LENS)
+    {
+        return KS_ERROR;
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        nbytes += iov[i].lens;
+        vec[i + 1] = iov[i];
+    }
+    if (nbytes > KSERIAL_MAX_DATA_BYTES)
+    {
+        return KS_ERROR;
+    }
+    kserial_pack_header(ctx->sbuffer, param, type, nbytes);
+    ctx->sbuffer[7] = '\r';
+    vec[0].data = ctx->sbuffer;
+    vec[0].lens = 7;
+    vec[count + 1].data = &ctx->sbuffer[7];
+    vec[count + 1].lens = 1;
+    kserial_ctx_writev(ctx, vec, count + 2);
+
+    return nbytes + 8;
+#else
+    return KS_ERROR;
+#endif
+}
+
+#if KSERIAL_SEQUENCE_ENABLE
+/**
+ *  @brief  kserial_send_seq_ctx
+ *  Device side of the sequence mode, send a numeric packet stamped with seq.
+ *  Send packet ['K', 'S', type, lens + 2, param1, param2, ck, data ..., SEQ[0:7], SEQ[8:15], '\r']
+ */
+uint32_t kserial_send_seq_ctx(kserial_ctx_t *ctx, void *param, void *pdata, uint32_t lens, uint32_t type, uint16_t seq)
+{
+    uint32_t typesize = KS_TYPE_SIZE[type & 0x0F];
+    uint8_t stamp[2] = {seq, seq >> 8};
+    kserial_iovec_t iov[2];
+
+    if (typesize == 0)
+    {
+        return KS_ERROR;
+    }
+    iov[0].data = pdata;
+    iov[0].lens = (typesize > 1) ? (lens * typesize) : lens;
+    iov[1].data = stamp;
+    iov[1].lens = 2;
+
+    return kserial_send_packetv_ctx(ctx, param, type, iov, 2);
+}
+#endif
+
+/**
+ *  @brief  kserial_recv_packet_ctx
+ *  Feed one byte to the frame parser, return KS_OK when a packet is complete.
+ */
+uint32_t kserial_recv_packet_ctx(kserial_ctx_t *ctx, uint8_t input, void *param, void *pdata, uint32_t *lens, uint32_t *type)
+{
+#if KSERIAL_RECV_ENABLE
+    kserial_parser_t *ps = &ctx->rparser;
+    uint32_t mask = KS_MAX_RECV_BUFFER_SIZE - 1;
+    uint32_t typesize;
+
+    ctx->rbuffer[ctx->rtail & mask] = input;
+    ctx->rtail++;
+    KSERIAL_COUNT(ctx->ks.stats.bytes, 1);
+    if (kserial_parse(ps, &ctx->ks.stats, ctx->rbuffer, mask, ctx->rtail) != KS_OK)
+    {
+        return KS_ERROR;
+    }
+    KSERIAL_COUNT(ctx->ks.stats.frames, 1);
+    ((uint8_t*)param)[0] = ps->param[0];
+    ((uint8_t*)param)[1] = ps->param[1];
+    *type = ps->type;
+    typesize = kserial_get_typesize(ps->type);
+    *lens = (typesize > 1) ? (ps->nbyte / typesize) : ps->nbyte;
+    if (pdata != NULL)
+    {
+        kserial_ring_copy(pdata, ctx->rbuffer, KS_MAX_RECV_BUFFER_SIZE, (ps->start + 7) & mask, ps->nbyte);
+    }
+    return KS_OK;
+#else
+    return KS_ERROR;
+#endif
+}
+
+/**
+ *  @brief  kserial_recv_packet
+ */
+uint32_t kserial_recv_packet(uint8_t input, void *param, void *pdata, uint32_t *lens, uint32_t *type)
+{
+    return kserial_recv_packet_ctx(&ksctx, input, param, pdata, lens, type);
+}
+
+#if KSERIAL_RECV_ENABLE
+/**
+ *  @brief  kserial_rate_at
+ *  Packets per second of the window seen at now ns, slots the reader has not cleared yet
+ *  but which fell out of the window are left out, so a silent port decays to 0.
+ */
+static uint32_t kserial_rate_at(const kserial_counters_t *st, uint64_t now)
+{
+    uint32_t tick = (uint32_t)(now / (KSERIAL_RATE_PERIOD * 1000000ULL));
+    uint32_t last = atomic_load_explicit(&st->tick, memory_order_relaxed);
+    uint64_t elapsed;
+    uint32_t sum = 0;
+
+    if ((int32_t)(tick - last) < 0)
+    {   // the reader updated after now was taken
+        tick = last;
+    }
+    for (uint32_t i = 0; i < KSERIAL_RATE_SLOTS; i++)
+    {
+        if ((tick - (last - i)) < KSERIAL_RATE_SLOTS)
+        {
+            sum += atomic_load_explicit(&st->window[(last - i) % KSERIAL_RATE_SLOTS], memory_order_relaxed);
+        }
+    }
+    // the current slot is only partly filled
+    elapsed = (KSERIAL_RATE_SLOTS - 1) * KSERIAL_RATE_PERIOD + (now / 1000000ULL) % KSERIAL_RATE_PERIOD + 1;
+
+    return (uint32_t)((uint64_t)sum * 1000 / elapsed);
+}
+
+/**
+ *  @brief  kserial_update_rate
+ *  Add count packets at now ns to the sliding window, slots older than the window are cleared.
+ */
+static void kserial_update_rate(kserial_counters_t *st, uint64_t now, uint32_t count)
+{
+    uint32_t tick = (uint32_t)(now / (KSERIAL_RATE_PERIOD * 1000000ULL));
+    uint32_t last = atomic_load_explicit(&st->tick, memory_order_relaxed);
+
+    for (uint32_t i = 0; (i < (tick - last)) && (i < KSERIAL_RATE_SLOTS); i++)
+    {   // slots entered since the last update
+        atomic_store_explicit(&st->window[(tick - i) % KSERIAL_RATE_SLOTS], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&st->tick, tick, memory_order_relaxed);
+    KSERIAL_COUNT(st->window[tick % KSERIAL_RATE_SLOTS], count);
+    atomic_store_explicit(&st->rate, kserial_rate_at(st, now), memory_order_relaxed);
+}
+
+#if KSERIAL_CREDIT_ENABLE
+/**
+ *  @brief  kserial_credit_grant
+ *  Send packet ['K', 'S', R0, 4, 0xD5, 2, ck, L[0:7], L[8:15], L[16:23], L[24:31], '\r']
+ *  followed by ['K', 'S', R0, 0, 0xD5, 3, ck, '\r'] while cr->sync is set.
+ *  The limit is the free-running granted total, so the next grant makes up for a lost one.
+ *  Packed on the stack and written only when no other send holds the transport, else the
+ *  grant is left to the next read.
+ */
+static void kserial_credit_grant(kserial_ctx_t *ctx, kserial_credit_t *cr, uint64_t now)
+{
+    uint8_t param[2] = {KSCMD_R0_DEVICE_CREDIT, KSCMD_CREDIT_GRANT};
+    uint8_t limit[4] = {cr->granted, cr->granted >> 8, cr->granted >> 16, cr->granted >> 24};
+    uint8_t packet[20];
+    uint32_t nbyte;
+
+    if ((ctx->transport == NULL) || (kserial_ctx_trylock(ctx) != KS_OK))
+    {
+        cr->deferred = 1;
+        return;
+    }
+    nbyte = kserial_pack(packet, param, KS_R0, 4, limit);
+    if (cr->sync)
+    {
+        param[1] = KSCMD_CREDIT_SYNC;
+        nbyte += kserial_pack(&packet[nbyte], param, KS_R0, 0, NULL);
+    }
+    ctx->transport->send(ctx->handle, packet, nbyte);
+    kserial_ctx_unlock(ctx);
+    cr->deferred = 0;
+    cr->sync = 0;
+    cr->grants++;
+    cr->last = now;
+}
+
+/**
+ *  @brief  kserial_credit_consume
+ *  Host side, count the numeric frames of a read and replenish the device credit.
+ *  Frames lost on the way would shrink the window for good, so after KSERIAL_CREDIT_IDLE
+ *  without numeric frames the limit is sent again together with a sync request. The sent
+ *  count in the reply follows every frame sent before it, the window restarts from there.
+ */
+static void kserial_credit_consume(kserial_ctx_t *ctx, kserial_credit_t *cr, const kserial_packet_t *pk, uint32_t count, uint64_t now)
+{
+    const uint8_t *sent;
+    uint32_t frames = 0;
+    uint32_t synced = 0;
+
+    if (cr->state != KS_OPEN)
+    {
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if ((pk[i].type == KS_R0) && (pk[i].param[0] == KSCMD_R0_DEVICE_CREDIT) &&
+            (pk[i].param[1] == KSCMD_CREDIT_SYNC) && (pk[i].nbyte >= 4))
+        {
+            sent = (const uint8_t *)pk[i].data;
+            cr->consumed = sent[0] | (sent[1] << 8) | (sent[2] << 16) | ((uint32_t)sent[3] << 24);
+            cr->granted = cr->consumed + cr->window;
+            cr->pending = 0;
+            cr->syncs++;
+            synced = 1;
+            continue;
+        }
+        if (KS_TYPE_SIZE[pk[i].type] == 0)
+        {
+            continue;
+        }
+        frames++;
+        if (cr->consumed == cr->granted)
+        {
+            cr->overrun++;
+            continue;
+        }
+        cr->consumed++;
+        cr->pending++;
+    }
+    if (cr->pending >= cr->threshold)
+    {
+        cr->granted += cr->pending;
+        cr->pending = 0;
+        kserial_credit_grant(ctx, cr, now);
+    }
+    else if (synced || cr->deferred)
+    {
+        kserial_credit_grant(ctx, cr, now);
+    }
+    else if (frames != 0)
+    {
+        cr->last = now;
+    }
+    else if ((now != 0) && (cr->last != 0) && ((now - cr->last) >= (KSERIAL_CREDIT_IDLE * 1000000ULL)))
+    {   // a grant or frames short of the threshold may be lost, or the device has nothing to send
+        cr->granted += cr->pending;
+        cr->pending = 0;
+        cr->idle += now - cr->last;
+        cr->resends++;
+        cr->sync = 1;
+        kserial_credit_grant(ctx, cr, now);
+    }
+}
+#endif
+
+#if KSERIAL_TIMESTAMP_ENABLE
+/**
+ *  @brief  kserial_mark_read
+ *  Record the clock of the bytes up to tail, reads already released are dropped first.
+ *  With all marks in use the newest one is extended, older frames keep their exact time.
+ */
+static void kserial_mark_read(kserial_t *ks, uint64_t now)
+{
+    kserial_mark_t *mk;
+
+    while ((ks->markhead != ks->marktail) &&
+           ((int32_t)(ks->mark[ks->markhead & (KSERIAL_TIME_MARKS - 1)].end - ks->head) <= 0))
+    {
+        ks->markhead++;
+    }
+    if ((ks->marktail - ks->markhead) == KSERIAL_TIME_MARKS)
+    {
+        mk = &ks->mark[(ks->marktail - 1) & (KSERIAL_TIME_MARKS - 1)];
+    }
+    else
+    {
+        mk = &ks->mark[ks->marktail++ & (KSERIAL_TIME_MARKS - 1)];
+    }
+    mk->end = ks->tail;
+    mk->time = now;
+}
+#endif
+
+#if KSERIAL_TAP_ENABLE
+/**
+ *  @brief  kserial_tap_input
+ *  Hand the bytes from ring index first to the tail to the tap, in two parts if they wrap.
+ */
+static void kserial_tap_input(kserial_t *ks, uint32_t first, uint64_t time)
+{
+    uint32_t mask = ks->size - 1;
+    uint32_t offset = first & mask;
+    uint32_t lens = ks->tail - first;
+
+    if ((offset + lens) > ks->size)
+    {
+        ks->tap->input(ks->tap->user, &ks->buffer[offset], ks->size - offset, time);
+        lens -= ks->size - offset;
+        offset = 0;
+    }
+    ks->tap->input(ks->tap->user, &ks->buffer[offset], lens, time);
+}
+#endif
+
+/**
+ *  @brief  kserial_push_from
+ *  Queue bytes already taken from the transport for the next read, what does not fit is dropped.
+ *  Return the bytes queued.
+ */
+static uint32_t kserial_push_from(kserial_ctx_t *ctx, kserial_t *ks, const uint8_t *data, uint32_t lens)
+{
+    uint32_t mask = ks->size - 1;
+    uint32_t offset = ks->tail & mask;
+    uint32_t space = ks->size - (ks->tail - ks->head);
+#if KSERIAL_TAP_ENABLE
+    uint32_t first = ks->tail;
+#endif
+
+    if (lens > space)
+    {
+        KSERIAL_COUNT(ks->stats.overflow, 1);
+        lens = space;
+    }
+    if (lens == 0)
+    {
+        return 0;
+    }
+    kserial_ring_write(ks->buffer, ks->size, offset, data, lens);
+    ks->tail += lens;
+    KSERIAL_COUNT(ks->stats.bytes, lens);
+#if KSERIAL_TAP_ENABLE
+    if ((ks->tap != NULL) && (ks->tap->input != NULL))
+    {
+        kserial_tap_input(ks, first, kserial_now_ctx(ctx));
+    }
+#else
+    (void)ctx;
+#endif
+
+    return lens;
+}
+
+/**
+ *  @brief  kserial_read_from
+ */
+static uint32_t kserial_read_from(kserial_ctx_t *ctx, kserial_t *ks)
+{
+    uint64_t now;
+#if KSERIAL_TAP_ENABLE
+    uint32_t first;
+#endif
+    uint32_t available = 0;
+    uint32_t mask = ks->size - 1;
+    uint32_t offset;
+    uint32_t space;
+    uint32_t nbyte;
+
+    // release bytes consumed by the previous read
+    ks->head = ks->index;
+#if KSERIAL_TAP_ENABLE
+    first = ks->tail;
+#endif
+
+    do
+    {   // add rx data to packet buffer
+        offset = ks->tail & mask;
+        space = ks->size - (ks->tail - ks->head);
+        if (space > (ks->size - offset))
+        {
+            space = ks->size - offset;
+        }
+        if (space == 0)
+        {   // the rest stays in the transport until the next read
+            KSERIAL_COUNT(ks->stats.overflow, 1);
+            break;
+        }
+        nbyte = kserial_ctx_read(ctx, &ks->buffer[offset], space);
+        if (nbyte)
+        {
+            available = 1;
+            ks->tail += nbyte;
+            KSERIAL_COUNT(ks->stats.bytes, nbyte);
+        }
+    }
+    while (nbyte);
+
+    now = kserial_now_ctx(ctx);
+#if KSERIAL_TIMESTAMP_ENABLE
+    if (available && (now != 0))
+    {
+        kserial_mark_read(ks, now);
+    }
+#endif
+#if KSERIAL_TAP_ENABLE
+    if ((ks->tap != NULL) && (ks->tap->input != NULL) && (ks->tail != first))
+    {
+        kserial_tap_input(ks, first, now);
+    }
+#endif
+
+    ks->pkcnt = 0;
+    // the previous read may have stopped at pksize with whole frames still buffered
+    if (available || (ks->index != ks->tail))
+    {
+        kserial_unpack_ring(ks);
+    }
+#if KSERIAL_TIMESTAMP_ENABLE
+    if ((ks->hist != NULL) && (ks->pkcnt != 0) && (now != 0))
+    {   // packets are delivered when the read returns
+        now = kserial_now_ctx(ctx);
+        for (uint32_t i = 0; i < ks->pkcnt; i++)
+        {
+            kserial_hist_record(ks->hist, now - ks->packet[i].tfirst);
+        }
+    }
+#endif
+    if (now != 0)
+    {
+        kserial_update_rate(&ks->stats, now, ks->pkcnt);
+    }
+#if KSERIAL_CREDIT_ENABLE
+    if (ks->credit != NULL)
+    {
+        kserial_credit_consume(ctx, ks->credit, ks->packet, ks->pkcnt, now);
+    }
+#endif
+    // TODO: fix return
+    return ks->pkcnt;
+}
+#endif
+
+/**
+ *  @brief  kserial_read_ctx
+ *  In view and arena mode, packet data stays valid until the next kserial_read_ctx.
+ */
+uint32_t kserial_read_ctx(kserial_ctx_t *ctx)
+{
+#if KSERIAL_RECV_ENABLE
+    return kserial_read_from(ctx, &ctx->ks);
+#else
+    return KS_ERROR;
+#endif
+}
+
+/**
+ *  @brief  kserial_read
+ *  In view and arena mode, packet data stays valid until the next kserial_read.
+ */
+uint32_t kserial_read(kserial_t *ks)
+{
+#if KSERIAL_RECV_ENABLE
+    return kserial_read_from(&ksctx, ks);
+#else
+    return KS_ERROR;
+#endif
+}
+
+/**
+ *  @brief  kserial_flush_read_ctx
+ */
+void kserial_flush_read_ctx(kserial_ctx_t *ctx)
+{
+#if KSERIAL_RECV_ENABLE
+    kserial_ctx_flush(ctx);
+    ctx->ks.head = 0;
+    ctx->ks.tail = 0;
+    ctx->ks.index = 0;
+    memset(&ctx->ks.parser, 0, sizeof(kserial_parser_t));
+#if KSERIAL_TIMESTAMP_ENABLE
+    ctx->ks.markhead = 0;
+    ctx->ks.marktail = 0;
+#endif
+#endif
+}
+
+/**
+ *  @brief  kserial_flush_read
+ */
+void kserial_flush_read(kserial_t *ks)
+{
+#if KSERIAL_RECV_ENABLE
+    kserial_ctx_flush(&ksctx);
+    ks->head = 0;
+    ks->tail = 0;
+    ks->index = 0;
+    memset(&ks->parser, 0, sizeof(kserial_parser_t));
+#if KSERIAL_TIMESTAMP_ENABLE
+    ks->markhead = 0;
+    ks->marktail = 0;
+#endif
+#endif
+}
+
+/**
+ *  @brief  kserial_get_stats
+ *  Snapshot of the receive counters, safe to call from any thread while another one reads.
+ */
+void kserial_get_stats(const kserial_t *ks, kserial_stats_t *stats)
+{
+    stats->bytes = atomic_load_explicit(&ks->stats.bytes, memory_order_relaxed);
+    stats->frames = atomic_load_explicit(&ks->stats.frames, memory_order_relaxed);
+    stats->checksum = atomic_load_explicit(&ks->stats.checksum, memory_order_relaxed);
+    stats->terminator = atomic_load_explicit(&ks->stats.terminator, memory_order_relaxed);
+    stats->skipped = atomic_load_explicit(&ks->stats.skipped, memory_order_relaxed);
+    stats->overflow = atomic_load_explicit(&ks->stats.overflow, memory_order_relaxed);
+    stats->rate = atomic_load_explicit(&ks->stats.rate, memory_order_relaxed);
+    for (uint32_t i = 0; i < KSERIAL_RATE_SLOTS; i++)
+    {
+        stats->window[i] = atomic_load_explicit(&ks->stats.window[i], memory_order_relaxed);
+    }
+    stats->tick = atomic_load_explicit(&ks->stats.tick, memory_order_relaxed);
+}
+
+/**
+ *  @brief  kserial_get_stats_ctx
+ *  The rate is taken at the transport clock, so it decays while the port is not read.
+ */
+void kserial_get_stats_ctx(const kserial_ctx_t *ctx, kserial_stats_t *stats)
+{
+    kserial_get_stats(&ctx->ks, stats);
+#if KSERIAL_RECV_ENABLE
+    if ((ctx->transport != NULL) && (ctx->transport->now != NULL) && (stats->tick != 0))
+    {
+        stats->rate = kserial_rate_at(&ctx->ks.stats, ctx->transport->now(ctx->handle));
+    }
+#endif
+}
+
+#if KSERIAL_TIMESTAMP_ENABLE
+/**
+ *  @brief  kserial_set_histogram_ctx
+ *  Record the first byte to delivery latency of every packet read from ctx, NULL to stop.
+ *  hist is written by the reader without locks, query it after the reader stopped.
+ */
+void kserial_set_histogram_ctx(kserial_ctx_t *ctx, kserial_hist_t *hist)
+{
+    ctx->ks.hist = hist;
+}
+
+/**
+ *  @brief  kserial_hist_reset
+ */
+void kserial_hist_reset(kserial_hist_t *hist)
+{
+    memset(hist, 0, sizeof(kserial_hist_t));
+    hist->min = UINT64_MAX;
+}
+
+/**
+ *  @brief  kserial_hist_index
+ *  Values below 2^SUB_BITS map one to one, above that each power of two is split into
+ *  2^SUB_BITS buckets, the relative error stays below 2^-SUB_BITS.
+ */
+static uint32_t kserial_hist_index(uint64_t value)
+{
+    uint32_t msb = 0;
+    uint32_t shift;
+
+    if (value >> KSERIAL_HIST_RANGE_BITS)
+    {
+        return KSERIAL_HIST_BUCKETS - 1;
+    }
+    if (value < (1U << KSERIAL_HIST_SUB_BITS))
+    {
+        return (uint32_t)value;
+    }
+#if defined(__GNUC__)
+    msb = 63 - __builtin_clzll(value);
+#else
+    for (uint64_t v = value >> 1; v != 0; v >>= 1)
+    {
+        msb++;
+    }
+#endif
+    shift = msb - KSERIAL_HIST_SUB_BITS;
+    return ((shift + 1) << KSERIAL_HIST_SUB_BITS) + (uint32_t)((value >> shift) & ((1U << KSERIAL_HIST_SUB_BITS) - 1));
+}
+
+/**
+ *  @brief  kserial_hist_record
+ */
+void kserial_hist_record(kserial_hist_t *hist, uint64_t value)
+{
+    hist->bucket[kserial_hist_index(value)]++;
+    hist->count++;
+    hist->sum += value;
+    if (value < hist->min)
+    {
+        hist->min = value;
+    }
+    if (value > hist->max)
+    {
+        hist->max = value;
+    }
+}
+
+/**
+ *  @brief  kserial_hist_percentile
+ *  Highest value of the bucket holding the percent (0 ~ 100) rank, 0 for an empty histogram.
+ */
+uint64_t kserial_hist_percentile(const kserial_hist_t *hist, double percent)
+{
+    uint64_t rank;
+    uint64_t total = 0;
+    uint64_t value;
+    uint32_t shift;
+
+    if (hist->count == 0)
+    {
+        return 0;
+    }
+    rank = (uint64_t)(percent * hist->count / 100.0 + 0.5);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+    for (uint32_t i = 0; i < KSERIAL_HIST_BUCKETS; i++)
+    {
+        total += hist->bucket[i];
+        if ((total >= rank) && (i != (KSERIAL_HIST_BUCKETS - 1)))
+        {
+            if (i < (1U << KSERIAL_HIST_SUB_BITS))
+            {
+                value = i;
+            }
+            else
+            {
+                shift = (i >> KSERIAL_HIST_SUB_BITS) - 1;
+                value = ((uint64_t)((i & ((1U << KSERIAL_HIST_SUB_BITS) - 1)) | (1U << KSERIAL_HIST_SUB_BITS)) << shift) + ((1ULL << shift) - 1);
+            }
+            return (value < hist->max) ? value : hist->max;
+        }
+    }
+    return hist->max;
+}
+#endif
+
+#if KSERIAL_TAP_ENABLE
+/**
+ *  @brief  kserial_set_tap_ctx
+ *  See every byte read from ctx and the position of every frame in it, NULL to stop.
+ *  Called by the reader, in the read that delivers the bytes.
+ */
+void kserial_set_tap_ctx(kserial_ctx_t *ctx, const kserial_tap_t *tap)
+{
+    ctx->ks.tap = tap;
+}
+#endif
+
+#if KSERIAL_SEQUENCE_ENABLE
+/**
+ *  @brief  kserial_set_sequence_ctx
+ *  Strip the sequence number of numeric frames read from ctx and track it in sq, NULL to stop.
+ *  Only the receiving side, kscmd_set_sequence_ctx also asks the device to stamp frames.
+ *  Attached captures keep the stamps, so a replay of one can be tracked the same way.
+ */
+void kserial_set_sequence_ctx(kserial_ctx_t *ctx, kserial_seq_t *sq)
+{
+    ctx->ks.seq = sq;
+}
+
+/**
+ *  @brief  kserial_seq_init
+ *  stream : table of size streams, a stream is a type and param pair
+ */
+void kserial_seq_init(kserial_seq_t *sq, kserial_stream_t *stream, uint32_t size, pkserial_gap_t gap, void *user)
+{
+    sq->size = size;
+    sq->stream = stream;
+    sq->gap = gap;
+    sq->user = user;
+    kserial_seq_reset(sq);
+}
+
+/**
+ *  @brief  kserial_seq_reset
+ */
+void kserial_seq_reset(kserial_seq_t *sq)
+{
+    sq->count = 0;
+    sq->untracked = 0;
+}
+
+/**
+ *  @brief  kserial_seq_find
+ */
+kserial_stream_t *kserial_seq_find(const kserial_seq_t *sq, uint32_t type, uint32_t param1, uint32_t param2)
+{
+    kserial_stream_t *st;
+
+    for (uint32_t i = 0; i < sq->count; i++)
+    {
+        st = &sq->stream[i];
+        if ((st->type == type) && (st->param[0] == param1) && (st->param[1] == param2))
+        {
+            return st;
+        }
+    }
+    return NULL;
+}
+
+/**
+ *  @brief  kserial_seq_update
+ *  Classify pk->seq against the stream of pk, return KSERIAL_SEQ_xxx.
+ *  The first frame of a stream marks the whole window as received, older frames count as
+ *  duplicates. A frame more than KSERIAL_SEQ_WINDOW behind restarts the stream.
+ */
+uint32_t kserial_seq_update(kserial_seq_t *sq, const kserial_packet_t *pk)
+{
+    kserial_stream_t *st = kserial_seq_find(sq, pk->type, pk->param[0], pk->param[1]);
+    int32_t delta;
+    uint32_t back;
+
+    if (st == NULL)
+    {
+        if (sq->count >= sq->size)
+        {
+            sq->untracked++;
+            return KSERIAL_SEQ_UNTRACKED;
+        }
+        st = &sq->stream[sq->count++];
+        memset(st, 0, sizeof(kserial_stream_t));
+        st->type = pk->type;
+        st->param[0] = pk->param[0];
+        st->param[1] = pk->param[1];
+        st->received = 1;
+        st->next = pk->seq + 1;
+        st->window = UINT64_MAX;
+        return KSERIAL_SEQ_OK;
+    }
+    st->received++;
+
+    delta = (int16_t)(pk->seq - st->next);
+    if (delta >= 0)
+    {
+        if (delta > 0)
+        {
+            st->lost += delta;
+            st->gaps++;
+            if (sq->gap != NULL)
+            {
+                sq->gap(sq->user, st, st->next, pk->seq);
+            }
+        }
+        st->window = ((delta + 1) >= (int32_t)KSERIAL_SEQ_WINDOW) ? 1 : ((st->window << (delta + 1)) | 1);
+        st->next = pk->seq + 1;
+        return (delta > 0) ? KSERIAL_SEQ_GAP : KSERIAL_SEQ_OK;
+    }
+
+    back = -delta - 1;
+    if (back >= KSERIAL_SEQ_WINDOW)
+    {
+        st->resets++;
+        st->next = pk->seq + 1;
+        st->window = UINT64_MAX;
+        return KSERIAL_SEQ_RESET;
+    }
+    if (st->window & (1ULL << back))
+    {
+        st->duplicate++;
+        return KSERIAL_SEQ_DUPLICATE;
+    }
+    st->window |= 1ULL << back;
+    st->reordered++;
+    if (st->lost != 0)
+    {   // a clear bit was counted by its gap, unless the caller cleared lost since
+        st->lost--;
+    }
+
+    return KSERIAL_SEQ_LATE;
+}
+#endif
+
+#if KSERIAL_CREDIT_ENABLE
+/**
+ *  @brief  kserial_credit_available
+ *  Frames that may still be sent, UINT32_MAX while credit is not enforced.
+ */
+uint32_t kserial_credit_available(const kserial_credit_t *cr)
+{
+    return (cr->state == KS_OPEN) ? (cr->granted - cr->consumed) : UINT32_MAX;
+}
+
+/**
+ *  @brief  kserial_credit_take
+ *  Device side, call before sending a numeric frame. Return KS_BUSY without credit,
+ *  the frame should then stay in device memory until the next grant.
+ */
+uint32_t kserial_credit_take(kserial_ctx_t *ctx, kserial_credit_t *cr)
+{
+    if (cr->state != KS_OPEN)
+    {
+        return KS_OK;
+    }
+    if (cr->consumed == cr->granted)
+    {
+        if (!cr->busy)
+        {
+            cr->busy = 1;
+            cr->since = kserial_now_ctx(ctx);
+            cr->stalls++;
+        }
+        return KS_BUSY;
+    }
+    cr->consumed++;
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_credit_dispatch
+ *  Device side, handle a KSCMD_R0_DEVICE_CREDIT packet, on and off are echoed.
+ *  A grant sets the limit, one that does not raise it is ignored. A sync is answered with
+ *  the frames taken so far, call kserial_credit_take right before each send.
+ *  Return KS_ERROR if pk is not a credit command.
+ */
+uint32_t kserial_credit_dispatch(kserial_ctx_t *ctx, kserial_credit_t *cr, const kserial_packet_t *pk)
+{
+    uint8_t param[2] = {pk->param[0], pk->param[1]};
+    const uint8_t *grant = (const uint8_t *)pk->data;
+    uint8_t sent[4];
+    uint32_t limit;
+    uint64_t now;
+
+    if ((pk->type != KS_R0) || (pk->param[0] != KSCMD_R0_DEVICE_CREDIT))
+    {
+        return KS_ERROR;
+    }
+    switch (pk->param[1])
+    {
+        case KSCMD_CREDIT_OFF:
+        case KSCMD_CREDIT_ON:
+            cr->state = (pk->param[1] == KSCMD_CREDIT_ON) ? KS_OPEN : KS_CLOSE;
+            cr->granted = 0;
+            cr->consumed = 0;
+            cr->busy = 0;
+            kserial_send_packet_ctx(ctx, param, NULL, 0, KS_R0);
+            break;
+        case KSCMD_CREDIT_GRANT:
+            if (pk->nbyte < 4)
+            {
+                return KS_ERROR;
+            }
+            limit = grant[0] | (grant[1] << 8) | (grant[2] << 16) | ((uint32_t)grant[3] << 24);
+            if ((int32_t)(limit - cr->granted) <= 0)
+            {   // repeated or overtaken by a newer grant
+                break;
+            }
+            cr->granted = limit;
+            if (cr->busy)
+            {
+                now = kserial_now_ctx(ctx);
+                if ((now != 0) && (cr->since != 0))
+                {
+                    cr->stall += now - cr->since;
+                }
+                cr->busy = 0;
+            }
+            break;
+        case KSCMD_CREDIT_SYNC:
+            if (cr->state == KS_OPEN)
+            {   // frames sent so far, the reply follows all of them on the wire
+                sent[0] = cr->consumed;
+                sent[1] = cr->consumed >> 8;
+                sent[2] = cr->consumed >> 16;
+                sent[3] = cr->consumed >> 24;
+                kserial_send_packet_ctx(ctx, param, sent, 4, KS_R0);
+            }
+            break;
+        default:
+            return KS_ERROR;
+    }
+
+    return KS_OK;
+}
+#endif
+
+/**
+ *  @brief  kserial_get_packetdata
+ */
+void kserial_get_packetdata(kserial_packet_t *ksp, void *pdata, uint32_t index)
+{
+    if (pdata != NULL)
+    {
+        memcpy(pdata, ksp[index].data, ksp[index].nbyte);
+    }
+    free(ksp[index].data);
+}
+
+/**
+ *  @brief  kserial_release_packet
+ *  Return the payload of a packet read from ks, nothing to do in view and arena mode.
+ */
+void kserial_release_packet(const kserial_t *ks, kserial_packet_t *pk)
+{
+    if (ks->mode == KSERIAL_PACKET_COPY)
+    {
+        free(pk->data);
+    }
+    else if (ks->mode == KSERIAL_PACKET_POOL)
     {
-        if ((rbuffer[point - 7] == 'K') && (rbuffer[point - 6] == 'S'))
-        {
-            index = point - 7;
-            bytes = (((rbuffer[index + 2] << 8) | rbuffer[index + 3]) & 0x0FFF) + 8;
-        }
-        if ((point - index + 1) == bytes)
-        {
-            state = kserial_unpack(&rbuffer[index], param, type, lens, pdata);
-            if (state == KS_OK)
-            {
-                point = 0;
-                index = 0;
-                bytes = 0;
-                typesize = kserial_get_typesize(*type);
-                if (typesize > 1)
-                {
-                    *lens /= typesize;
-                }
-                return KS_OK;
-            }
-        }
+        kserial_pool_free(ks->pool, pk->data);
     }
-    if (++point >= KS_MAX_RECV_BUFFER_SIZE)
+    else
     {
-        point = 0;
+        return;
     }
-    return KS_ERROR;
-#else
-    return KS_ERROR;
-#endif
+    pk->data = NULL;
 }
 
+#if KSERIAL_RECV_ENABLE
 /**
- *  @brief  kserial_read
+ *  @brief  kserial_read_continuous_from
  */
-uint32_t kserial_read(kserial_t *ks)
+static uint32_t kserial_read_continuous_from(kserial_ctx_t *ctx, kserial_t *ks, kserial_packet_t *ksp, uint32_t *index, uint32_t *count, uint32_t *total)
 {
-#if KSERIAL_RECV_ENABLE
-    uint32_t available = 0;
-    uint32_t nbyte;
-    uint32_t newindex;
-
-    do
-    {   // add rx data to packet buffer
-        nbyte = kserial_recv(&ks->buffer[ks->count], ks->size - ks->count);
-        if (nbyte)
+    if ((*count == 0) || (*index >= *count))
+    {
+        *count = kserial_read_from(ctx, ks);
+        if (*count == 0)
         {
-            available = 1;
-            ks->count += nbyte;
+            return KS_ERROR;
         }
+        *index = 0;
     }
-    while (nbyte);
-
-    ks->pkcnt = 0;
-    if (available)
+    if ((ks->mode == KSERIAL_PACKET_COPY) || (ks->mode == KSERIAL_PACKET_POOL))
     {
-        newindex = kserial_unpack_buffer(ks->buffer, ks->count, ks->packet, &ks->pkcnt);
-        if (ks->pkcnt)
+        if ((ksp->data != NULL) && (ks->packet[*index].nbyte != 0))
         {
-            // update packet buffer
-            ks->count -= newindex;
-            memcpy(ks->buffer, &ks->buffer[newindex], ks->count);
-            memset(&ks->buffer[ks->count], 0, ks->size - ks->count);
+            memcpy(ksp->data, ks->packet[*index].data, ks->packet[*index].nbyte);
         }
+        kserial_release_packet(ks, &ks->packet[*index]);
     }
-    // TODO: fix return
-    return ks->pkcnt;
-#else
-    return KS_ERROR;
-#endif
+    else
+    {   // zero-copy, valid until the next kserial_read
+        ksp->data = ks->packet[*index].data;
+    }
+    ksp->param[0] = ks->packet[*index].param[0];
+    ksp->param[1] = ks->packet[*index].param[1];
+    ksp->type = ks->packet[*index].type;
+    ksp->lens = ks->packet[*index].lens;
+    ksp->nbyte = ks->packet[*index].nbyte;
+    (*total)++;
+    (*index)++;
+    return KS_OK;
 }
+#endif
 
 /**
- *  @brief  kserial_flush_read
+ *  @brief  kserial_read_continuous_ctx
  */
-void kserial_flush_read(kserial_t *ks)
+uint32_t kserial_read_continuous_ctx(kserial_ctx_t *ctx, kserial_packet_t *ksp, uint32_t *index, uint32_t *count, uint32_t *total)
 {
 #if KSERIAL_RECV_ENABLE
-    kserial_flush_recv();
-    memset(ks->buffer, 0, ks->size);
-    ks->count = 0;
+    return kserial_read_continuous_from(ctx, &ctx->ks, ksp, index, count, total);
+#else
+    return KS_ERROR;
 #endif
 }
 
 /**
- *  @brief  kserial_get_frequence
+ *  @brief  kserial_read_continuous
  */
-// float kserial_get_frequence(uint32_t lens, uint32_t time, uint32_t count)
-// {
-//     // static uint64_t kslensLast = 0;
-//     // static uint64_t ksTimeLast = 0;
-//     static float frequence = 0;
-//     // if ((time - ksTimeLast) >= count)
-//     // {
-//     //     frequence = ((float)lens - kslensLast) / (time - ksTimeLast) * 1000.0f;
-//     //     kslensLast = lens;
-//     //     ksTimeLast = time;
-//     // }
-//     return frequence;
-// }
+uint32_t kserial_read_continuous(kserial_packet_t *ksp, uint32_t *index, uint32_t *count, uint32_t *total)
+{
+#if KSERIAL_RECV_TREAD_ENABLE && KSERIAL_RECV_STATIC_ENABLE
+    return kserial_read_continuous_from(&ksctx, &ks, ksp, index, count, total);
+#else
+    (void)ksp;
+    (void)index;
+    (void)count;
+    (void)total;
+    return KS_ERROR;
+#endif
+}
 
 /**
- *  @brief  kserial_get_packetdata
+ *  @brief  kscmd_check_response
+ *  Compare the fields selected by match (KSCMD_MATCH_TYPE, _P1, _P2) of a received packet.
  */
-void kserial_get_packetdata(kserial_packet_t *ksp, void *pdata, uint32_t index)
+uint32_t kscmd_check_response(const kserial_packet_t *pk, uint32_t match, uint32_t type, const uint8_t *param)
 {
-    if (pdata != NULL)
+    if (((match & KSCMD_MATCH_TYPE) && (pk->type != type)) ||
+        ((match & KSCMD_MATCH_P1) && (pk->param[0] != param[0])) ||
+        ((match & KSCMD_MATCH_P2) && (pk->param[1] != param[1])))
     {
-        memcpy(pdata, ksp[index].data, ksp[index].nbyte);
+        return KS_ERROR;
     }
-    free(ksp[index].data);
+    return KS_OK;
 }
 
+#if KSERIAL_RECV_ENABLE
 /**
- *  @brief  kserial_read_continuous
+ *  @brief  kscmd_wait_response
+ *  Return as soon as a matching packet arrives or after timeout ms,
+ *  pk->data points to ctx->sbuffer. Other frames read meanwhile are kept in ctx->ks.
  */
-uint32_t kserial_read_continuous(kserial_packet_t *ksp, uint32_t *index, uint32_t *count, uint32_t *total)
+static uint32_t kscmd_wait_response(kserial_ctx_t *ctx, uint32_t match, uint32_t type, const uint8_t *param, uint32_t timeout, kserial_packet_t *pk)
 {
-#if KSERIAL_RECV_TREAD_ENABLE
-    if ((*count == 0) || (*index >= *count))
+    uint8_t input[64];
+    uint32_t nbyte;
+    uint32_t typesize;
+    uint32_t seen = 0;
+    uint32_t queued = 0;
+    uint32_t keep;
+    uint32_t elapsed = 0;
+    uint64_t start = kserial_now_ctx(ctx);
+
+    while (elapsed <= timeout)
     {
-        *count = kserial_read(&ks);
-        if (*count == 0)
+        while ((nbyte = kserial_ctx_read(ctx, input, sizeof(input))) != 0)
         {
-            return KS_ERROR;
+            for (uint32_t i = 0; i < nbyte; i++)
+            {
+                if (kserial_recv_packet_ctx(ctx, input[i], pk->param, ctx->sbuffer, &pk->lens, &pk->type) != KS_OK)
+                {
+                    continue;
+                }
+                if (kscmd_check_response(pk, match, type, param) == KS_OK)
+                {
+                    if (ctx->ks.buffer != NULL)
+                    {   // everything read but the response belongs to the next read
+                        queued += kserial_push_from(ctx, &ctx->ks, input, i + 1);
+                        seen += i + 1;
+                        keep = (seen > (ctx->rparser.nbyte + 8)) ? (seen - (ctx->rparser.nbyte + 8)) : 0;
+                        if (queued > keep)
+                        {
+                            ctx->ks.tail -= queued - keep;
+                        }
+                        kserial_push_from(ctx, &ctx->ks, &input[i + 1], nbyte - i - 1);
+                    }
+                    typesize = kserial_get_typesize(pk->type);
+                    pk->nbyte = (typesize > 1) ? (pk->lens * typesize) : pk->lens;
+                    pk->data = ctx->sbuffer;
+                    return KS_OK;
+                }
+            }
+            if (ctx->ks.buffer != NULL)
+            {   // queued as read, the ring is not released until the next read
+                queued += kserial_push_from(ctx, &ctx->ks, input, nbyte);
+                seen += nbyte;
+            }
         }
-        *index = 0;
+        if (kserial_wait_ctx(ctx, 1) == KS_ERROR)
+        {
+            break;
+        }
+        // without a transport clock, count one ms per wait
+        elapsed = (start != 0) ? (uint32_t)((kserial_now_ctx(ctx) - start) / 1000000) : (elapsed + 1);
     }
-    kserial_get_packetdata(ks.packet, ksp->data, *index);
-    ksp->param[0] = ks.packet[*index].param[0];
-    ksp->param[1] = ks.packet[*index].param[1];
-    ksp->type = ks.packet[*index].type;
-    ksp->lens = ks.packet[*index].lens;
-    ksp->nbyte = ks.packet[*index].nbyte;
-    (*total)++;
-    (*index)++;
-    return KS_OK;
-#else
-    return KS_ERROR;
-#endif
+
+    return KS_TIMEOUT;
 }
+#endif
 
 /**
- *  @brief  kscmd_send_command
- *  Send packet ['K', 'S', type, 0, param1, param2, ck, '\r']
- *  Recv packet ['K', 'S', type, 0, param1, param2, ck, '\r']
+ *  @brief  kscmd_request
+ *  Send a command, then wait up to KSCMD_RESPONSE_TIMEOUT ms for the first response selected by match.
  */
-uint32_t kscmd_send_command(uint32_t type, uint32_t param1, uint32_t param2, kserial_ack_t *ack)
+static uint32_t kscmd_request(kserial_ctx_t *ctx, uint32_t type, uint32_t param1, uint32_t param2, uint32_t match, kserial_ack_t *ack)
 {
 #if KSERIAL_SEND_ENABLE
     uint8_t param[2] = {param1, param2};
     uint32_t nbytes;
     uint32_t status = KS_OK;
+#if KSERIAL_RECV_ENABLE
+    kserial_packet_t pk;
+#endif
 
 #if KSERIAL_RECV_ENABLE
     if (ack != NULL)
     {
-        kserial_flush_recv();
+        kserial_ctx_flush(ctx);
     }
 #endif
-    nbytes = kserial_pack(sbuffer, param, type, 0, NULL);
-    kserial_send(sbuffer, nbytes);
+    nbytes = kserial_pack(ctx->sbuffer, param, type, 0, NULL);
+    kserial_ctx_write(ctx, ctx->sbuffer, nbytes);
 #if KSERIAL_RECV_ENABLE
     if (ack != NULL)
     {
-#if 0
-        nbytes = 0;
-        while (nbytes == 0)
+        status = kscmd_wait_response(ctx, match, type, param, KSCMD_RESPONSE_TIMEOUT, &pk);
+        if (status == KS_OK)
         {
-            kserial_delay(50);
-            nbytes = kserial_recv(rbuffer, KS_MAX_RECV_BUFFER_SIZE);
+            ack->param[0] = pk.param[0];
+            ack->param[1] = pk.param[1];
+            ack->type = pk.type;
+            ack->nbyte = (pk.nbyte > sizeof(ack->data)) ? sizeof(ack->data) : pk.nbyte;
+            memcpy(ack->data, pk.data, ack->nbyte);
         }
-#else
-        kserial_delay(50);
-        nbytes = kserial_recv(rbuffer, KS_MAX_RECV_BUFFER_SIZE);
-#endif
-        status = kserial_unpack(rbuffer, ack->param, &ack->type, &ack->nbyte, ack->data);
     }
 #endif
     return status;
@@ -499,15 +2940,26 @@ uint32_t kscmd_send_command(uint32_t type, uint32_t param1, uint32_t param2, kse
 }
 
 /**
- *  @brief  kscmd_check_device
+ *  @brief  kscmd_send_command_ctx
+ *  Send packet ['K', 'S', type, 0, param1, param2, ck, '\r']
+ *  Recv packet ['K', 'S', type, 0, param1, param2, ck, '\r']
+ *  The first response of the same type is the ack.
+ */
+uint32_t kscmd_send_command_ctx(kserial_ctx_t *ctx, uint32_t type, uint32_t param1, uint32_t param2, kserial_ack_t *ack)
+{
+    return kscmd_request(ctx, type, param1, param2, KSCMD_MATCH_TYPE, ack);
+}
+
+/**
+ *  @brief  kscmd_check_device_ctx
  *  Send packet ['K', 'S', R0, 0, 0xD0,   0, ck, '\r']
  *  Recv packet ['K', 'S', R0, 0,  IDL, IDH, ck, '\r']
  */
-uint32_t kscmd_check_device(uint32_t *id)
+uint32_t kscmd_check_device_ctx(kserial_ctx_t *ctx, uint32_t *id)
 {
 #if KSERIAL_CMD_ENABLE
     kserial_ack_t ack = {0};
-    if (kscmd_send_command(KS_R0, KSCMD_R0_DEVICE_ID, 0x00, &ack) != KS_OK)
+    if (kscmd_send_command_ctx(ctx, KS_R0, KSCMD_R0_DEVICE_ID, 0x00, &ack) != KS_OK)
     {
         return KS_ERROR;
     }
@@ -526,55 +2978,55 @@ uint32_t kscmd_check_device(uint32_t *id)
 }
 
 /**
- *  @brief  kscmd_set_baudrate
+ *  @brief  kscmd_set_baudrate_ctx
  *  Send packet ['K', 'S', R0, 4, 0xD1, 4, ck, BAUD[0:7], BAUD[8:15], BAUD[16:23], BAUD[24:31], '\r']
  */
-uint32_t kscmd_set_baudrate(int32_t baudrate)
+uint32_t kscmd_set_baudrate_ctx(kserial_ctx_t *ctx, int32_t baudrate)
 {
     if (baudrate < 0)
     {
         return KS_ERROR;
     }
     uint8_t param[2] = {KSCMD_R0_DEVICE_BAUDRATE, 4};
-    return kserial_send_packet(param, &baudrate, param[1], KS_R0);
+    return kserial_send_packet_ctx(ctx, param, &baudrate, param[1], KS_R0);
 }
 
 /**
- *  @brief  kscmd_set_updaterate
+ *  @brief  kscmd_set_updaterate_ctx
  *  Send packet ['K', 'S', R0, 4, 0xD2, 4, ck, FREQ[0:7], FREQ[8:15], FREQ[16:23], FREQ[24:31], '\r']
  */
-uint32_t kscmd_set_updaterate(int32_t updaterate)
+uint32_t kscmd_set_updaterate_ctx(kserial_ctx_t *ctx, int32_t updaterate)
 {
     if (updaterate < 0)
     {
         return KS_ERROR;
     }
     uint8_t param[2] = {KSCMD_R0_DEVICE_RATE, 4};
-    return kserial_send_packet(param, &updaterate, param[1], KS_R0);
+    return kserial_send_packet_ctx(ctx, param, &updaterate, param[1], KS_R0);
 }
 
 /**
- *  @brief  kscmd_set_mode
+ *  @brief  kscmd_set_mode_ctx
  *  Send packet ['K', 'S', R0, 4, 0xD3, 4, ck, MODE[0:7], MODE[8:15], MODE[16:23], MODE[24:31], '\r']
  */
-uint32_t kscmd_set_mode(int32_t mode)
+uint32_t kscmd_set_mode_ctx(kserial_ctx_t *ctx, int32_t mode)
 {
     if (mode < 0)
     {
         return KS_ERROR;
     }
-    return kscmd_send_command(KS_R0, KSCMD_R0_DEVICE_MDOE, mode, NULL);
+    return kscmd_send_command_ctx(ctx, KS_R0, KSCMD_R0_DEVICE_MDOE, mode, NULL);
 }
 
 /**
- *  @brief  kscmd_get_value
+ *  @brief  kscmd_get_value_ctx
  *  Send packet ['K', 'S', R0, 0, 0xE3, ITEM, ck, '\r']
  *  Recv packet ['K', 'S', R0, 0, 0xE3, ITEM, ck, VAL[0:7], VAL[8:15], VAL[16:23], VAL[24:31], '\r']
  */
-uint32_t kscmd_get_value(uint32_t item, int32_t *value)
+uint32_t kscmd_get_value_ctx(kserial_ctx_t *ctx, uint32_t item, int32_t *value)
 {
     kserial_ack_t ack = {0};
-    if (kscmd_send_command(KS_R0, KSCMD_R0_DEVICE_GET, item, &ack) != KS_OK)
+    if (kscmd_request(ctx, KS_R0, KSCMD_R0_DEVICE_GET, item, KSCMD_MATCH_ALL, &ack) != KS_OK)
     {
         *value = 0;
         return KS_ERROR;
@@ -583,21 +3035,83 @@ uint32_t kscmd_get_value(uint32_t item, int32_t *value)
     return KS_OK;
 }
 
+#if KSERIAL_SEQUENCE_ENABLE
 /**
- *  @brief  kscmd_twi_writereg
+ *  @brief  kscmd_set_sequence_ctx
+ *  Send packet ['K', 'S', R0, 0, 0xD4, ENABLE, ck, '\r']
+ *  Recv packet ['K', 'S', R0, 0, 0xD4, ENABLE, ck, '\r']
+ *  Ask the device to stamp numeric frames, then track them in sq. NULL turns stamping off.
+ */
+uint32_t kscmd_set_sequence_ctx(kserial_ctx_t *ctx, kserial_seq_t *sq)
+{
+    kserial_ack_t ack = {0};
+    if (kscmd_request(ctx, KS_R0, KSCMD_R0_DEVICE_SEQUENCE, (sq != NULL) ? 1 : 0, KSCMD_MATCH_ALL, &ack) != KS_OK)
+    {
+        return KS_ERROR;
+    }
+    kserial_set_sequence_ctx(ctx, sq);
+    return KS_OK;
+}
+#endif
+
+#if KSERIAL_CREDIT_ENABLE
+/**
+ *  @brief  kscmd_set_credit_ctx
+ *  Send packet ['K', 'S', R0, 0, 0xD5, ON, ck, '\r']
+ *  Recv packet ['K', 'S', R0, 0, 0xD5, ON, ck, '\r']
+ *  Enforce credit on the device and grant window frames, kserial_read_ctx replenishes the
+ *  credit every window / 2 frames read and, when frames stop for KSERIAL_CREDIT_IDLE ms,
+ *  sends the limit again and restarts the window from the sent count of the device.
+ *  NULL turns credit off.
+ */
+uint32_t kscmd_set_credit_ctx(kserial_ctx_t *ctx, kserial_credit_t *cr, uint32_t window)
+{
+    kserial_ack_t ack = {0};
+
+    if (cr == NULL)
+    {
+        if (kscmd_request(ctx, KS_R0, KSCMD_R0_DEVICE_CREDIT, KSCMD_CREDIT_OFF, KSCMD_MATCH_ALL, &ack) != KS_OK)
+        {
+            return KS_ERROR;
+        }
+        ctx->ks.credit = NULL;
+        return KS_OK;
+    }
+    if (window == 0)
+    {
+        return KS_ERROR;
+    }
+    memset(cr, 0, sizeof(kserial_credit_t));
+    cr->window = window;
+    cr->threshold = (window + 1) / 2;
+    if (kscmd_request(ctx, KS_R0, KSCMD_R0_DEVICE_CREDIT, KSCMD_CREDIT_ON, KSCMD_MATCH_ALL, &ack) != KS_OK)
+    {
+        return KS_ERROR;
+    }
+    cr->state = KS_OPEN;
+    cr->granted = window;
+    ctx->ks.credit = cr;
+    kserial_credit_grant(ctx, cr, kserial_now_ctx(ctx));
+
+    return KS_OK;
+}
+#endif
+
+/**
+ *  @brief  kscmd_twi_writereg_ctx
  *  Send packet ['K', 'S', R1, 1, slaveAddress(8-bit), regAddress, ck, regData, '\r']
  */
-uint32_t kscmd_twi_writereg(uint8_t slaveaddr, uint8_t regaddr, uint8_t regdata)
+uint32_t kscmd_twi_writereg_ctx(kserial_ctx_t *ctx, uint8_t slaveaddr, uint8_t regaddr, uint8_t regdata)
 {
 #if KSERIAL_CMD_ENABLE
     uint8_t param[2] = {slaveaddr << 1, regaddr};
     uint32_t type = KS_R1;
     uint32_t nbytes;
 
-    kserial_flush_recv();
+    kserial_ctx_flush(ctx);
 
-    nbytes = kserial_pack(sbuffer, param, type, 1, &regdata);
-    kserial_send(sbuffer, nbytes);
+    nbytes = kserial_pack(ctx->sbuffer, param, type, 1, &regdata);
+    kserial_ctx_write(ctx, ctx->sbuffer, nbytes);
 #if 0
     klogd("[W] param = %02X, %02X, type = %d, bytes = %d, data = %02X\n", param[0], param[1], type, nbytes, wdata);
 #endif
@@ -608,37 +3122,31 @@ uint32_t kscmd_twi_writereg(uint8_t slaveaddr, uint8_t regaddr, uint8_t regdata)
 }
 
 /**
- *  @brief  kscmd_twi_readregs
+ *  @brief  kscmd_twi_readregs_ctx
  *  Send packet ['K', 'S', R1,    1, slaveAddress(8-bit)+1, regAddress, ck, lens, '\r']
  *  Recv packet ['K', 'S', R1, lens, slaveAddress(8-bit)+1, regAddress, ck, regData ..., '\r']
  */
-uint32_t kscmd_twi_readregs(uint8_t slaveaddr, uint8_t regaddr, uint8_t *regdata, uint8_t lens)
+uint32_t kscmd_twi_readregs_ctx(kserial_ctx_t *ctx, uint8_t slaveaddr, uint8_t regaddr, uint8_t *regdata, uint8_t lens)
 {
 #if KSERIAL_CMD_ENABLE
     uint8_t param[2] = {(slaveaddr << 1) + 1, regaddr};
     uint32_t type = KS_R1;
     uint32_t nbytes;
     uint32_t status;
+    kserial_packet_t pk;
 
-    kserial_flush_recv();
-
-    nbytes = kserial_pack(sbuffer, param, type, 1, &lens);
-    kserial_send(sbuffer, nbytes);
+    kserial_ctx_flush(ctx);
 
-    nbytes = 0;
-    while (nbytes == 0)
-    {
-        kserial_delay(100);
-        nbytes = kserial_recv(rbuffer, KS_MAX_RECV_BUFFER_SIZE);
-    }
+    nbytes = kserial_pack(ctx->sbuffer, param, type, 1, &lens);
+    kserial_ctx_write(ctx, ctx->sbuffer, nbytes);
 
-    // TODO: check i2cbuff first 'KS'
-    status = kserial_unpack(rbuffer, param, &type, &nbytes, sbuffer);
+    status = kscmd_wait_response(ctx, KSCMD_MATCH_ALL, type, param, KSCMD_RESPONSE_TIMEOUT, &pk);
     if (status == KS_OK)
     {
+        nbytes = (pk.nbyte > lens) ? lens : pk.nbyte;
         for (uint32_t i = 0; i < nbytes; i++)
         {
-            regdata[i] = sbuffer[i];
+            regdata[i] = ((uint8_t*)pk.data)[i];
         }
 #if 0
         klogd("[R] param = %02X, %02X, type = %d, bytes = %d, data =", param[0], param[1], type, nbytes + 8);
@@ -656,20 +3164,20 @@ uint32_t kscmd_twi_readregs(uint8_t slaveaddr, uint8_t regaddr, uint8_t *regdata
 }
 
 /**
- *  @brief  kscmd_twi_writeregs
+ *  @brief  kscmd_twi_writeregs_ctx
  *  Send packet ['K', 'S', R1, lens, slaveAddress(8-bit), regAddress, ck, regData ... , '\r']
  */
-uint32_t kscmd_twi_writeregs(uint8_t slaveaddr, uint8_t regaddr, uint8_t *regdata, uint8_t lens)
+uint32_t kscmd_twi_writeregs_ctx(kserial_ctx_t *ctx, uint8_t slaveaddr, uint8_t regaddr, uint8_t *regdata, uint8_t lens)
 {
 #if KSERIAL_CMD_ENABLE
     uint8_t param[2] = {slaveaddr << 1, regaddr};
     uint32_t type = KS_R1;
     uint32_t nbytes;
 
-    kserial_flush_recv();
+    kserial_ctx_flush(ctx);
 
-    nbytes = kserial_pack(sbuffer, param, type, lens, regdata);
-    kserial_send(sbuffer, nbytes);
+    nbytes = kserial_pack(ctx->sbuffer, param, type, lens, regdata);
+    kserial_ctx_write(ctx, ctx->sbuffer, nbytes);
 #if 0
     klogd("[W] param = %02X, %02X, type = %d, bytes = %d, data = %02X\n", param[0], param[1], type, nbytes, wdata);
 #endif
@@ -680,11 +3188,11 @@ uint32_t kscmd_twi_writeregs(uint8_t slaveaddr, uint8_t regaddr, uint8_t *regdat
 }
 
 /**
- *  @brief  kscmd_twi_scandevice
+ *  @brief  kscmd_twi_scandevice_ctx
  *  Send packet ['K', 'S', R2,    0, 0xA1, 0, ck, '\r']
  *  Recv packet ['K', 'S', R2, lens, 0xA1, 0, ck, address ..., '\r']
  */
-uint32_t kscmd_twi_scandevice(uint8_t *slaveaddr)
+uint32_t kscmd_twi_scandevice_ctx(kserial_ctx_t *ctx, uint8_t *slaveaddr)
 {
 #if KSERIAL_CMD_ENABLE
     uint8_t param[2] = {KSCMD_R2_TWI_SCAN_DEVICE, 0};
@@ -692,22 +3200,20 @@ uint32_t kscmd_twi_scandevice(uint8_t *slaveaddr)
     uint32_t nbytes;
     uint32_t status;
     uint32_t count;
+    kserial_packet_t pk;
 
-    kserial_flush_recv();
+    kserial_ctx_flush(ctx);
 
-    nbytes = kserial_pack(sbuffer, param, type, 0, NULL);
-    kserial_send(sbuffer, nbytes);
+    nbytes = kserial_pack(ctx->sbuffer, param, type, 0, NULL);
+    kserial_ctx_write(ctx, ctx->sbuffer, nbytes);
 
-    kserial_delay(100);
-    nbytes = kserial_recv(rbuffer, KS_MAX_RECV_BUFFER_SIZE);
-
-    // TODO: check i2cbuff first 'KS'
-    status = kserial_unpack(rbuffer, param, &type, &count, sbuffer);
+    status = kscmd_wait_response(ctx, KSCMD_MATCH_ALL, type, param, KSCMD_RESPONSE_TIMEOUT, &pk);
     if (status == KS_OK)
     {
+        count = pk.nbyte;
         for (uint32_t i = 0; i < count; i++)
         {
-            slaveaddr[i] = sbuffer[i];
+            slaveaddr[i] = ((uint8_t*)pk.data)[i];
         }
 #if 0
         klogd(" >> i2c device list (found %d device)\n\n", count);
@@ -730,33 +3236,31 @@ uint32_t kscmd_twi_scandevice(uint8_t *slaveaddr)
 }
 
 /**
- *  @brief  kscmd_twi_scanregister
+ *  @brief  kscmd_twi_scanregister_ctx
  *  Send packet ['K', 'S', R2,   0, 0xA2, slaveAddress, ck, '\r']
  *  Recv packet ['K', 'S', R2, 256, 0xA2, slaveAddress, ck, address ..., '\r']
  */
-uint32_t kscmd_twi_scanregister(uint8_t slaveaddr, uint8_t reg[256])
+uint32_t kscmd_twi_scanregister_ctx(kserial_ctx_t *ctx, uint8_t slaveaddr, uint8_t reg[256])
 {
 #if KSERIAL_CMD_ENABLE
     uint8_t param[2] = {KSCMD_R2_TWI_SCAN_REGISTER, slaveaddr << 1};
     uint32_t type = KS_R2;
     uint32_t nbytes;
     uint32_t status;
+    kserial_packet_t pk;
 
-    kserial_flush_recv();
-
-    nbytes = kserial_pack(sbuffer, param, type, 0, NULL);
-    kserial_send(sbuffer, nbytes);
+    kserial_ctx_flush(ctx);
 
-    kserial_delay(100);
-    nbytes = kserial_recv(rbuffer, KS_MAX_RECV_BUFFER_SIZE);
+    nbytes = kserial_pack(ctx->sbuffer, param, type, 0, NULL);
+    kserial_ctx_write(ctx, ctx->sbuffer, nbytes);
 
-    // TODO: check i2cbuff first 'KS'
-    status = kserial_unpack(rbuffer, param, &type, &nbytes, sbuffer);
+    status = kscmd_wait_response(ctx, KSCMD_MATCH_ALL, type, param, KSCMD_RESPONSE_TIMEOUT, &pk);
     if (status == KS_OK)
     {
-        for (uint32_t i = 0; i < 256; i++)
+        nbytes = (pk.nbyte > 256) ? 256 : pk.nbyte;
+        for (uint32_t i = 0; i < nbytes; i++)
         {
-            reg[i] = sbuffer[i];
+            reg[i] = ((uint8_t*)pk.data)[i];
         }
 #if 0
         klogd("\n");
@@ -781,4 +3285,112 @@ uint32_t kscmd_twi_scanregister(uint8_t slaveaddr, uint8_t reg[256])
 #endif
 }
 
+/**
+ *  @brief  kscmd_send_command
+ */
+uint32_t kscmd_send_command(uint32_t type, uint32_t param1, uint32_t param2, kserial_ack_t *ack)
+{
+    return kscmd_send_command_ctx(&ksctx, type, param1, param2, ack);
+}
+
+/**
+ *  @brief  kscmd_check_device
+ */
+uint32_t kscmd_check_device(uint32_t *id)
+{
+    return kscmd_check_device_ctx(&ksctx, id);
+}
+
+/**
+ *  @brief  kscmd_set_baudrate
+ */
+uint32_t kscmd_set_baudrate(int32_t baudrate)
+{
+    return kscmd_set_baudrate_ctx(&ksctx, baudrate);
+}
+
+/**
+ *  @brief  kscmd_set_updaterate
+ */
+uint32_t kscmd_set_updaterate(int32_t updaterate)
+{
+    return kscmd_set_updaterate_ctx(&ksctx, updaterate);
+}
+
+/**
+ *  @brief  kscmd_set_mode
+ */
+uint32_t kscmd_set_mode(int32_t mode)
+{
+    return kscmd_set_mode_ctx(&ksctx, mode);
+}
+
+/**
+ *  @brief  kscmd_get_value
+ */
+uint32_t kscmd_get_value(uint32_t item, int32_t *value)
+{
+    return kscmd_get_value_ctx(&ksctx, item, value);
+}
+
+#if KSERIAL_SEQUENCE_ENABLE
+/**
+ *  @brief  kscmd_set_sequence
+ */
+uint32_t kscmd_set_sequence(kserial_seq_t *sq)
+{
+    return kscmd_set_sequence_ctx(&ksctx, sq);
+}
+#endif
+
+#if KSERIAL_CREDIT_ENABLE
+/**
+ *  @brief  kscmd_set_credit
+ */
+uint32_t kscmd_set_credit(kserial_credit_t *cr, uint32_t window)
+{
+    return kscmd_set_credit_ctx(&ksctx, cr, window);
+}
+#endif
+
+/**
+ *  @brief  kscmd_twi_writereg
+ */
+uint32_t kscmd_twi_writereg(uint8_t slaveaddr, uint8_t regaddr, uint8_t regdata)
+{
+    return kscmd_twi_writereg_ctx(&ksctx, slaveaddr, regaddr, regdata);
+}
+
+/**
+ *  @brief  kscmd_twi_readregs
+ */
+uint32_t kscmd_twi_readregs(uint8_t slaveaddr, uint8_t regaddr, uint8_t *regdata, uint8_t lens)
+{
+    return kscmd_twi_readregs_ctx(&ksctx, slaveaddr, regaddr, regdata, lens);
+}
+
+/**
+ *  @brief  kscmd_twi_writeregs
+ */
+uint32_t kscmd_twi_writeregs(uint8_t slaveaddr, uint8_t regaddr, uint8_t *regdata, uint8_t lens)
+{
+    return kscmd_twi_writeregs_ctx(&ksctx, slaveaddr, regaddr, regdata, lens);
+}
+
+/**
+ *  @brief  kscmd_twi_scandevice
+ */
+uint32_t kscmd_twi_scandevice(uint8_t *slaveaddr)
+{
+    return kscmd_twi_scandevice_ctx(&ksctx, slaveaddr);
+}
+
+/**
+ *  @brief  kscmd_twi_scanregister
+ */
+uint32_t kscmd_twi_scanregister(uint8_t slaveaddr, uint8_t reg[256])
+{
+    return kscmd_twi_scanregister_ctx(&ksctx, slaveaddr, reg);
+}
+
 /*************************************** END OF FILE ****************************************/
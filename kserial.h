@@ -22,6 +22,9 @@ extern "C" {
 
 /* Includes --------------------------------------------------------------------------------*/
 #include <stdint.h>
+#ifndef __cplusplus
+#include <stdatomic.h>
+#endif
 #include "kstatus.h"
 #ifndef KSERIAL_RECONFIG
 #include "kserial_conf.h"
@@ -35,6 +38,61 @@ extern "C" {
 #define KSERIAL_VERSION_DEFINE                          "1.1.2"
 #endif
 
+#define KSERIAL_MAX_DATA_BYTES                          (4095)  /* 12-bit LN */
+
+/* packet payload storage mode */
+#define KSERIAL_PACKET_COPY                             (0U)    /* malloc per packet, release with kserial_get_packetdata */
+#define KSERIAL_PACKET_VIEW                             (1U)    /* data points into the receive buffer */
+#define KSERIAL_PACKET_ARENA                            (2U)    /* data points into a caller-supplied arena */
+#define KSERIAL_PACKET_POOL                             (3U)    /* slab of the context pool, release with kserial_release_packet */
+
+/* kserial_seq_update result */
+#define KSERIAL_SEQ_OK                                  (0U)
+#define KSERIAL_SEQ_GAP                                 (1U)    /* frames before this one were lost */
+#define KSERIAL_SEQ_LATE                                (2U)    /* behind a later frame, no longer counted lost */
+#define KSERIAL_SEQ_DUPLICATE                           (3U)
+#define KSERIAL_SEQ_RESET                               (4U)    /* out of the window, the stream restarted */
+#define KSERIAL_SEQ_UNTRACKED                           (5U)    /* stream table full */
+#define KSERIAL_SEQ_WINDOW                              (64U)
+
+/* payload slabs of 64, 256, 1024 and 4096 bytes */
+#define KSERIAL_POOL_CLASSES                            (4U)
+#define KSERIAL_POOL_SLAB_SIZE(__CLASS)                 (64U << (2 * (__CLASS)))
+
+/* param2 of KSCMD_R0_DEVICE_CREDIT */
+#define KSCMD_CREDIT_OFF                                (0U)
+#define KSCMD_CREDIT_ON                                 (1U)    /* device credit starts at 0 */
+#define KSCMD_CREDIT_GRANT                              (2U)    /* payload : u32 limit, free-running frames the device may send */
+#define KSCMD_CREDIT_SYNC                               (3U)    /* reply payload : u32 free-running frames the device sent */
+
+/* response fields compared by kscmd_check_response */
+#define KSCMD_MATCH_TYPE                                (1U << 0)
+#define KSCMD_MATCH_P1                                  (1U << 1)
+#define KSCMD_MATCH_P2                                  (1U << 2)
+#define KSCMD_MATCH_ALL                                 (KSCMD_MATCH_TYPE | KSCMD_MATCH_P1 | KSCMD_MATCH_P2)
+
+/* sync search instruction set */
+#define KSERIAL_SIMD_AUTO                               (0U)
+#define KSERIAL_SIMD_NONE                               (1U)
+#define KSERIAL_SIMD_SSE2                               (2U)
+#define KSERIAL_SIMD_AVX2                               (3U)
+
+/* receive counter, the same layout without _Atomic in c++, read it with kserial_get_stats */
+#ifndef __cplusplus
+#define KSERIAL_COUNTER                                 _Atomic uint32_t
+#else
+#define KSERIAL_COUNTER                                 uint32_t
+#endif
+
+/* packet rate window, KSERIAL_RATE_SLOTS * KSERIAL_RATE_PERIOD ms */
+#define KSERIAL_RATE_SLOTS                              (8U)
+#define KSERIAL_RATE_PERIOD                             (125U)  /* ms */
+
+/* latency histogram, 2^SUB_BITS linear buckets per power of two up to 2^RANGE_BITS ns */
+#define KSERIAL_HIST_SUB_BITS                           (4U)
+#define KSERIAL_HIST_RANGE_BITS                         (36U)
+#define KSERIAL_HIST_BUCKETS                            ((KSERIAL_HIST_RANGE_BITS - KSERIAL_HIST_SUB_BITS + 1) << KSERIAL_HIST_SUB_BITS)
+
 /* Macro -----------------------------------------------------------------------------------*/
 /* Typedef ---------------------------------------------------------------------------------*/
 
@@ -45,20 +103,255 @@ typedef struct
     uint32_t lens;
     uint32_t nbyte;
     void *data;
+#if KSERIAL_TIMESTAMP_ENABLE
+    uint64_t tfirst;    // transport clock in ns when the first byte was read, 0 without a clock
+    uint64_t tlast;     // transport clock in ns when the '\r' was read
+#endif
+#if KSERIAL_SEQUENCE_ENABLE
+    uint16_t seq;       // sequence number of a stamped frame, 0 otherwise
+#endif
 
 } kserial_packet_t;
 
+typedef struct
+{
+    const void *data;
+    uint32_t lens;
+
+} kserial_iovec_t;
+
+typedef struct
+{
+    uint32_t (*send)(void *handle, const void *data, uint32_t lens);
+    uint32_t (*sendv)(void *handle, const kserial_iovec_t *iov, uint32_t count);   // optional
+    uint32_t (*recv)(void *handle, void *data, uint32_t lens);                     // never blocks
+    void     (*flush)(void *handle);
+    uint32_t (*wait)(void *handle, uint32_t timeout);                              // ms, KS_OK when readable
+    uint64_t (*now)(void *handle);                                                 // monotonic ns, optional
+    int      (*fd)(void *handle);                                                  // pollable descriptor, optional
+    uint32_t (*setbaud)(void *handle, uint32_t baudrate);                          // optional, after pending output
+
+} kserial_transport_t;
+
+typedef struct
+{
+    uint32_t state;
+    uint32_t start;     // free-running index of the frame header 'K'
+    uint32_t index;     // free-running index of the next byte to examine
+    uint32_t checksum;
+    uint32_t type;
+    uint32_t nbyte;
+    uint8_t param[2];
+
+} kserial_parser_t;
+
+typedef struct
+{
+    // free running, written by the reader only, may wrap
+    uint32_t bytes;         // bytes read from the transport
+    uint32_t frames;        // frames accepted
+    uint32_t checksum;      // header checksum failures
+    uint32_t terminator;    // frames rejected for a missing '\r'
+    uint32_t skipped;       // bytes discarded while resynchronising
+    uint32_t overflow;      // reads stopped by a full ring
+    uint32_t rate;          // packets per second over the window, needs a transport clock
+    uint32_t window[KSERIAL_RATE_SLOTS];
+    uint64_t tick;
+
+} kserial_stats_t;
+
+typedef struct
+{
+    // live kserial_stats_t of a reader, snapshot with kserial_get_stats from any thread
+    KSERIAL_COUNTER bytes;
+    KSERIAL_COUNTER frames;
+    KSERIAL_COUNTER checksum;
+    KSERIAL_COUNTER terminator;
+    KSERIAL_COUNTER skipped;
+    KSERIAL_COUNTER overflow;
+    KSERIAL_COUNTER rate;
+    KSERIAL_COUNTER window[KSERIAL_RATE_SLOTS];
+    KSERIAL_COUNTER tick;       // KSERIAL_RATE_PERIOD of the last update, wraps after years
+
+} kserial_counters_t;
+
+#if KSERIAL_TIMESTAMP_ENABLE
+typedef struct
+{
+    uint32_t end;       // free-running index behind the bytes of one read
+    uint64_t time;
+
+} kserial_mark_t;
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t sum;
+    uint32_t bucket[KSERIAL_HIST_BUCKETS];
+
+} kserial_hist_t;
+#endif
+
+#if KSERIAL_SEQUENCE_ENABLE
+typedef struct
+{
+    uint8_t type;
+    uint8_t param[2];
+    uint16_t next;          // expected sequence number
+    uint64_t window;        // bit i is set when next - 1 - i was received
+    uint32_t received;
+    uint32_t lost;          // skipped numbers that did not arrive later
+    uint32_t gaps;
+    uint32_t reordered;
+    uint32_t duplicate;
+    uint32_t resets;
+
+} kserial_stream_t;
+
+typedef void (*pkserial_gap_t)(void *user, const kserial_stream_t *st, uint16_t expected, uint16_t seq);
+
 typedef struct
 {
     uint32_t size;
     uint32_t count;
+    kserial_stream_t *stream;
+    uint32_t untracked;     // stamped frames of streams beyond size
+    pkserial_gap_t gap;     // optional, called by the read that found the gap
+    void *user;
+
+} kserial_seq_t;
+#endif
+
+#if KSERIAL_CREDIT_ENABLE
+typedef struct
+{
+    uint32_t state;         // KS_OPEN while credit is enforced
+    uint32_t granted;       // free-running, credits sent by the host or received by the device
+    uint32_t consumed;      // free-running, numeric frames read by the host or sent by the device
+
+    // host
+    uint32_t window;        // frames the device may send ahead of the reader
+    uint32_t threshold;     // frames read before the credit is replenished
+    uint32_t pending;       // frames read since the last grant
+    uint32_t grants;
+    uint32_t overrun;       // frames received without credit
+    uint32_t resends;       // limit and sync sent again after KSERIAL_CREDIT_IDLE without numeric frames
+    uint32_t syncs;         // sent counts of the device taken over, frames lost on the way are given back
+    uint32_t sync;          // ask for the sent count with the next grant
+    uint32_t deferred;      // grant left for the next read, the caller was sending
+    uint64_t idle;          // ns without numeric frames up to each resend, needs a transport clock
+    uint64_t last;          // last numeric frame or grant
+
+    // device
+    uint32_t busy;          // the last take found no credit
+    uint32_t stalls;
+    uint64_t stall;         // ns spent without credit, needs a transport clock
+    uint64_t since;         // start of the current stall
+
+} kserial_credit_t;
+#endif
+
+#if KSERIAL_TAP_ENABLE
+typedef struct
+{
+    // bytes as read from the transport, time of the read, 0 without a clock
+    void (*input)(void *user, const uint8_t *data, uint32_t nbyte, uint64_t time);
+    // frame of pk, nbyte on the wire, starting back bytes before the end of the input so far
+    void (*frame)(void *user, const kserial_packet_t *pk, uint32_t back, uint32_t nbyte);
+    void *user;
+
+} kserial_tap_t;
+#endif
+
+typedef struct
+{
+    uint32_t size;      // ring size, power of two
+    uint32_t pksize;    // packets per read
+    uint32_t slabs[KSERIAL_POOL_CLASSES];
+
+} kserial_pool_conf_t;
+
+typedef struct
+{
+    uint32_t size;      // bytes per slab
+    uint32_t count;
+    uint32_t avail;
+    uint8_t *base;
+    void *next;         // free list, the link is stored in the free slab
+
+} kserial_slab_t;
+
+typedef struct
+{
     uint8_t *buffer;
+    uint32_t size;
+    kserial_packet_t *packet;
+    uint32_t pksize;
+    kserial_slab_t slab[KSERIAL_POOL_CLASSES];
+    uint32_t fail;      // payloads without a free slab, the frame stays in the ring
+    void *memory;       // allocated by kserial_pool_init, NULL for a caller block
+
+} kserial_pool_t;
+
+typedef struct
+{
+    uint32_t size;      // ring size, power of two
+    uint32_t head;      // free-running read index
+    uint32_t tail;      // free-running write index
+    uint8_t *buffer;    // size + KSERIAL_MAX_DATA_BYTES, the tail unwraps view packets
 
     uint32_t pkcnt;
+    uint32_t pksize;
     kserial_packet_t *packet;
 
+    uint32_t mode;
+    uint32_t index;     // parse position, becomes head on the next read
+    kserial_parser_t parser;
+    uint8_t *arena;
+    uint32_t arenasize;
+    kserial_pool_t *pool;
+    kserial_counters_t stats;
+#if KSERIAL_TIMESTAMP_ENABLE
+    kserial_mark_t mark[KSERIAL_TIME_MARKS];
+    uint32_t markhead;
+    uint32_t marktail;
+    kserial_hist_t *hist;   // first byte to delivery latency, optional
+#endif
+#if KSERIAL_SEQUENCE_ENABLE
+    kserial_seq_t *seq;     // strip and track sequence numbers, optional
+#endif
+#if KSERIAL_CREDIT_ENABLE
+    kserial_credit_t *credit;   // replenish device credit as frames are read, optional
+#endif
+#if KSERIAL_TAP_ENABLE
+    const kserial_tap_t *tap;   // see the raw input, optional
+#endif
+
 } kserial_t;
 
+typedef struct
+{
+    const kserial_transport_t *transport;
+    void *handle;
+
+#if KSERIAL_SEND_ENABLE
+    uint8_t sbuffer[KS_MAX_SEND_BUFFER_SIZE];
+#endif
+#if KSERIAL_RECV_ENABLE
+    uint8_t rbuffer[KS_MAX_RECV_BUFFER_SIZE];
+    uint32_t rtail;     // kserial_recv_packet ring
+    kserial_parser_t rparser;
+#endif
+#if KSERIAL_CREDIT_ENABLE
+    KSERIAL_COUNTER sending;    // a send holds the transport, the reader grants only when free
+#endif
+
+    kserial_t ks;
+
+} kserial_ctx_t;
+
 typedef struct
 {
     uint32_t type;
@@ -75,6 +368,9 @@ typedef enum
     KSCMD_R0_DEVICE_BAUDRATE    = 0xD1,
     KSCMD_R0_DEVICE_RATE        = 0xD2,
     KSCMD_R0_DEVICE_MDOE        = 0xD3,
+    KSCMD_R0_DEVICE_SEQUENCE    = 0xD4,
+    KSCMD_R0_DEVICE_CREDIT      = 0xD5,
+    KSCMD_R0_DEVICE_ECHO        = 0xD6,
     KSCMD_R0_DEVICE_GET         = 0xE3
 
 } kserial_r0_command_t;
@@ -87,6 +383,7 @@ typedef enum
 } kserial_r2_command_t;
 
 typedef void (*pkserial_callback_t)(kserial_packet_t *pk, uint8_t *data, uint32_t count, uint32_t total);
+typedef void (*pkserial_handler_t)(void *user, const kserial_packet_t *pk);
 
 /* Extern ----------------------------------------------------------------------------------*/
 
@@ -94,10 +391,17 @@ extern const uint32_t KS_TYPE_SIZE[KSERIAL_TYPE_LENS];
 extern const char KS_TYPE_STRING[KSERIAL_TYPE_LENS][4];
 extern const char KS_TYPE_FORMATE[KSERIAL_TYPE_LENS][8];
 
+#if KSERIAL_SERIAL_ENABLE
+extern const kserial_transport_t kserial_transport_serial;  // handle : serial_t *, NULL for the global port
+#endif
+
 /* Functions -------------------------------------------------------------------------------*/
 
 uint32_t    kserial_get_typesize(uint32_t type);
 
+uint32_t    kserial_simd_select(uint32_t isa);
+uint32_t    kserial_find_sync(const uint8_t *buffer, uint32_t lens);
+
 uint32_t    kserial_check_header(const uint8_t *packet, void *param, uint32_t *type, uint32_t *nbyte);
 uint32_t    kserial_check_end(const uint8_t *packet, uint32_t nbyte);
 uint32_t    kserial_check(const uint8_t *packet, void *param, uint32_t *type, uint32_t *nbyte);
@@ -106,27 +410,104 @@ void        kserial_get_bytesdata(const uint8_t *packet, void *pdata, uint32_t n
 uint32_t    kserial_pack(uint8_t *packet, const void *param, uint32_t type, uint32_t lens, const void *pdata);
 uint32_t    kserial_unpack(const uint8_t *packet, void *param, uint32_t *type, uint32_t *nbyte, void *pdata);
 uint32_t    kserial_unpack_buffer(const uint8_t *buffer, uint32_t buffersize, kserial_packet_t *ksp, uint32_t *count);
+uint32_t    kserial_unpack_buffer_view(const uint8_t *buffer, uint32_t buffersize, kserial_packet_t *ksp, uint32_t *count);
+uint32_t    kserial_unpack_buffer_arena(const uint8_t *buffer, uint32_t buffersize, kserial_packet_t *ksp, uint32_t *count, uint8_t *arena, uint32_t arenasize);
+uint32_t    kserial_decode_as(const kserial_packet_t *pk, uint32_t type, void *pdata, uint32_t lens);
+uint32_t    kserial_pack_delta(uint8_t *packet, const void *param, uint32_t type, uint32_t lens, const void *pdata);
+uint32_t    kserial_unpack_delta(const kserial_packet_t *pk, uint32_t *type, void *pdata, uint32_t lens);
+
+uint32_t    kserial_pool_bytes(const kserial_pool_conf_t *conf);
+uint32_t    kserial_pool_init(kserial_pool_t *pool, const kserial_pool_conf_t *conf, void *memory, uint32_t bytes);
+void        kserial_pool_deinit(kserial_pool_t *pool);
+void       *kserial_pool_alloc(kserial_pool_t *pool, uint32_t nbyte);
+void        kserial_pool_free(kserial_pool_t *pool, void *data);
+
+uint32_t    kserial_ctx_init(kserial_ctx_t *ctx, const kserial_transport_t *transport, void *handle,
+                             uint8_t *buffer, uint32_t size, kserial_packet_t *packet, uint32_t pksize);
+uint32_t    kserial_ctx_init_pool(kserial_ctx_t *ctx, const kserial_transport_t *transport, void *handle, kserial_pool_t *pool);
+void        kserial_set_transport(const kserial_transport_t *transport, void *handle);
+uint32_t    kserial_wait_ctx(kserial_ctx_t *ctx, uint32_t timeout);
+uint64_t    kserial_now_ctx(kserial_ctx_t *ctx);
+uint32_t    kserial_set_baudrate_ctx(kserial_ctx_t *ctx, uint32_t baudrate);
 
 uint32_t    kserial_send_packet(void *param, void *pdata, uint32_t lens, uint32_t type);
 uint32_t    kserial_recv_packet(uint8_t input, void *param, void *pdata, uint32_t *lens, uint32_t *type);
+uint32_t    kserial_send_packet_ctx(kserial_ctx_t *ctx, void *param, void *pdata, uint32_t lens, uint32_t type);
+uint32_t    kserial_send_packets(const kserial_packet_t *pks, uint32_t count);
+uint32_t    kserial_send_packets_ctx(kserial_ctx_t *ctx, const kserial_packet_t *pks, uint32_t count);
+uint32_t    kserial_send_delta(void *param, void *pdata, uint32_t lens, uint32_t type);
+uint32_t    kserial_send_delta_ctx(kserial_ctx_t *ctx, void *param, void *pdata, uint32_t lens, uint32_t type);
+#if KSERIAL_SEQUENCE_ENABLE
+uint32_t    kserial_send_seq_ctx(kserial_ctx_t *ctx, void *param, void *pdata, uint32_t lens, uint32_t type, uint16_t seq);
+#endif
+uint32_t    kserial_send_packetv_ctx(kserial_ctx_t *ctx, void *param, uint32_t type, const kserial_iovec_t *iov, uint32_t count);
+uint32_t    kserial_recv_packet_ctx(kserial_ctx_t *ctx, uint8_t input, void *param, void *pdata, uint32_t *lens, uint32_t *type);
 
 uint32_t    kserial_read(kserial_t *ks );
 void        kserial_flush_read(kserial_t *ks );
 void        kserial_get_packetdata(kserial_packet_t *ksp, void *pdata, uint32_t index);
+void        kserial_release_packet(const kserial_t *ks, kserial_packet_t *pk);
 uint32_t    kserial_read_continuous(kserial_packet_t *ksp, uint32_t *index, uint32_t *count, uint32_t *total);
+uint32_t    kserial_read_ctx(kserial_ctx_t *ctx);
+void        kserial_flush_read_ctx(kserial_ctx_t *ctx);
+void        kserial_get_stats(const kserial_t *ks, kserial_stats_t *stats);
+void        kserial_get_stats_ctx(const kserial_ctx_t *ctx, kserial_stats_t *stats);
+#if KSERIAL_TIMESTAMP_ENABLE
+void        kserial_set_histogram_ctx(kserial_ctx_t *ctx, kserial_hist_t *hist);
+void        kserial_hist_reset(kserial_hist_t *hist);
+void        kserial_hist_record(kserial_hist_t *hist, uint64_t value);
+uint64_t    kserial_hist_percentile(const kserial_hist_t *hist, double percent);
+#endif
+#if KSERIAL_SEQUENCE_ENABLE
+void        kserial_set_sequence_ctx(kserial_ctx_t *ctx, kserial_seq_t *sq);
+void        kserial_seq_init(kserial_seq_t *sq, kserial_stream_t *stream, uint32_t size, pkserial_gap_t gap, void *user);
+void        kserial_seq_reset(kserial_seq_t *sq);
+uint32_t    kserial_seq_update(kserial_seq_t *sq, const kserial_packet_t *pk);
+kserial_stream_t *kserial_seq_find(const kserial_seq_t *sq, uint32_t type, uint32_t param1, uint32_t param2);
+#endif
+#if KSERIAL_CREDIT_ENABLE
+uint32_t    kserial_credit_available(const kserial_credit_t *cr);
+uint32_t    kserial_credit_take(kserial_ctx_t *ctx, kserial_credit_t *cr);
+uint32_t    kserial_credit_dispatch(kserial_ctx_t *ctx, kserial_credit_t *cr, const kserial_packet_t *pk);
+#endif
+#if KSERIAL_TAP_ENABLE
+void        kserial_set_tap_ctx(kserial_ctx_t *ctx, const kserial_tap_t *tap);
+#endif
+uint32_t    kserial_read_continuous_ctx(kserial_ctx_t *ctx, kserial_packet_t *ksp, uint32_t *index, uint32_t *count, uint32_t *total);
 
+uint32_t    kscmd_check_response(const kserial_packet_t *pk, uint32_t match, uint32_t type, const uint8_t *param);
 uint32_t    kscmd_send_command(uint32_t type, uint32_t param1, uint32_t param2, kserial_ack_t *ack);
 uint32_t    kscmd_check_device(uint32_t *id);
+uint32_t    kscmd_send_command_ctx(kserial_ctx_t *ctx, uint32_t type, uint32_t param1, uint32_t param2, kserial_ack_t *ack);
+uint32_t    kscmd_check_device_ctx(kserial_ctx_t *ctx, uint32_t *id);
 
 uint32_t    kscmd_set_baudrate(int32_t baudrate);
 uint32_t    kscmd_set_updaterate(int32_t updaterate);
 uint32_t    kscmd_set_mode(int32_t mode);
 uint32_t    kscmd_get_value(uint32_t item, int32_t *value);
+uint32_t    kscmd_set_baudrate_ctx(kserial_ctx_t *ctx, int32_t baudrate);
+uint32_t    kscmd_set_updaterate_ctx(kserial_ctx_t *ctx, int32_t updaterate);
+uint32_t    kscmd_set_mode_ctx(kserial_ctx_t *ctx, int32_t mode);
+uint32_t    kscmd_get_value_ctx(kserial_ctx_t *ctx, uint32_t item, int32_t *value);
+#if KSERIAL_SEQUENCE_ENABLE
+uint32_t    kscmd_set_sequence(kserial_seq_t *sq);
+uint32_t    kscmd_set_sequence_ctx(kserial_ctx_t *ctx, kserial_seq_t *sq);
+#endif
+#if KSERIAL_CREDIT_ENABLE
+uint32_t    kscmd_set_credit(kserial_credit_t *cr, uint32_t window);
+uint32_t    kscmd_set_credit_ctx(kserial_ctx_t *ctx, kserial_credit_t *cr, uint32_t window);
+#endif
 
+uint32_t    kscmd_twi_writereg(uint8_t slaveaddr, uint8_t regaddr, uint8_t regdata);
 uint32_t    kscmd_twi_readregs(uint8_t slaveaddr, uint8_t regaddr, uint8_t *regdata, uint8_t lens);
 uint32_t    kscmd_twi_writeregs(uint8_t slaveaddr, uint8_t regaddr, uint8_t *regdata, uint8_t lens);
 uint32_t    kscmd_twi_scandevice( uint8_t *slaveaddr);
 uint32_t    kscmd_twi_scanregister(uint8_t slaveaddr, uint8_t reg[256]);
+uint32_t    kscmd_twi_writereg_ctx(kserial_ctx_t *ctx, uint8_t slaveaddr, uint8_t regaddr, uint8_t regdata);
+uint32_t    kscmd_twi_readregs_ctx(kserial_ctx_t *ctx, uint8_t slaveaddr, uint8_t regaddr, uint8_t *regdata, uint8_t lens);
+uint32_t    kscmd_twi_writeregs_ctx(kserial_ctx_t *ctx, uint8_t slaveaddr, uint8_t regaddr, uint8_t *regdata, uint8_t lens);
+uint32_t    kscmd_twi_scandevice_ctx(kserial_ctx_t *ctx, uint8_t *slaveaddr);
+uint32_t    kscmd_twi_scanregister_ctx(kserial_ctx_t *ctx, uint8_t slaveaddr, uint8_t reg[256]);
 
 #ifdef __cplusplus
 }
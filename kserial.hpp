@@ -0,0 +1,316 @@
+/**
+ *      __            ____
+ *     / /__ _  __   / __/                      __  
+ *    / //_/(_)/ /_ / /  ___   ____ ___  __ __ / /_ 
+ *   / ,<  / // __/_\ \ / _ \ / __// _ \/ // // __/ 
+ *  /_/|_|/_/ \__//___// .__//_/   \___/\_,_/ \__/  
+ *                    /_/   github.com/KitSprout    
+ * 
+ *  @file    kserial.hpp
+ *  @author  KitSprout
+ *  @brief   header-only C++17 layer, type codes and sizes are resolved at compile time
+ *           kserial::encode<T, N> packs a fixed size array into a std::array frame,
+ *           kserial::view<T> reads a received payload of type T in place.
+ */
+
+/* Define to prevent recursive inclusion ---------------------------------------------------*/
+#ifndef __KSERIAL_HPP
+#define __KSERIAL_HPP
+
+/* Includes --------------------------------------------------------------------------------*/
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <type_traits>
+#if (__cplusplus >= 202002L) && defined(__has_include)
+#if __has_include(<span>)
+#include <span>
+#define KSERIAL_STD_SPAN
+#endif
+#endif
+#include "kserial.h"
+
+namespace kserial
+{
+
+/* Typedef ---------------------------------------------------------------------------------*/
+
+using param_t = std::array<uint8_t, 2>;
+
+#ifdef KSERIAL_STD_SPAN
+inline constexpr std::size_t dynamic_extent = std::dynamic_extent;
+
+template <typename T, std::size_t E = dynamic_extent>
+using span = std::span<T, E>;
+#else
+inline constexpr std::size_t dynamic_extent = static_cast<std::size_t>(-1);
+
+/**
+ *  @brief  span
+ *  Subset of std::span for C++17, contiguous elements with a static or dynamic extent.
+ */
+template <typename T, std::size_t E = dynamic_extent>
+class span
+{
+public:
+    static constexpr std::size_t extent = E;
+
+    template <std::size_t N = E, typename = std::enable_if_t<(N == 0) || (N == dynamic_extent)>>
+    constexpr span() noexcept : ptr(nullptr), count(0) {}
+    constexpr span(T *data, std::size_t size) noexcept : ptr(data), count(size) {}
+    template <std::size_t N, typename = std::enable_if_t<(E == dynamic_extent) || (E == N)>>
+    constexpr span(T (&data)[N]) noexcept : ptr(data), count(N) {}
+    template <typename U, std::size_t N, typename = std::enable_if_t<((E == dynamic_extent) || (E == N)) && std::is_convertible_v<U (*)[], T (*)[]>>>
+    constexpr span(std::array<U, N> &data) noexcept : ptr(data.data()), count(N) {}
+    template <typename U, std::size_t N, typename = std::enable_if_t<((E == dynamic_extent) || (E == N)) && std::is_convertible_v<const U (*)[], T (*)[]>>>
+    constexpr span(const std::array<U, N> &data) noexcept : ptr(data.data()), count(N) {}
+    template <typename U, std::size_t N, typename = std::enable_if_t<((E == dynamic_extent) || (E == N)) && std::is_convertible_v<U (*)[], T (*)[]>>>
+    constexpr span(const span<U, N> &other) noexcept : ptr(other.data()), count(other.size()) {}
+
+    constexpr T *data() const noexcept { return ptr; }
+    constexpr std::size_t size() const noexcept { return (E == dynamic_extent) ? count : E; }
+    constexpr std::size_t size_bytes() const noexcept { return size() * sizeof(T); }
+    constexpr bool empty() const noexcept { return size() == 0; }
+    constexpr T &operator[](std::size_t index) const noexcept { return ptr[index]; }
+    constexpr T *begin() const noexcept { return ptr; }
+    constexpr T *end() const noexcept { return ptr + size(); }
+
+private:
+    T *ptr;
+    std::size_t count;
+};
+#endif
+
+/* Define ----------------------------------------------------------------------------------*/
+
+/**
+ *  @brief  type_code
+ *  KS_xxx of an element type, only exact fixed width integers, float and double map.
+ */
+template <typename T> struct type_code;
+template <> struct type_code<uint8_t>  : std::integral_constant<uint32_t, KS_U8>  {};
+template <> struct type_code<uint16_t> : std::integral_constant<uint32_t, KS_U16> {};
+template <> struct type_code<uint32_t> : std::integral_constant<uint32_t, KS_U32> {};
+template <> struct type_code<uint64_t> : std::integral_constant<uint32_t, KS_U64> {};
+template <> struct type_code<int8_t>   : std::integral_constant<uint32_t, KS_I8>  {};
+template <> struct type_code<int16_t>  : std::integral_constant<uint32_t, KS_I16> {};
+template <> struct type_code<int32_t>  : std::integral_constant<uint32_t, KS_I32> {};
+template <> struct type_code<int64_t>  : std::integral_constant<uint32_t, KS_I64> {};
+template <> struct type_code<float>    : std::integral_constant<uint32_t, KS_F32> {};
+template <> struct type_code<double>   : std::integral_constant<uint32_t, KS_F64> {};
+template <typename T> struct type_code<const T> : type_code<T> {};
+
+template <typename T>
+inline constexpr uint32_t type_code_v = type_code<T>::value;
+
+/**
+ *  @brief  type_size
+ *  constexpr copy of KS_TYPE_SIZE, 0 for R0 ~ R4.
+ */
+constexpr uint32_t type_size(uint32_t type) noexcept
+{
+    constexpr uint32_t size[KSERIAL_TYPE_LENS] =
+    {
+        1, 2, 4, 8,
+        1, 2, 4, 8,
+        0, 2, 4, 8,
+        0, 0, 0, 0
+    };
+    return size[type & 0x0F];
+}
+
+template <typename T>
+inline constexpr uint32_t type_size_v = type_size(type_code_v<T>);
+
+template <typename T, std::size_t N>
+inline constexpr std::size_t frame_size_v = N * sizeof(T) + 8;
+
+static_assert(sizeof(float) == 4 && sizeof(double) == 8, "float and double must be IEEE 754 single and double");
+
+/* Functions -------------------------------------------------------------------------------*/
+
+/**
+ *  @brief  header
+ *  The 7 header bytes of a frame with nbyte payload bytes.
+ */
+constexpr void header(uint8_t *frame, param_t param, uint32_t type, uint32_t nbyte) noexcept
+{
+    frame[0] = 'K';
+    frame[1] = 'S';
+    frame[2] = static_cast<uint8_t>((type << 4) | (nbyte >> 8));
+    frame[3] = static_cast<uint8_t>(nbyte);
+    frame[4] = param[0];
+    frame[5] = param[1];
+    frame[6] = static_cast<uint8_t>(frame[2] + frame[3] + frame[4] + frame[5]);
+}
+
+/**
+ *  @brief  encode
+ *  Frame of a fixed size array, the payload size is checked at compile time.
+ */
+template <typename T, std::size_t N, typename = std::enable_if_t<N != dynamic_extent>>
+std::array<uint8_t, frame_size_v<T, N>> encode(param_t param, span<const T, N> data) noexcept
+{
+    constexpr uint32_t nbyte = static_cast<uint32_t>(N * sizeof(T));
+    static_assert(nbyte <= KSERIAL_MAX_DATA_BYTES, "payload does not fit the 12-bit LN");
+    static_assert(type_size_v<T> == sizeof(T), "type size does not match KS_TYPE_SIZE");
+    std::array<uint8_t, frame_size_v<T, N>> frame;
+
+    header(frame.data(), param, type_code_v<T>, nbyte);
+    if constexpr (nbyte != 0)
+    {
+        std::memcpy(&frame[7], data.data(), nbyte);
+    }
+    frame[7 + nbyte] = '\r';
+    return frame;
+}
+
+template <typename T, std::size_t N>
+std::array<uint8_t, frame_size_v<T, N>> encode(param_t param, const T (&data)[N]) noexcept
+{
+    return encode<T, N>(param, span<const T, N>(data));
+}
+
+template <typename T, std::size_t N>
+std::array<uint8_t, frame_size_v<T, N>> encode(param_t param, const std::array<T, N> &data) noexcept
+{
+    return encode<T, N>(param, span<const T, N>(data));
+}
+
+/**
+ *  @brief  encode
+ *  Frame of a runtime sized array into frame, which holds data.size() * sizeof(T) + 8 bytes.
+ *  Return the frame bytes, 0 when the payload does not fit the 12-bit LN.
+ */
+template <typename T>
+uint32_t encode(param_t param, span<const T> data, uint8_t *frame) noexcept
+{
+    static_assert(type_size_v<T> == sizeof(T), "type size does not match KS_TYPE_SIZE");
+    const std::size_t nbyte = data.size() * sizeof(T);
+
+    if (nbyte > KSERIAL_MAX_DATA_BYTES)
+    {
+        return 0;
+    }
+    header(frame, param, type_code_v<T>, static_cast<uint32_t>(nbyte));
+    if (nbyte != 0)
+    {
+        std::memcpy(&frame[7], data.data(), nbyte);
+    }
+    frame[7 + nbyte] = '\r';
+    return static_cast<uint32_t>(nbyte + 8);
+}
+
+/**
+ *  @brief  send
+ *  kserial_send_packet_ctx with the type code and lens taken from data.
+ */
+template <typename T, std::size_t N>
+uint32_t send(kserial_ctx_t *ctx, param_t param, span<const T, N> data) noexcept
+{
+    static_assert(type_size_v<T> == sizeof(T), "type size does not match KS_TYPE_SIZE");
+    if constexpr (N != dynamic_extent)
+    {
+        static_assert((N * sizeof(T)) <= KSERIAL_MAX_DATA_BYTES, "payload does not fit the 12-bit LN");
+    }
+    else if (data.size_bytes() > KSERIAL_MAX_DATA_BYTES)
+    {
+        return KS_ERROR;
+    }
+    return kserial_send_packet_ctx(ctx, param.data(), const_cast<T *>(data.data()), static_cast<uint32_t>(data.size()), type_code_v<T>);
+}
+
+/**
+ *  @brief  view
+ *  Elements of type T in the payload of a received packet, empty if the packet type differs.
+ *  The payload may be unaligned, elements are loaded by value. Valid as long as the packet data.
+ */
+template <typename T>
+class view
+{
+    static_assert(std::is_trivially_copyable_v<T>, "view needs a trivially copyable type");
+    static_assert(type_size_v<T> == sizeof(T), "type size does not match KS_TYPE_SIZE");
+
+public:
+    class iterator
+    {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = T;
+
+        constexpr iterator() noexcept : ptr(nullptr) {}
+        constexpr explicit iterator(const uint8_t *p) noexcept : ptr(p) {}
+
+        T operator*() const noexcept { T value; std::memcpy(&value, ptr, sizeof(T)); return value; }
+        T operator[](difference_type n) const noexcept { return *(*this + n); }
+        iterator &operator++() noexcept { ptr += sizeof(T); return *this; }
+        iterator operator++(int) noexcept { iterator it = *this; ptr += sizeof(T); return it; }
+        iterator &operator--() noexcept { ptr -= sizeof(T); return *this; }
+        iterator operator--(int) noexcept { iterator it = *this; ptr -= sizeof(T); return it; }
+        iterator &operator+=(difference_type n) noexcept { ptr += n * static_cast<difference_type>(sizeof(T)); return *this; }
+        iterator &operator-=(difference_type n) noexcept { ptr -= n * static_cast<difference_type>(sizeof(T)); return *this; }
+        friend iterator operator+(iterator it, difference_type n) noexcept { return it += n; }
+        friend iterator operator+(difference_type n, iterator it) noexcept { return it += n; }
+        friend iterator operator-(iterator it, difference_type n) noexcept { return it -= n; }
+        friend difference_type operator-(iterator a, iterator b) noexcept { return (a.ptr - b.ptr) / static_cast<difference_type>(sizeof(T)); }
+        friend bool operator==(iterator a, iterator b) noexcept { return a.ptr == b.ptr; }
+        friend bool operator!=(iterator a, iterator b) noexcept { return a.ptr != b.ptr; }
+        friend bool operator<(iterator a, iterator b) noexcept { return a.ptr < b.ptr; }
+        friend bool operator>(iterator a, iterator b) noexcept { return a.ptr > b.ptr; }
+        friend bool operator<=(iterator a, iterator b) noexcept { return a.ptr <= b.ptr; }
+        friend bool operator>=(iterator a, iterator b) noexcept { return a.ptr >= b.ptr; }
+
+    private:
+        const uint8_t *ptr;
+    };
+
+    explicit view(const kserial_packet_t &pk) noexcept
+        : ptr((pk.type == type_code_v<T>) ? static_cast<const uint8_t *>(pk.data) : nullptr),
+          count((ptr != nullptr) ? (pk.nbyte / sizeof(T)) : 0)
+    {
+    }
+
+    explicit operator bool() const noexcept { return ptr != nullptr; }
+    std::size_t size() const noexcept { return count; }
+    bool empty() const noexcept { return count == 0; }
+    const uint8_t *bytes() const noexcept { return ptr; }
+
+    T operator[](std::size_t index) const noexcept
+    {
+        T value;
+        std::memcpy(&value, ptr + index * sizeof(T), sizeof(T));
+        return value;
+    }
+
+    iterator begin() const noexcept { return iterator(ptr); }
+    iterator end() const noexcept { return iterator(ptr + count * sizeof(T)); }
+
+    /**
+     *  @brief  copy
+     *  Copy up to out.size() elements, return the number copied.
+     */
+    std::size_t copy(span<T> out) const noexcept
+    {
+        std::size_t n = (out.size() < count) ? out.size() : count;
+        if (n != 0)
+        {
+            std::memcpy(out.data(), ptr, n * sizeof(T));
+        }
+        return n;
+    }
+
+private:
+    const uint8_t *ptr;
+    std::size_t count;
+};
+
+}   // namespace kserial
+
+#endif
+
+/*************************************** END OF FILE ****************************************/
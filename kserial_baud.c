@@ -0,0 +1,551 @@
+/**
+ *      __            ____
+ *     / /__ _  __   / __/                      __  
+ *    / //_/(_)/ /_ / /  ___   ____ ___  __ __ / /_ 
+ *   / ,<  / // __/_\ \ / _ \ / __// _ \/ // // __/ 
+ *  /_/|_|/_/ \__//___// .__//_/   \___/\_,_/ \__/  
+ *                    /_/   github.com/KitSprout    
+ * 
+ *  @file    kserial_baud.c
+ *  @author  KitSprout
+ *  @brief   baud rate negotiation and link probing
+ *           The host asks for a new rate with KSCMD_R0_DEVICE_BAUDRATE, the device checks that
+ *           its transport takes the rate, echoes the request at the old rate and switches.
+ *           Both sides then exchange a burst of KSCMD_R0_DEVICE_ECHO frames at the new rate,
+ *           the host counts missing and damaged echoes together with the checksum and
+ *           terminator failures of the receive counters. A clean probe is committed, otherwise
+ *           the host switches back and the device reverts by itself KSERIAL_BAUD_CONFIRM ms
+ *           after the request or the last probe frame.
+ *           A committed rate is watched too, the device goes back to rate[0] after a
+ *           KSERIAL_BAUD_SILENCE period without valid frames or with KSERIAL_BAUD_ERRORS receive
+ *           errors. kserial_baud_check keeps a quiet link alive and meets the device there when
+ *           the link got too bad to command.
+ *           Host functions block, the device side takes a caller supplied millisecond tick.
+ *           Negotiate while the device is not streaming.
+ */
+
+/* Includes --------------------------------------------------------------------------------*/
+#include <string.h>
+#include "kserial_baud.h"
+
+/* Define ----------------------------------------------------------------------------------*/
+/* Macro -----------------------------------------------------------------------------------*/
+/* Typedef ---------------------------------------------------------------------------------*/
+/* Variables -------------------------------------------------------------------------------*/
+/* Prototypes ------------------------------------------------------------------------------*/
+/* Functions -------------------------------------------------------------------------------*/
+
+/**
+ *  @brief  kserial_baud_elapsed
+ *  Milliseconds since start, without a transport clock count one ms per call.
+ */
+static uint32_t kserial_baud_elapsed(kserial_ctx_t *ctx, uint64_t start, uint32_t elapsed)
+{
+    return (start != 0) ? (uint32_t)((kserial_now_ctx(ctx) - start) / 1000000) : (elapsed + 1);
+}
+
+/**
+ *  @brief  kserial_baud_frame
+ *  Milliseconds on the wire of a frame with nbyte payload, 10 bits per byte.
+ */
+static uint32_t kserial_baud_frame(uint32_t nbyte, uint32_t baudrate)
+{
+    return (baudrate != 0) ? (uint32_t)((uint64_t)(nbyte + 8) * 10 * 1000 / baudrate) : 0;
+}
+
+/**
+ *  @brief  kserial_baud_request
+ *  Send ['K', 'S', R0, lens, 0xD1, param2, ck, data ..., '\r'] and wait for the echo.
+ */
+static uint32_t kserial_baud_request(kserial_baud_t *bd, uint8_t param2, void *pdata, uint32_t lens, uint32_t timeout)
+{
+    kserial_ctx_t *ctx = bd->ctx;
+    kserial_t *ks = &ctx->ks;
+    uint8_t param[2] = {KSCMD_R0_DEVICE_BAUDRATE, param2};
+    uint64_t start = kserial_now_ctx(ctx);
+    uint32_t elapsed = 0;
+    uint32_t status = KS_TIMEOUT;
+    uint32_t count;
+
+    kserial_send_packet_ctx(ctx, param, pdata, lens, KS_R0);
+    while ((status != KS_OK) && (elapsed <= timeout))
+    {
+        count = kserial_read_ctx(ctx);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (kscmd_check_response(&ks->packet[i], KSCMD_MATCH_ALL, KS_R0, param) == KS_OK)
+            {
+                status = KS_OK;
+            }
+            kserial_release_packet(ks, &ks->packet[i]);
+        }
+        if ((status != KS_OK) && (count == 0) && (kserial_wait_ctx(ctx, 1) == KS_ERROR))
+        {
+            break;
+        }
+        elapsed = kserial_baud_elapsed(ctx, start, elapsed);
+    }
+
+    return status;
+}
+
+/**
+ *  @brief  kserial_baud_drain
+ *  Discard input for timeout ms.
+ */
+static void kserial_baud_drain(kserial_baud_t *bd, uint32_t timeout)
+{
+    kserial_ctx_t *ctx = bd->ctx;
+    uint64_t start = kserial_now_ctx(ctx);
+    uint32_t elapsed = 0;
+    uint32_t count;
+
+    while (elapsed <= timeout)
+    {
+        count = kserial_read_ctx(ctx);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            kserial_release_packet(&ctx->ks, &ctx->ks.packet[i]);
+        }
+        if ((count == 0) && (kserial_wait_ctx(ctx, 1) == KS_ERROR))
+        {
+            break;
+        }
+        elapsed = kserial_baud_elapsed(ctx, start, elapsed);
+    }
+    kserial_flush_read_ctx(ctx);
+}
+
+/**
+ *  @brief  kserial_baud_run
+ *  Echo burst at baudrate, which only sets the timeout.
+ *  burst and nbyte are clamped first, every probe path runs through here.
+ */
+static uint32_t kserial_baud_run(kserial_baud_t *bd, uint32_t baudrate)
+{
+    kserial_ctx_t *ctx = bd->ctx;
+    kserial_t *ks = &ctx->ks;
+    kserial_packet_t *pk;
+    kserial_stats_t before;
+    kserial_stats_t after;
+    uint8_t payload[KSERIAL_MAX_DATA_BYTES];
+    uint8_t seen[256] = {0};
+    uint8_t param[2] = {KSCMD_R0_DEVICE_ECHO, 0};
+    uint64_t start;
+    uint64_t bytes = 0;
+    uint32_t elapsed = 0;
+    uint32_t timeout = KSCMD_RESPONSE_TIMEOUT;
+    uint32_t idle;
+    uint32_t last = 0;
+    uint32_t received = 0;
+    uint32_t bad = 0;
+    uint32_t count;
+
+    if (bd->burst > 256)
+    {   // one byte of sequence in P2
+        bd->burst = 256;
+    }
+    if (bd->nbyte > KSERIAL_MAX_DATA_BYTES)
+    {
+        bd->nbyte = KSERIAL_MAX_DATA_BYTES;
+    }
+    idle = KSCMD_RESPONSE_TIMEOUT + 2 * kserial_baud_frame(bd->nbyte, baudrate);
+    if (baudrate != 0)
+    {   // 10 bits per byte, both directions
+        timeout += (uint32_t)((uint64_t)bd->burst * (bd->nbyte + 8) * 20 * 1000 / baudrate);
+    }
+    kserial_flush_read_ctx(ctx);
+    kserial_get_stats_ctx(ctx, &before);
+    start = kserial_now_ctx(ctx);
+    for (uint32_t i = 0; i < bd->burst; i++)
+    {
+        param[1] = i;
+        for (uint32_t n = 0; n < bd->nbyte; n++)
+        {
+            payload[n] = (uint8_t)(i * 31 + n);
+        }
+        kserial_send_packet_ctx(ctx, param, payload, bd->nbyte, KS_R0);
+    }
+    while ((received < bd->burst) && (elapsed <= timeout) && ((elapsed - last) <= idle))
+    {   // a lost echo ends the burst once the line is quiet
+        count = kserial_read_ctx(ctx);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            pk = &ks->packet[i];
+            if ((pk->type == KS_R0) && (pk->param[0] == KSCMD_R0_DEVICE_ECHO) && (pk->param[1] < bd->burst) &&
+                (pk->nbyte == bd->nbyte) && !seen[pk->param[1]])
+            {
+                for (uint32_t n = 0; n < bd->nbyte; n++)
+                {
+                    payload[n] = (uint8_t)(pk->param[1] * 31 + n);
+                }
+                if ((bd->nbyte == 0) || (memcmp(pk->data, payload, bd->nbyte) == 0))
+                {
+                    seen[pk->param[1]] = 1;
+                    received++;
+                    bytes += bd->nbyte + 8;
+                }
+                else
+                {
+                    bad++;
+                }
+            }
+            else
+            {
+                bad++;
+            }
+            kserial_release_packet(ks, pk);
+        }
+        if ((count == 0) && (kserial_wait_ctx(ctx, 1) == KS_ERROR))
+        {
+            break;
+        }
+        elapsed = kserial_baud_elapsed(ctx, start, elapsed);
+        if (count != 0)
+        {
+            last = elapsed;
+        }
+    }
+    kserial_get_stats_ctx(ctx, &after);
+
+    bd->echoed = received;
+    bd->errors = (after.checksum - before.checksum) + (after.terminator - before.terminator) +
+                 (after.skipped - before.skipped) + bad + (bd->burst - received);
+    bd->elapsed = elapsed;
+    bd->throughput = ((start != 0) && (elapsed != 0)) ? (uint32_t)(bytes * 1000 / elapsed) : 0;
+
+    return (bd->errors == 0) ? KS_OK : KS_ERROR;
+}
+
+/**
+ *  @brief  kserial_baud_init
+ *  rate : candidates in ascending order, both sides start at rate[0], NULL on a device
+ *         that accepts any rate its transport can set
+ */
+void kserial_baud_init(kserial_baud_t *bd, kserial_ctx_t *ctx, const uint32_t *rate, uint32_t count)
+{
+    memset(bd, 0, sizeof(kserial_baud_t));
+    bd->ctx = ctx;
+    bd->rate = rate;
+    bd->count = count;
+    bd->burst = KSERIAL_BAUD_BURST;
+    bd->nbyte = 256;
+    bd->baudrate = ((rate != NULL) && (count != 0)) ? rate[0] : 0;
+    kserial_get_stats_ctx(ctx, &bd->mark);
+}
+
+/**
+ *  @brief  kserial_baud_probe
+ *  Echo burst at the rate in use, KS_OK when every frame came back intact.
+ */
+uint32_t kserial_baud_probe(kserial_baud_t *bd)
+{
+    return kserial_baud_run(bd, (bd->rate != NULL) ? bd->rate[bd->index] : 0);
+}
+
+/**
+ *  @brief  kserial_baud_step
+ *  Move both sides to rate[index], probe and commit. On failure both sides are back at the
+ *  previous rate and KS_ERROR is returned.
+ */
+uint32_t kserial_baud_step(kserial_baud_t *bd, uint32_t index)
+{
+    kserial_ctx_t *ctx = bd->ctx;
+    uint32_t rate;
+    uint32_t committed = KS_ERROR;
+    uint8_t request[4];
+
+    if ((bd->rate == NULL) || (index >= bd->count) || (index == bd->index))
+    {
+        return KS_ERROR;
+    }
+    rate = bd->rate[index];
+    request[0] = rate;
+    request[1] = rate >> 8;
+    request[2] = rate >> 16;
+    request[3] = rate >> 24;
+    kserial_flush_read_ctx(ctx);
+    if (kserial_baud_request(bd, KSCMD_BAUD_SET, request, 4, KSCMD_RESPONSE_TIMEOUT) != KS_OK)
+    {
+        return KS_ERROR;
+    }
+    if (kserial_set_baudrate_ctx(ctx, rate) == KS_OK)
+    {
+        if (kserial_baud_run(bd, rate) == KS_OK)
+        {
+            committed = kserial_baud_request(bd, KSCMD_BAUD_COMMIT, NULL, 0, KSCMD_RESPONSE_TIMEOUT);
+            if (committed == KS_OK)
+            {
+                bd->index = index;
+                kserial_get_stats_ctx(ctx, &bd->mark);
+                return KS_OK;
+            }
+        }
+    }
+
+    // without a commit the device reverts by itself
+    kserial_set_baudrate_ctx(ctx, bd->rate[bd->index]);
+    kserial_baud_drain(bd, KSERIAL_BAUD_CONFIRM + KSCMD_RESPONSE_TIMEOUT);
+    if ((committed != KS_ERROR) && (kserial_baud_run(bd, bd->rate[bd->index]) != KS_OK))
+    {   // the commit reached the device but its echo was lost
+        kserial_set_baudrate_ctx(ctx, rate);
+        if (kserial_baud_run(bd, rate) == KS_OK)
+        {
+            bd->index = index;
+            kserial_get_stats_ctx(ctx, &bd->mark);
+            return KS_OK;
+        }
+        kserial_set_baudrate_ctx(ctx, bd->rate[bd->index]);
+    }
+    kserial_get_stats_ctx(ctx, &bd->mark);
+
+    return KS_ERROR;
+}
+
+/**
+ *  @brief  kserial_baud_restart
+ *  Meet the device at rate[0], probing until it has reverted after a silent or damaged
+ *  watch period.
+ */
+static uint32_t kserial_baud_restart(kserial_baud_t *bd)
+{
+    kserial_ctx_t *ctx = bd->ctx;
+    uint64_t start = kserial_now_ctx(ctx);
+    uint32_t elapsed = 0;
+    uint32_t probed;
+
+    kserial_set_baudrate_ctx(ctx, bd->rate[0]);
+    bd->index = 0;
+    do
+    {   // the last probe starts after the device has certainly reverted
+        probed = elapsed;
+        if (kserial_baud_probe(bd) == KS_OK)
+        {
+            kserial_get_stats_ctx(ctx, &bd->mark);
+            return KS_OK;
+        }
+        kserial_baud_drain(bd, KSERIAL_BAUD_SILENCE / 4);
+        elapsed = (start != 0) ? (uint32_t)((kserial_now_ctx(ctx) - start) / 1000000) : (elapsed + KSERIAL_BAUD_SILENCE / 4);
+    }
+    while (probed <= (2 * KSERIAL_BAUD_SILENCE + KSERIAL_BAUD_CONFIRM));
+
+    return KS_ERROR;
+}
+
+/**
+ *  @brief  kserial_baud_negotiate
+ *  Step up through the candidates until a rate fails, return the rate in use.
+ */
+uint32_t kserial_baud_negotiate(kserial_baud_t *bd)
+{
+    while (((bd->index + 1) < bd->count) && (kserial_baud_step(bd, bd->index + 1) == KS_OK))
+    {
+        continue;
+    }
+    return bd->rate[bd->index];
+}
+
+/**
+ *  @brief  kserial_baud_check
+ *  Call periodically on the host, at least every KSERIAL_BAUD_SILENCE / 2 ms away from rate[0].
+ *  A clean link is kept alive, a checksum, terminator or framing failure since the last check
+ *  steps down one rate, bytes at a rate the device left only show as skipped. When the link
+ *  is too damaged to command, both sides meet at rate[0] and step up again as far as the
+ *  previous rate allows.
+ *  Return KS_OK when the link is clean, KS_BUSY after a fallback, KS_ERROR if none worked.
+ */
+uint32_t kserial_baud_check(kserial_baud_t *bd)
+{
+    kserial_ctx_t *ctx = bd->ctx;
+    kserial_stats_t stats;
+    uint8_t param[2] = {KSCMD_R0_DEVICE_BAUDRATE, KSCMD_BAUD_KEEP};
+    uint32_t index = bd->index;
+    uint32_t errors;
+
+    kserial_get_stats_ctx(ctx, &stats);
+    errors = (stats.checksum - bd->mark.checksum) + (stats.terminator - bd->mark.terminator) +
+             (stats.skipped - bd->mark.skipped);
+    bd->mark = stats;
+    if (errors == 0)
+    {   // the device may hear nothing else from the host
+        if (index != 0)
+        {
+            kserial_send_packet_ctx(ctx, param, NULL, 0, KS_R0);
+        }
+        return KS_OK;
+    }
+    if (index == 0)
+    {
+        return KS_ERROR;
+    }
+    if (kserial_baud_step(bd, index - 1) != KS_OK)
+    {
+        if (kserial_baud_restart(bd) != KS_OK)
+        {
+            return KS_ERROR;
+        }
+        while (((bd->index + 1) < index) && (kserial_baud_step(bd, bd->index + 1) == KS_OK))
+        {
+            continue;
+        }
+    }
+    bd->fallbacks++;
+
+    return KS_BUSY;
+}
+
+/**
+ *  @brief  kserial_baud_accept
+ *  Device side, KS_OK when rate is a candidate its transport takes. A known rate in use is
+ *  set again after the trial, the echo still has to go out at it.
+ */
+static uint32_t kserial_baud_accept(kserial_baud_t *bd, uint32_t rate)
+{
+    const kserial_transport_t *transport = bd->ctx->transport;
+    uint32_t listed = (bd->rate == NULL);
+
+    for (uint32_t i = 0; (i < bd->count) && !listed; i++)
+    {
+        listed = (bd->rate[i] == rate);
+    }
+    if ((rate == 0) || !listed || (transport == NULL) || (transport->setbaud == NULL))
+    {
+        return KS_ERROR;
+    }
+    if (bd->baudrate == 0)
+    {
+        return KS_OK;
+    }
+    if (kserial_set_baudrate_ctx(bd->ctx, rate) != KS_OK)
+    {
+        return KS_ERROR;
+    }
+
+    return kserial_set_baudrate_ctx(bd->ctx, bd->baudrate);
+}
+
+/**
+ *  @brief  kserial_baud_watch
+ *  Device side, start a new watch period.
+ */
+static void kserial_baud_watch(kserial_baud_t *bd, uint32_t now)
+{
+    kserial_get_stats_ctx(bd->ctx, &bd->mark);
+    bd->watch = now;
+    bd->heard = 0;
+    bd->faults = 0;
+}
+
+/**
+ *  @brief  kserial_baud_dispatch
+ *  Device side, answer echo and baud rate commands. Return KS_ERROR if pk is neither.
+ */
+uint32_t kserial_baud_dispatch(kserial_baud_t *bd, const kserial_packet_t *pk, uint32_t now)
+{
+    uint8_t param[2] = {pk->param[0], pk->param[1]};
+    const uint8_t *request = (const uint8_t *)pk->data;
+    uint32_t rate;
+
+    if (pk->type != KS_R0)
+    {
+        return KS_ERROR;
+    }
+    if (pk->param[0] == KSCMD_R0_DEVICE_ECHO)
+    {
+        kserial_send_packet_ctx(bd->ctx, param, pk->data, pk->nbyte, KS_R0);
+        if (bd->pending)
+        {   // a probe at a slow rate may outlast the confirm time
+            bd->deadline = now + KSERIAL_BAUD_CONFIRM + 2 * kserial_baud_frame(pk->nbyte, bd->baudrate);
+        }
+        return KS_OK;
+    }
+    if (pk->param[0] != KSCMD_R0_DEVICE_BAUDRATE)
+    {
+        return KS_ERROR;
+    }
+    if ((pk->param[1] == KSCMD_BAUD_SET) && (pk->nbyte >= 4))
+    {
+        rate = request[0] | (request[1] << 8) | (request[2] << 16) | ((uint32_t)request[3] << 24);
+        if (kserial_baud_accept(bd, rate) != KS_OK)
+        {   // not echoed, the host times out at the old rate
+            return KS_OK;
+        }
+        // echo at the old rate, the transport sends it before switching
+        kserial_send_packet_ctx(bd->ctx, param, pk->data, 4, KS_R0);
+        if (kserial_set_baudrate_ctx(bd->ctx, rate) != KS_OK)
+        {
+            return KS_OK;
+        }
+        if (!bd->pending)
+        {
+            bd->previous = bd->baudrate;
+        }
+        bd->baudrate = rate;
+        bd->pending = 1;
+        bd->deadline = now + KSERIAL_BAUD_CONFIRM;
+    }
+    else if (pk->param[1] == KSCMD_BAUD_COMMIT)
+    {
+        bd->pending = 0;
+        kserial_send_packet_ctx(bd->ctx, param, NULL, 0, KS_R0);
+        kserial_baud_watch(bd, now);
+    }
+    else if (pk->param[1] == KSCMD_BAUD_KEEP)
+    {
+        return KS_OK;
+    }
+    else
+    {
+        return KS_ERROR;
+    }
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_baud_poll
+ *  Device side, call every few ms. Revert an uncommitted rate after KSERIAL_BAUD_CONFIRM ms,
+ *  and a rate other than rate[0] after a KSERIAL_BAUD_SILENCE period without valid frames or
+ *  with KSERIAL_BAUD_ERRORS receive errors. Return KS_TIMEOUT when it reverted.
+ */
+uint32_t kserial_baud_poll(kserial_baud_t *bd, uint32_t now)
+{
+    kserial_stats_t stats;
+    uint32_t revert;
+
+    if (bd->pending)
+    {
+        if ((int32_t)(now - bd->deadline) < 0)
+        {
+            return KS_OK;
+        }
+        kserial_set_baudrate_ctx(bd->ctx, bd->previous);
+        bd->baudrate = bd->previous;
+        bd->pending = 0;
+        kserial_baud_watch(bd, now);
+        return KS_TIMEOUT;
+    }
+
+    kserial_get_stats_ctx(bd->ctx, &stats);
+    bd->heard += stats.frames - bd->mark.frames;
+    bd->faults += (stats.checksum - bd->mark.checksum) + (stats.terminator - bd->mark.terminator);
+    bd->mark = stats;
+    if ((now - bd->watch) < KSERIAL_BAUD_SILENCE)
+    {
+        return KS_OK;
+    }
+    revert = (bd->rate != NULL) && (bd->count != 0) && (bd->baudrate != bd->rate[0]) &&
+             ((bd->heard == 0) || (bd->faults >= KSERIAL_BAUD_ERRORS));
+    kserial_baud_watch(bd, now);
+    if (!revert)
+    {
+        return KS_OK;
+    }
+    kserial_set_baudrate_ctx(bd->ctx, bd->rate[0]);
+    bd->baudrate = bd->rate[0];
+    bd->reverts++;
+
+    return KS_TIMEOUT;
+}
+
+/*************************************** END OF FILE ****************************************/
@@ -0,0 +1,86 @@
+/**
+ *      __            ____
+ *     / /__ _  __   / __/                      __  
+ *    / //_/(_)/ /_ / /  ___   ____ ___  __ __ / /_ 
+ *   / ,<  / // __/_\ \ / _ \ / __// _ \/ // // __/ 
+ *  /_/|_|/_/ \__//___// .__//_/   \___/\_,_/ \__/  
+ *                    /_/   github.com/KitSprout    
+ * 
+ *  @file    kserial_baud.h
+ *  @author  KitSprout
+ *  @brief   baud rate negotiation and link probing
+ * 
+ */
+
+/* Define to prevent recursive inclusion ---------------------------------------------------*/
+#ifndef __KSERIAL_BAUD_H
+#define __KSERIAL_BAUD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes --------------------------------------------------------------------------------*/
+#include "kserial.h"
+
+/* Define ----------------------------------------------------------------------------------*/
+
+/* param2 of KSCMD_R0_DEVICE_BAUDRATE */
+#define KSCMD_BAUD_COMMIT                               (0U)    /* keep the new rate */
+#define KSCMD_BAUD_KEEP                                 (1U)    /* host still listening, not echoed */
+#define KSCMD_BAUD_SET                                  (2U)    /* payload : u32 baudrate, 4 is kscmd_set_baudrate_ctx */
+
+/* Macro -----------------------------------------------------------------------------------*/
+/* Typedef ---------------------------------------------------------------------------------*/
+
+typedef struct
+{
+    kserial_ctx_t *ctx;
+    const uint32_t *rate;       // candidates in ascending order, rate[0] is where both sides start
+    uint32_t count;
+    uint32_t index;             // rate in use
+    uint32_t burst;             // echo frames per probe
+    uint32_t nbyte;             // payload bytes of a probe frame
+
+    // last probe
+    uint32_t echoed;
+    uint32_t errors;            // checksum, terminator and payload errors, missing echoes
+    uint32_t throughput;        // echoed bytes per second
+    uint32_t elapsed;           // ms
+
+    // monitor
+    kserial_stats_t mark;       // receive counters at the last check or poll
+    uint32_t fallbacks;
+
+    // device, a new rate is reverted unless committed in time
+    uint32_t baudrate;
+    uint32_t previous;
+    uint32_t pending;
+    uint32_t deadline;
+
+    // device, back to rate[0] after a silent or damaged watch period
+    uint32_t watch;             // start of the watch period
+    uint32_t heard;             // valid frames in the period
+    uint32_t faults;            // checksum and terminator errors in the period
+    uint32_t reverts;
+
+} kserial_baud_t;
+
+/* Extern ----------------------------------------------------------------------------------*/
+/* Functions -------------------------------------------------------------------------------*/
+
+void        kserial_baud_init(kserial_baud_t *bd, kserial_ctx_t *ctx, const uint32_t *rate, uint32_t count);
+uint32_t    kserial_baud_probe(kserial_baud_t *bd);
+uint32_t    kserial_baud_step(kserial_baud_t *bd, uint32_t index);
+uint32_t    kserial_baud_negotiate(kserial_baud_t *bd);
+uint32_t    kserial_baud_check(kserial_baud_t *bd);
+uint32_t    kserial_baud_dispatch(kserial_baud_t *bd, const kserial_packet_t *pk, uint32_t now);
+uint32_t    kserial_baud_poll(kserial_baud_t *bd, uint32_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/*************************************** END OF FILE ****************************************/
@@ -0,0 +1,492 @@
+/**
+ *      __            ____
+ *     / /__ _  __   / __/                      __  
+ *    / //_/(_)/ /_ / /  ___   ____ ___  __ __ / /_ 
+ *   / ,<  / // __/_\ \ / _ \ / __// _ \/ // // __/ 
+ *  /_/|_|/_/ \__//___// .__//_/   \___/\_,_/ \__/  
+ *                    /_/   github.com/KitSprout    
+ * 
+ *  @file    kserial_bulk.c
+ *  @author  KitSprout
+ *  @brief   windowed bulk transfer over R3
+ *           A buffer larger than one frame is announced with START and streamed as DATA
+ *           chunks, chunk n covers bytes [n * chunk, (n + 1) * chunk) and carries n & 0xFF
+ *           in P2. The receiver acknowledges the number of chunks received in order every
+ *           quarter window, so up to window chunks stay in flight. A gap is answered with a
+ *           repeated ACK and the sender goes back to the first missing chunk, as it does when
+ *           no ACK arrives within timeout. kserial only checks the header, so every R3 frame
+ *           carries a CRC-32 and corrupted frames are dropped like lost ones. The whole buffer
+ *           is checked once more at the end.
+ *           Time is a caller supplied millisecond tick.
+ */
+
+/* Includes --------------------------------------------------------------------------------*/
+#include <string.h>
+#include "kserial_bulk.h"
+
+/* Define ----------------------------------------------------------------------------------*/
+
+/* receiver state */
+#define KSERIAL_BULK_IDLE                               (0U)
+#define KSERIAL_BULK_READY                              (1U)
+#define KSERIAL_BULK_ACTIVE                             (2U)
+
+/* Macro -----------------------------------------------------------------------------------*/
+/* Typedef ---------------------------------------------------------------------------------*/
+/* Variables -------------------------------------------------------------------------------*/
+
+// CRC-32 (0xEDB88320), one nibble per step
+static const uint32_t KSERIAL_CRC32_TABLE[16] =
+{
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+/* Prototypes ------------------------------------------------------------------------------*/
+/* Functions -------------------------------------------------------------------------------*/
+
+/**
+ *  @brief  kserial_bulk_crc32
+ *  Continue crc over data, start from 0xFFFFFFFF and invert the result.
+ */
+static uint32_t kserial_bulk_crc32(uint32_t crc, const uint8_t *data, uint32_t lens)
+{
+    for (uint32_t i = 0; i < lens; i++)
+    {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ KSERIAL_CRC32_TABLE[crc & 0x0F];
+        crc = (crc >> 4) ^ KSERIAL_CRC32_TABLE[crc & 0x0F];
+    }
+    return crc;
+}
+
+/**
+ *  @brief  kserial_bulk_put32
+ */
+static void kserial_bulk_put32(uint8_t *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+/**
+ *  @brief  kserial_bulk_get32
+ */
+static uint32_t kserial_bulk_get32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ *  @brief  kserial_bulk_frame
+ */
+static void kserial_bulk_frame(kserial_bulk_t *bk, uint32_t command, uint32_t sequence, const uint8_t *pdata, uint32_t lens)
+{
+    uint8_t param[2] = {command, sequence};
+    uint8_t check[4];
+    kserial_iovec_t iov[2];
+    uint32_t crc;
+
+    crc = kserial_bulk_crc32(0xFFFFFFFF, param, 2);
+    crc = kserial_bulk_crc32(crc, pdata, lens);
+    kserial_bulk_put32(check, ~crc);
+    iov[0].data = pdata;
+    iov[0].lens = lens;
+    iov[1].data = check;
+    iov[1].lens = 4;
+    if (lens != 0)
+    {
+        kserial_send_packetv_ctx(bk->ctx, param, KS_R3, iov, 2);
+    }
+    else
+    {
+        kserial_send_packetv_ctx(bk->ctx, param, KS_R3, &iov[1], 1);
+    }
+}
+
+/**
+ *  @brief  kserial_bulk_check
+ *  Return the payload bytes in front of the CRC, or -1 when the frame is corrupted.
+ */
+static int32_t kserial_bulk_check(const kserial_packet_t *pk)
+{
+    const uint8_t *data = (const uint8_t *)pk->data;
+    uint32_t lens;
+    uint32_t crc;
+
+    if (pk->nbyte < 4)
+    {
+        return -1;
+    }
+    lens = pk->nbyte - 4;
+    crc = kserial_bulk_crc32(0xFFFFFFFF, pk->param, 2);
+    crc = kserial_bulk_crc32(crc, data, lens);
+    if (~crc != kserial_bulk_get32(&data[lens]))
+    {
+        return -1;
+    }
+    return (int32_t)lens;
+}
+
+/**
+ *  @brief  kserial_bulk_ack
+ */
+static void kserial_bulk_ack(kserial_bulk_t *bk, uint32_t chunks)
+{
+    uint8_t data[4];
+
+    kserial_bulk_put32(data, chunks);
+    kserial_bulk_frame(bk, KSERIAL_BULK_ACK, 0, data, 4);
+}
+
+/**
+ *  @brief  kserial_bulk_start
+ */
+static void kserial_bulk_start(kserial_bulk_t *bk)
+{
+    uint8_t data[12];
+
+    kserial_bulk_put32(&data[0], bk->tsize);
+    kserial_bulk_put32(&data[4], bk->tcrc);
+    data[8] = bk->chunk;
+    data[9] = bk->chunk >> 8;
+    data[10] = bk->window;
+    data[11] = bk->window >> 8;
+    kserial_bulk_frame(bk, KSERIAL_BULK_START, 0, data, 12);
+}
+
+/**
+ *  @brief  kserial_bulk_finish
+ */
+static void kserial_bulk_finish(kserial_bulk_t *bk)
+{
+    uint32_t status = KS_OK;
+
+    bk->rstate = KSERIAL_BULK_IDLE;
+    if (~kserial_bulk_crc32(0xFFFFFFFF, bk->rdata, bk->rsize) != bk->rcrc)
+    {
+        status = KS_ERROR;
+        bk->expected = 0;
+        kserial_bulk_frame(bk, KSERIAL_BULK_ABORT, 0, NULL, 0);
+    }
+    else
+    {
+        kserial_bulk_ack(bk, bk->expected);
+    }
+    if (bk->rcallback != NULL)
+    {
+        bk->rcallback(bk->ruser, status, bk->rdata, bk->rsize);
+    }
+}
+
+/**
+ *  @brief  kserial_bulk_recv_start
+ */
+static void kserial_bulk_recv_start(kserial_bulk_t *bk, const kserial_packet_t *pk, uint32_t nbyte)
+{
+    const uint8_t *data = (const uint8_t *)pk->data;
+    uint32_t size;
+    uint32_t chunk;
+    uint32_t window;
+
+    if (nbyte < 12)
+    {
+        return;
+    }
+    size = kserial_bulk_get32(&data[0]);
+    chunk = data[8] | ((uint32_t)data[9] << 8);
+    window = data[10] | ((uint32_t)data[11] << 8);
+    if ((bk->rstate == KSERIAL_BULK_IDLE) || (size > bk->rcapacity) ||
+        (chunk == 0) || (chunk > KSERIAL_BULK_MAX_CHUNK) || (window == 0) || (window > 128))
+    {
+        kserial_bulk_frame(bk, KSERIAL_BULK_ABORT, 0, NULL, 0);
+        return;
+    }
+    // a repeated START restarts the transfer
+    bk->rstate = KSERIAL_BULK_ACTIVE;
+    bk->rsize = size;
+    bk->rcrc = kserial_bulk_get32(&data[4]);
+    bk->rchunk = chunk;
+    bk->rchunks = (size + chunk - 1) / chunk;
+    bk->rwindow = window;
+    bk->expected = 0;
+    bk->nak = 0;
+    kserial_bulk_ack(bk, 0);
+    if (bk->rchunks == 0)
+    {
+        kserial_bulk_finish(bk);
+    }
+}
+
+/**
+ *  @brief  kserial_bulk_recv_data
+ */
+static void kserial_bulk_recv_data(kserial_bulk_t *bk, const kserial_packet_t *pk, uint32_t nbyte)
+{
+    uint32_t offset;
+    uint32_t lens;
+    uint32_t step;
+
+    if (bk->rstate != KSERIAL_BULK_ACTIVE)
+    {   // the final ACK was lost, the sender is retransmitting
+        if (bk->expected != 0)
+        {
+            kserial_bulk_ack(bk, bk->expected);
+        }
+        return;
+    }
+    offset = bk->expected * bk->rchunk;
+    lens = bk->rsize - offset;
+    if (lens > bk->rchunk)
+    {
+        lens = bk->rchunk;
+    }
+    if ((pk->param[1] != (bk->expected & 0xFF)) || (nbyte != lens))
+    {   // report a gap once, everything up to the missing chunk is dropped
+        if (!bk->nak)
+        {
+            bk->nak = 1;
+            kserial_bulk_ack(bk, bk->expected);
+        }
+        return;
+    }
+    memcpy(&bk->rdata[offset], pk->data, lens);
+    bk->expected++;
+    bk->nak = 0;
+    if (bk->expected == bk->rchunks)
+    {
+        kserial_bulk_finish(bk);
+        return;
+    }
+    step = (bk->rwindow < 4) ? 1 : (bk->rwindow / 4);
+    if ((bk->expected % step) == 0)
+    {
+        kserial_bulk_ack(bk, bk->expected);
+    }
+}
+
+/**
+ *  @brief  kserial_bulk_send_ack
+ */
+static void kserial_bulk_send_ack(kserial_bulk_t *bk, uint32_t chunks, uint32_t now)
+{
+    if (bk->status != KS_BUSY)
+    {
+        return;
+    }
+    if (!bk->started)
+    {
+        if (chunks != 0)
+        {
+            return;
+        }
+        bk->started = 1;
+    }
+    else if ((chunks > bk->acked) && (chunks <= bk->tchunks))
+    {
+        bk->acked = chunks;
+        if (bk->next < bk->acked)
+        {
+            bk->next = bk->acked;
+        }
+    }
+    else
+    {
+        if ((chunks == bk->acked) && (bk->next > bk->acked))
+        {   // gap at the receiver
+            bk->next = bk->acked;
+        }
+        return;
+    }
+    bk->retries = 0;
+    bk->deadline = now + bk->timeout;
+    if (bk->acked == bk->tchunks)
+    {
+        bk->status = KS_OK;
+    }
+}
+
+/**
+ *  @brief  kserial_bulk_init
+ */
+void kserial_bulk_init(kserial_bulk_t *bk, kserial_ctx_t *ctx)
+{
+    memset(bk, 0, sizeof(kserial_bulk_t));
+    bk->ctx = ctx;
+    bk->chunk = KSERIAL_BULK_MAX_CHUNK;
+    bk->window = KSERIAL_BULK_WINDOW;
+    bk->timeout = KSERIAL_BULK_TIMEOUT;
+    bk->retry = KSERIAL_BULK_RETRY;
+    bk->status = KS_OK;
+    bk->rstate = KSERIAL_BULK_IDLE;
+}
+
+/**
+ *  @brief  kserial_bulk_send
+ *  Start sending data, it must stay alive until kserial_bulk_pump stops returning KS_BUSY.
+ *  Return KS_BUSY while the previous transfer is running.
+ */
+uint32_t kserial_bulk_send(kserial_bulk_t *bk, const void *data, uint32_t size, uint32_t now)
+{
+    if (bk->status == KS_BUSY)
+    {
+        return KS_BUSY;
+    }
+    if ((bk->chunk == 0) || (bk->chunk > KSERIAL_BULK_MAX_CHUNK) || (bk->window == 0) || (bk->window > 128))
+    {
+        return KS_ERROR;
+    }
+    bk->tdata = (const uint8_t *)data;
+    bk->tsize = size;
+    bk->tcrc = ~kserial_bulk_crc32(0xFFFFFFFF, bk->tdata, size);
+    bk->tchunks = (size + bk->chunk - 1) / bk->chunk;
+    bk->acked = 0;
+    bk->next = 0;
+    bk->started = 0;
+    bk->retries = 0;
+    bk->deadline = now + bk->timeout;
+    bk->status = KS_BUSY;
+    kserial_bulk_start(bk);
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_bulk_recv
+ *  Accept one transfer of up to size bytes into buffer, callback reports KS_OK, or KS_ERROR
+ *  on a CRC mismatch. Arm again for the next transfer, a NULL buffer stops accepting.
+ */
+uint32_t kserial_bulk_recv(kserial_bulk_t *bk, void *buffer, uint32_t size, pkserial_bulk_callback_t callback, void *user)
+{
+    if (bk->rstate == KSERIAL_BULK_ACTIVE)
+    {
+        return KS_BUSY;
+    }
+    bk->rdata = (uint8_t *)buffer;
+    bk->rcapacity = size;
+    bk->rcallback = callback;
+    bk->ruser = user;
+    bk->rstate = (buffer != NULL) ? KSERIAL_BULK_READY : KSERIAL_BULK_IDLE;
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_bulk_dispatch
+ *  Handle an R3 packet of either direction, return KS_ERROR for any other packet.
+ *  Corrupted frames are consumed and ignored.
+ */
+uint32_t kserial_bulk_dispatch(kserial_bulk_t *bk, const kserial_packet_t *pk, uint32_t now)
+{
+    int32_t nbyte;
+
+    if ((pk->type != KS_R3) || (pk->param[0] > KSERIAL_BULK_ABORT))
+    {
+        return KS_ERROR;
+    }
+    nbyte = kserial_bulk_check(pk);
+    if (nbyte < 0)
+    {
+        return KS_OK;
+    }
+    switch (pk->param[0])
+    {
+        case KSERIAL_BULK_START:
+        {
+            kserial_bulk_recv_start(bk, pk, (uint32_t)nbyte);
+            break;
+        }
+        case KSERIAL_BULK_DATA:
+        {
+            kserial_bulk_recv_data(bk, pk, (uint32_t)nbyte);
+            break;
+        }
+        case KSERIAL_BULK_ACK:
+        {
+            if (nbyte >= 4)
+            {
+                kserial_bulk_send_ack(bk, kserial_bulk_get32((const uint8_t *)pk->data), now);
+            }
+            break;
+        }
+        case KSERIAL_BULK_ABORT:
+        {
+            if (bk->status == KS_BUSY)
+            {
+                bk->status = KS_ERROR;
+            }
+            break;
+        }
+        default:
+        {
+            return KS_ERROR;
+        }
+    }
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_bulk_pump
+ *  Fill the window and handle the acknowledgement timeout, for callers dispatching packets
+ *  themselves. Return the sender status.
+ */
+uint32_t kserial_bulk_pump(kserial_bulk_t *bk, uint32_t now)
+{
+    uint32_t offset;
+    uint32_t lens;
+
+    if (bk->status != KS_BUSY)
+    {
+        return bk->status;
+    }
+    if ((int32_t)(now - bk->deadline) >= 0)
+    {
+        if (++bk->retries > bk->retry)
+        {
+            bk->status = KS_TIMEOUT;
+            return KS_TIMEOUT;
+        }
+        if (!bk->started)
+        {
+            kserial_bulk_start(bk);
+        }
+        bk->next = bk->acked;
+        bk->deadline = now + bk->timeout;
+    }
+    while (bk->started && (bk->next < bk->tchunks) && ((bk->next - bk->acked) < bk->window))
+    {
+        offset = bk->next * bk->chunk;
+        lens = ((bk->tsize - offset) > bk->chunk) ? bk->chunk : (bk->tsize - offset);
+        kserial_bulk_frame(bk, KSERIAL_BULK_DATA, bk->next & 0xFF, &bk->tdata[offset], lens);
+        bk->next++;
+    }
+
+    return bk->status;
+}
+
+/**
+ *  @brief  kserial_bulk_poll
+ *  Read the context, handle R3 packets and hand other packets to bk->unmatched, then pump.
+ *  Return the sender status.
+ */
+uint32_t kserial_bulk_poll(kserial_bulk_t *bk, uint32_t now)
+{
+    kserial_t *ks = &bk->ctx->ks;
+    uint32_t count;
+
+    count = kserial_read_ctx(bk->ctx);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if ((kserial_bulk_dispatch(bk, &ks->packet[i], now) != KS_OK) && (bk->unmatched != NULL))
+        {
+            bk->unmatched(bk->user, &ks->packet[i]);
+        }
+        kserial_release_packet(ks, &ks->packet[i]);
+    }
+
+    return kserial_bulk_pump(bk, now);
+}
+
+/*************************************** END OF FILE ****************************************/
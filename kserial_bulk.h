@@ -0,0 +1,100 @@
+/**
+ *      __            ____
+ *     / /__ _  __   / __/                      __  
+ *    / //_/(_)/ /_ / /  ___   ____ ___  __ __ / /_ 
+ *   / ,<  / // __/_\ \ / _ \ / __// _ \/ // // __/ 
+ *  /_/|_|/_/ \__//___// .__//_/   \___/\_,_/ \__/  
+ *                    /_/   github.com/KitSprout    
+ * 
+ *  @file    kserial_bulk.h
+ *  @author  KitSprout
+ *  @brief   windowed bulk transfer over R3
+ * 
+ */
+
+/* Define to prevent recursive inclusion ---------------------------------------------------*/
+#ifndef __KSERIAL_BULK_H
+#define __KSERIAL_BULK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes --------------------------------------------------------------------------------*/
+#include "kserial.h"
+
+/* Define ----------------------------------------------------------------------------------*/
+
+#define KSERIAL_BULK_MAX_CHUNK                          (KSERIAL_MAX_DATA_BYTES - 4)
+
+/* Macro -----------------------------------------------------------------------------------*/
+/* Typedef ---------------------------------------------------------------------------------*/
+
+// payload of every R3 frame ends with the CRC-32 of P1, P2 and the bytes before it
+typedef enum
+{
+    KSERIAL_BULK_START          = 0x00,     // u32 size, u32 crc32, u16 chunk, u16 window
+    KSERIAL_BULK_DATA           = 0x01,     // P2 chunk sequence, chunk bytes
+    KSERIAL_BULK_ACK            = 0x02,     // u32 chunks received in order
+    KSERIAL_BULK_ABORT          = 0x03
+
+} kserial_r3_command_t;
+
+typedef void (*pkserial_bulk_callback_t)(void *user, uint32_t status, void *buffer, uint32_t size);
+
+typedef struct
+{
+    kserial_ctx_t *ctx;
+    uint32_t chunk;             // bytes per frame, 1 ~ KSERIAL_BULK_MAX_CHUNK
+    uint32_t window;            // chunks in flight, 1 ~ 128
+    uint32_t timeout;           // ms
+    uint32_t retry;
+
+    // sender, status is KS_BUSY while sending, then KS_OK, KS_TIMEOUT or KS_ERROR
+    const uint8_t *tdata;
+    uint32_t tsize;
+    uint32_t tcrc;
+    uint32_t tchunks;
+    uint32_t acked;
+    uint32_t next;
+    uint32_t started;
+    uint32_t retries;
+    uint32_t deadline;
+    uint32_t status;
+
+    // receiver
+    uint8_t *rdata;
+    uint32_t rcapacity;
+    uint32_t rstate;
+    uint32_t rsize;
+    uint32_t rcrc;
+    uint32_t rchunk;
+    uint32_t rchunks;
+    uint32_t rwindow;
+    uint32_t expected;          // chunks received in order, kept after completion
+    uint32_t nak;
+    pkserial_bulk_callback_t rcallback;
+    void *ruser;
+
+    pkserial_handler_t unmatched;
+    void *user;
+
+} kserial_bulk_t;
+
+/* Extern ----------------------------------------------------------------------------------*/
+/* Functions -------------------------------------------------------------------------------*/
+
+void        kserial_bulk_init(kserial_bulk_t *bk, kserial_ctx_t *ctx);
+uint32_t    kserial_bulk_send(kserial_bulk_t *bk, const void *data, uint32_t size, uint32_t now);
+uint32_t    kserial_bulk_recv(kserial_bulk_t *bk, void *buffer, uint32_t size, pkserial_bulk_callback_t callback, void *user);
+uint32_t    kserial_bulk_dispatch(kserial_bulk_t *bk, const kserial_packet_t *pk, uint32_t now);
+uint32_t    kserial_bulk_pump(kserial_bulk_t *bk, uint32_t now);
+uint32_t    kserial_bulk_poll(kserial_bulk_t *bk, uint32_t now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/*************************************** END OF FILE ****************************************/
@@ -0,0 +1,820 @@
+/**
+ *      __            ____
+ *     / /__ _  __   / __/                      __  
+ *    / //_/(_)/ /_ / /  ___   ____ ___  __ __ / /_ 
+ *   / ,<  / // __/_\ \ / _ \ / __// _ \/ // // __/ 
+ *  /_/|_|/_/ \__//___// .__//_/   \___/\_,_/ \__/  
+ *                    /_/   github.com/KitSprout    
+ * 
+ *  @file    kserial_capture.c
+ *  @author  KitSprout
+ *  @brief   memory mappable packet capture
+ *           <path> holds the bytes read from an attached context exactly as they arrived,
+ *           noise, resync bytes and damaged frames included, so a replay sees the same
+ *           stream. <path>.idx holds a header and one fixed size record per parsed frame in
+ *           receive order, followed on close by the record numbers sorted by channel, all
+ *           little endian. Both files are mapped read-only by kserial_capture_map, a time or
+ *           channel lookup is a binary search and payloads are read in place.
+ *           kserial_transport_replay feeds a mapped capture to a context as if it came from
+ *           a port, with the recorded timing or as fast as the reader takes it.
+ */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+/* Includes --------------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "kserial_capture.h"
+#include "kserial_demux.h"
+
+#if KSERIAL_POSIX_ENABLE
+
+/* Define ----------------------------------------------------------------------------------*/
+
+#define KSERIAL_CAPTURE_INDEX_SUFFIX    ".idx"
+#define KSERIAL_CAPTURE_HEADER_SIZE     (24)
+#define KSERIAL_CAPTURE_RECORD_SIZE     (24)
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define KSERIAL_CAPTURE_BIG_ENDIAN
+#endif
+
+/* Macro -----------------------------------------------------------------------------------*/
+/* Typedef ---------------------------------------------------------------------------------*/
+/* Variables -------------------------------------------------------------------------------*/
+
+static const uint8_t KSERIAL_CAPTURE_MAGIC[4] = {'K', 'S', 'I', 'X'};
+
+/* Prototypes ------------------------------------------------------------------------------*/
+
+static uint32_t kserial_replay_send(void *handle, const void *data, uint32_t lens);
+static uint32_t kserial_replay_recv(void *handle, void *data, uint32_t lens);
+static void     kserial_replay_flush(void *handle);
+static uint32_t kserial_replay_wait(void *handle, uint32_t timeout);
+static uint64_t kserial_replay_now(void *handle);
+
+const kserial_transport_t kserial_transport_replay =
+{
+    .send = kserial_replay_send,
+    .sendv = NULL,
+    .recv = kserial_replay_recv,
+    .flush = kserial_replay_flush,
+    .wait = kserial_replay_wait,
+    .now = kserial_replay_now,
+    .fd = NULL,
+    .setbaud = NULL
+};
+
+/* Functions -------------------------------------------------------------------------------*/
+
+/**
+ *  @brief  kserial_capture_index_path
+ */
+static char *kserial_capture_index_path(const char *path)
+{
+    size_t lens = strlen(path);
+    char *name = (char *)malloc(lens + sizeof(KSERIAL_CAPTURE_INDEX_SUFFIX));
+
+    if (name != NULL)
+    {
+        memcpy(name, path, lens);
+        memcpy(&name[lens], KSERIAL_CAPTURE_INDEX_SUFFIX, sizeof(KSERIAL_CAPTURE_INDEX_SUFFIX));
+    }
+    return name;
+}
+
+/**
+ *  @brief  kserial_capture_put
+ */
+static void kserial_capture_put(uint8_t *data, uint64_t value, uint32_t lens)
+{
+    for (uint32_t i = 0; i < lens; i++)
+    {
+        data[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+/**
+ *  @brief  kserial_capture_get
+ */
+static uint64_t kserial_capture_get(const uint8_t *data, uint32_t lens)
+{
+    uint64_t value = 0;
+
+    for (uint32_t i = 0; i < lens; i++)
+    {
+        value |= (uint64_t)data[i] << (8 * i);
+    }
+    return value;
+}
+
+/**
+ *  @brief  kserial_capture_write_header
+ */
+static uint32_t kserial_capture_write_header(FILE *fp, uint64_t count, uint64_t channel)
+{
+    uint8_t header[KSERIAL_CAPTURE_HEADER_SIZE];
+
+    memcpy(&header[offsetof(kserial_capture_header_t, magic)], KSERIAL_CAPTURE_MAGIC, 4);
+    kserial_capture_put(&header[offsetof(kserial_capture_header_t, version)], KSERIAL_CAPTURE_VERSION, 2);
+    kserial_capture_put(&header[offsetof(kserial_capture_header_t, recsize)], KSERIAL_CAPTURE_RECORD_SIZE, 2);
+    kserial_capture_put(&header[offsetof(kserial_capture_header_t, count)], count, 8);
+    kserial_capture_put(&header[offsetof(kserial_capture_header_t, channel)], channel, 8);
+
+    return (fwrite(header, sizeof(header), 1, fp) == 1) ? KS_OK : KS_ERROR;
+}
+
+/**
+ *  @brief  kserial_capture_open
+ *  Create <path> and <path>.idx, existing files are truncated.
+ */
+uint32_t kserial_capture_open(kserial_capture_t *cap, const char *path)
+{
+    char *name = kserial_capture_index_path(path);
+
+    memset(cap, 0, sizeof(kserial_capture_t));
+    if (name == NULL)
+    {
+        return KS_ERROR;
+    }
+    cap->data = fopen(path, "wb");
+    cap->index = fopen(name, "wb");
+    free(name);
+    if ((cap->data == NULL) || (cap->index == NULL) || (kserial_capture_write_header(cap->index, 0, 0) != KS_OK))
+    {
+        if (cap->data != NULL)
+        {
+            fclose(cap->data);
+        }
+        if (cap->index != NULL)
+        {
+            fclose(cap->index);
+        }
+        memset(cap, 0, sizeof(kserial_capture_t));
+        return KS_ERROR;
+    }
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_capture_record
+ *  Index the frame at offset of the data file, nbyte is its payload on the wire.
+ *  A wire payload longer than pk->nbyte carries the sequence stamp the parser stripped.
+ */
+static uint32_t kserial_capture_record(kserial_capture_t *cap, uint64_t offset, uint64_t time, const kserial_packet_t *pk, uint32_t nbyte)
+{
+    uint8_t record[KSERIAL_CAPTURE_RECORD_SIZE] = {0};
+    uint32_t *key;
+
+    if (cap->count >= UINT32_MAX)
+    {
+        return KS_ERROR;
+    }
+    if (cap->count == cap->size)
+    {
+        key = (uint32_t *)realloc(cap->key, ((cap->size == 0) ? 1024 : (cap->size * 2)) * sizeof(uint32_t));
+        if (key == NULL)
+        {
+            return KS_ERROR;
+        }
+        cap->key = key;
+        cap->size = (cap->size == 0) ? 1024 : (cap->size * 2);
+    }
+    if (time < cap->last)
+    {
+        time = cap->last;
+    }
+
+    kserial_capture_put(&record[offsetof(kserial_capture_index_t, offset)], offset, 8);
+    kserial_capture_put(&record[offsetof(kserial_capture_index_t, time)], time, 8);
+    kserial_capture_put(&record[offsetof(kserial_capture_index_t, nbyte)], nbyte, 2);
+    record[offsetof(kserial_capture_index_t, type)] = pk->type;
+    record[offsetof(kserial_capture_index_t, param)] = pk->param[0];
+    record[offsetof(kserial_capture_index_t, param) + 1] = pk->param[1];
+    record[offsetof(kserial_capture_index_t, flags)] = (nbyte > pk->nbyte) ? KSERIAL_CAPTURE_STAMPED : 0;
+    if (fwrite(record, sizeof(record), 1, cap->index) != 1)
+    {
+        return KS_ERROR;
+    }
+    cap->key[cap->count++] = KSERIAL_DEMUX_KEY(pk->type, pk->param[0], pk->param[1]);
+    cap->last = time;
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_capture_write
+ *  Append a frame packed from pk received at time ns, for captures built from packets.
+ */
+uint32_t kserial_capture_write(kserial_capture_t *cap, const kserial_packet_t *pk, uint64_t time)
+{
+    uint8_t frame[KSERIAL_MAX_DATA_BYTES + 8];
+    uint32_t typesize = KS_TYPE_SIZE[pk->type & 0x0F];
+    uint32_t nbyte;
+
+    if (pk->nbyte > KSERIAL_MAX_DATA_BYTES)
+    {
+        return KS_ERROR;
+    }
+    nbyte = kserial_pack(frame, pk->param, pk->type, (typesize > 1) ? (pk->nbyte / typesize) : pk->nbyte, pk->data);
+    if ((fwrite(frame, 1, nbyte, cap->data) != nbyte) || (kserial_capture_record(cap, cap->offset, time, pk, nbyte - 8) != KS_OK))
+    {
+        return KS_ERROR;
+    }
+    cap->offset += nbyte;
+
+    return KS_OK;
+}
+
+#if KSERIAL_TAP_ENABLE
+/**
+ *  @brief  kserial_capture_input
+ */
+static void kserial_capture_input(void *user, const uint8_t *data, uint32_t nbyte, uint64_t time)
+{
+    kserial_capture_t *cap = (kserial_capture_t *)user;
+
+    if (fwrite(data, 1, nbyte, cap->data) != nbyte)
+    {
+        cap->status = KS_ERROR;
+    }
+    cap->offset += nbyte;
+    cap->time = time;
+}
+
+/**
+ *  @brief  kserial_capture_frame
+ */
+static void kserial_capture_frame(void *user, const kserial_packet_t *pk, uint32_t back, uint32_t nbyte)
+{
+    kserial_capture_t *cap = (kserial_capture_t *)user;
+    uint64_t time = cap->time;
+
+    if (back > (cap->offset - cap->base))
+    {   // started before the capture was attached
+        return;
+    }
+#if KSERIAL_TIMESTAMP_ENABLE
+    if (pk->tlast != 0)
+    {
+        time = pk->tlast;
+    }
+#endif
+    if (kserial_capture_record(cap, cap->offset - back, time, pk, nbyte - 8) != KS_OK)
+    {
+        cap->status = KS_ERROR;
+    }
+}
+
+/**
+ *  @brief  kserial_capture_attach
+ *  Record every byte read from ctx and index its frames until detached or closed.
+ */
+uint32_t kserial_capture_attach(kserial_capture_t *cap, kserial_ctx_t *ctx)
+{
+    if ((cap->data == NULL) || (cap->ctx != NULL) || (ctx->ks.tap != NULL))
+    {
+        return KS_ERROR;
+    }
+    cap->tap.input = kserial_capture_input;
+    cap->tap.frame = kserial_capture_frame;
+    cap->tap.user = cap;
+    cap->ctx = ctx;
+    cap->base = cap->offset;
+    kserial_set_tap_ctx(ctx, &cap->tap);
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_capture_detach
+ */
+void kserial_capture_detach(kserial_capture_t *cap)
+{
+    if (cap->ctx != NULL)
+    {
+        kserial_set_tap_ctx(cap->ctx, NULL);
+        cap->ctx = NULL;
+    }
+}
+#endif
+
+/**
+ *  @brief  kserial_capture_compare
+ */
+static int kserial_capture_compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ *  @brief  kserial_capture_close
+ *  Append the per channel order and complete the header.
+ */
+uint32_t kserial_capture_close(kserial_capture_t *cap)
+{
+    uint32_t status = KS_OK;
+    uint64_t channel = 0;
+    uint64_t *order;
+    uint8_t record[4];
+
+    if ((cap->data == NULL) || (cap->index == NULL))
+    {
+        return KS_ERROR;
+    }
+#if KSERIAL_TAP_ENABLE
+    kserial_capture_detach(cap);
+#endif
+    status = cap->status;
+
+    // (key, record number) pairs sort by channel, then by time
+    order = (uint64_t *)malloc((cap->count + 1) * sizeof(uint64_t));
+    if (order != NULL)
+    {
+        for (uint64_t i = 0; i < cap->count; i++)
+        {
+            order[i] = ((uint64_t)cap->key[i] << 32) | i;
+        }
+        qsort(order, cap->count, sizeof(uint64_t), kserial_capture_compare);
+        channel = KSERIAL_CAPTURE_HEADER_SIZE + cap->count * KSERIAL_CAPTURE_RECORD_SIZE;
+        for (uint64_t i = 0; (i < cap->count) && (channel != 0); i++)
+        {
+            kserial_capture_put(record, (uint32_t)order[i], 4);
+            if (fwrite(record, sizeof(record), 1, cap->index) != 1)
+            {
+                channel = 0;
+            }
+        }
+        free(order);
+    }
+
+    if ((fseek(cap->index, 0, SEEK_SET) != 0) || (kserial_capture_write_header(cap->index, cap->count, channel) != KS_OK))
+    {
+        status = KS_ERROR;
+    }
+    if ((fclose(cap->index) != 0) || (fclose(cap->data) != 0))
+    {
+        status = KS_ERROR;
+    }
+    free(cap->key);
+    memset(cap, 0, sizeof(kserial_capture_t));
+
+    return status;
+}
+
+/**
+ *  @brief  kserial_capture_mmap
+ */
+static void *kserial_capture_mmap(const char *path, size_t *size)
+{
+    struct stat st;
+    void *map = NULL;
+    int fd = open(path, O_RDONLY);
+
+    *size = 0;
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    if ((fstat(fd, &st) == 0) && (st.st_size > 0))
+    {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            map = NULL;
+        }
+        else
+        {
+            *size = (size_t)st.st_size;
+        }
+    }
+    close(fd);
+
+    return map;
+}
+
+#ifdef KSERIAL_CAPTURE_BIG_ENDIAN
+/**
+ *  @brief  kserial_capture_swap
+ *  Decode the little endian index and channel order into host order copies.
+ */
+static uint32_t kserial_capture_swap(kserial_capture_view_t *view)
+{
+    const uint8_t *src = (const uint8_t *)view->index;
+    kserial_capture_index_t *index;
+    uint32_t *channel;
+
+    index = (kserial_capture_index_t *)malloc((view->count + 1) * sizeof(kserial_capture_index_t));
+    if (index == NULL)
+    {
+        return KS_ERROR;
+    }
+    for (uint64_t i = 0; i < view->count; i++, src += KSERIAL_CAPTURE_RECORD_SIZE)
+    {
+        memset(&index[i], 0, sizeof(kserial_capture_index_t));
+        index[i].offset = kserial_capture_get(&src[offsetof(kserial_capture_index_t, offset)], 8);
+        index[i].time = kserial_capture_get(&src[offsetof(kserial_capture_index_t, time)], 8);
+        index[i].nbyte = (uint16_t)kserial_capture_get(&src[offsetof(kserial_capture_index_t, nbyte)], 2);
+        index[i].type = src[offsetof(kserial_capture_index_t, type)];
+        index[i].param[0] = src[offsetof(kserial_capture_index_t, param)];
+        index[i].param[1] = src[offsetof(kserial_capture_index_t, param) + 1];
+        index[i].flags = src[offsetof(kserial_capture_index_t, flags)];
+    }
+    view->copy[0] = index;
+    view->index = index;
+    if (view->channel != NULL)
+    {
+        src = (const uint8_t *)view->channel;
+        channel = (uint32_t *)malloc((view->count + 1) * sizeof(uint32_t));
+        if (channel == NULL)
+        {
+            return KS_ERROR;
+        }
+        for (uint64_t i = 0; i < view->count; i++)
+        {
+            channel[i] = (uint32_t)kserial_capture_get(&src[4 * i], 4);
+        }
+        view->copy[1] = channel;
+        view->channel = channel;
+    }
+
+    return KS_OK;
+}
+#endif
+
+/**
+ *  @brief  kserial_capture_map
+ *  Map a capture, an unclosed one is usable without the per channel order.
+ */
+uint32_t kserial_capture_map(kserial_capture_view_t *view, const char *path)
+{
+    const uint8_t *header;
+    char *name = kserial_capture_index_path(path);
+    uint64_t count;
+    uint64_t total;
+    uint64_t channel;
+
+    memset(view, 0, sizeof(kserial_capture_view_t));
+    if (name == NULL)
+    {
+        return KS_ERROR;
+    }
+    view->map[0] = kserial_capture_mmap(path, &view->mapsize[0]);
+    view->map[1] = kserial_capture_mmap(name, &view->mapsize[1]);
+    free(name);
+
+    header = (const uint8_t *)view->map[1];
+    if ((header == NULL) || (view->mapsize[1] < KSERIAL_CAPTURE_HEADER_SIZE) ||
+        (memcmp(&header[offsetof(kserial_capture_header_t, magic)], KSERIAL_CAPTURE_MAGIC, 4) != 0) ||
+        (kserial_capture_get(&header[offsetof(kserial_capture_header_t, version)], 2) != KSERIAL_CAPTURE_VERSION) ||
+        (kserial_capture_get(&header[offsetof(kserial_capture_header_t, recsize)], 2) != KSERIAL_CAPTURE_RECORD_SIZE))
+    {
+        kserial_capture_unmap(view);
+        return KS_ERROR;
+    }
+
+    count = (view->mapsize[1] - KSERIAL_CAPTURE_HEADER_SIZE) / KSERIAL_CAPTURE_RECORD_SIZE;
+    total = kserial_capture_get(&header[offsetof(kserial_capture_header_t, count)], 8);
+    channel = kserial_capture_get(&header[offsetof(kserial_capture_header_t, channel)], 8);
+    if ((total != 0) && (total <= count))
+    {
+        count = total;
+        if ((channel != 0) && ((channel + count * sizeof(uint32_t)) <= view->mapsize[1]))
+        {
+            view->channel = (const uint32_t *)&header[channel];
+        }
+    }
+    view->data = (const uint8_t *)view->map[0];
+    view->datasize = view->mapsize[0];
+    view->index = (const kserial_capture_index_t *)&header[KSERIAL_CAPTURE_HEADER_SIZE];
+    view->count = count;
+#ifdef KSERIAL_CAPTURE_BIG_ENDIAN
+    if (kserial_capture_swap(view) != KS_OK)
+    {
+        kserial_capture_unmap(view);
+        return KS_ERROR;
+    }
+#endif
+    // drop records of frames that never reached the data file
+    while ((view->count > 0) && ((view->index[view->count - 1].offset + view->index[view->count - 1].nbyte + 8) > view->datasize))
+    {
+        view->count--;
+        view->channel = NULL;
+    }
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_capture_unmap
+ */
+void kserial_capture_unmap(kserial_capture_view_t *view)
+{
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        if (view->map[i] != NULL)
+        {
+            munmap(view->map[i], view->mapsize[i]);
+        }
+        free(view->copy[i]);
+    }
+    memset(view, 0, sizeof(kserial_capture_view_t));
+}
+
+/**
+ *  @brief  kserial_capture_seek
+ *  Return the first record received at or after time, view->count if none.
+ */
+uint64_t kserial_capture_seek(const kserial_capture_view_t *view, uint64_t time)
+{
+    uint64_t lower = 0;
+    uint64_t upper = view->count;
+    uint64_t middle;
+
+    while (lower < upper)
+    {
+        middle = lower + (upper - lower) / 2;
+        if (view->index[middle].time < time)
+        {
+            lower = middle + 1;
+        }
+        else
+        {
+            upper = middle;
+        }
+    }
+    return lower;
+}
+
+/**
+ *  @brief  kserial_capture_key
+ */
+static inline uint32_t kserial_capture_key(const kserial_capture_view_t *view, uint32_t record)
+{
+    const kserial_capture_index_t *index = &view->index[record];
+    return KSERIAL_DEMUX_KEY(index->type, index->param[0], index->param[1]);
+}
+
+/**
+ *  @brief  kserial_capture_channel
+ *  record returns the record numbers of one channel in time order.
+ */
+uint32_t kserial_capture_channel(const kserial_capture_view_t *view, uint32_t type, uint32_t param1, uint32_t param2, const uint32_t **record, uint64_t *count)
+{
+    uint32_t key = KSERIAL_DEMUX_KEY(type, param1, param2);
+    uint64_t lower = 0;
+    uint64_t upper = view->count;
+    uint64_t first;
+    uint64_t middle;
+
+    *record = NULL;
+    *count = 0;
+    if (view->channel == NULL)
+    {
+        return KS_ERROR;
+    }
+    while (lower < upper)
+    {
+        middle = lower + (upper - lower) / 2;
+        if (kserial_capture_key(view, view->channel[middle]) < key)
+        {
+            lower = middle + 1;
+        }
+        else
+        {
+            upper = middle;
+        }
+    }
+    first = lower;
+    upper = view->count;
+    while (lower < upper)
+    {
+        middle = lower + (upper - lower) / 2;
+        if (kserial_capture_key(view, view->channel[middle]) <= key)
+        {
+            lower = middle + 1;
+        }
+        else
+        {
+            upper = middle;
+        }
+    }
+    *record = &view->channel[first];
+    *count = lower - first;
+
+    return (*count != 0) ? KS_OK : KS_ERROR;
+}
+
+/**
+ *  @brief  kserial_capture_channel_seek
+ *  Return the first position in record received at or after time, count if none.
+ */
+uint64_t kserial_capture_channel_seek(const kserial_capture_view_t *view, const uint32_t *record, uint64_t count, uint64_t time)
+{
+    uint64_t lower = 0;
+    uint64_t upper = count;
+    uint64_t middle;
+
+    while (lower < upper)
+    {
+        middle = lower + (upper - lower) / 2;
+        if (view->index[record[middle]].time < time)
+        {
+            lower = middle + 1;
+        }
+        else
+        {
+            upper = middle;
+        }
+    }
+    return lower;
+}
+
+/**
+ *  @brief  kserial_capture_packet
+ *  Packet data points into the mapped capture, a stamped frame returns its samples and seq.
+ */
+uint32_t kserial_capture_packet(const kserial_capture_view_t *view, uint64_t record, kserial_packet_t *pk)
+{
+    const kserial_capture_index_t *index;
+    const uint8_t *data;
+    uint32_t typesize;
+    uint32_t nbyte;
+
+    if (record >= view->count)
+    {
+        return KS_ERROR;
+    }
+    index = &view->index[record];
+    data = &view->data[index->offset + 7];
+    typesize = KS_TYPE_SIZE[index->type & 0x0F];
+    nbyte = index->nbyte;
+    if ((index->flags & KSERIAL_CAPTURE_STAMPED) && (nbyte >= 2))
+    {
+        nbyte -= 2;
+    }
+    pk->param[0] = index->param[0];
+    pk->param[1] = index->param[1];
+    pk->type = index->type;
+    pk->nbyte = nbyte;
+    pk->lens = (typesize > 1) ? (nbyte / typesize) : nbyte;
+    pk->data = (void *)data;
+#if KSERIAL_SEQUENCE_ENABLE
+    pk->seq = (nbyte != index->nbyte) ? (data[nbyte] | (data[nbyte + 1] << 8)) : 0;
+#endif
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_replay_now
+ */
+static uint64_t kserial_replay_now(void *handle)
+{
+    struct timespec ts;
+    (void)handle;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ *  @brief  kserial_replay_init
+ *  The view must stay mapped while replaying.
+ */
+void kserial_replay_init(kserial_replay_t *rp, const kserial_capture_view_t *view, uint32_t realtime)
+{
+    memset(rp, 0, sizeof(kserial_replay_t));
+    rp->view = view;
+    rp->realtime = realtime;
+    rp->start = kserial_replay_now(NULL);
+    rp->origin = (view->count != 0) ? view->index[0].time : 0;
+    if (!realtime)
+    {
+        rp->record = view->count;
+        rp->release = view->datasize;
+    }
+}
+
+/**
+ *  @brief  kserial_replay_done
+ *  Every byte of the capture has been delivered.
+ */
+uint32_t kserial_replay_done(const kserial_replay_t *rp)
+{
+    return (rp->record == rp->view->count) && (rp->offset == rp->view->datasize);
+}
+
+/**
+ *  @brief  kserial_replay_advance
+ *  Release the frames whose recorded time has come.
+ */
+static void kserial_replay_advance(kserial_replay_t *rp)
+{
+    const kserial_capture_view_t *view = rp->view;
+    uint64_t elapsed = kserial_replay_now(NULL) - rp->start;
+
+    while ((rp->record < view->count) && ((view->index[rp->record].time - rp->origin) <= elapsed))
+    {
+        rp->record++;
+    }
+    rp->release = (rp->record == view->count) ? view->datasize : view->index[rp->record].offset;
+}
+
+/**
+ *  @brief  kserial_replay_send
+ *  Nothing is attached to a replay, writes are discarded.
+ */
+static uint32_t kserial_replay_send(void *handle, const void *data, uint32_t lens)
+{
+    (void)handle;
+    (void)data;
+    return lens;
+}
+
+/**
+ *  @brief  kserial_replay_recv
+ */
+static uint32_t kserial_replay_recv(void *handle, void *data, uint32_t lens)
+{
+    kserial_replay_t *rp = (kserial_replay_t *)handle;
+
+    if (rp->realtime)
+    {
+        kserial_replay_advance(rp);
+    }
+    if (lens > (rp->release - rp->offset))
+    {
+        lens = (uint32_t)(rp->release - rp->offset);
+    }
+    memcpy(data, &rp->view->data[rp->offset], lens);
+    rp->offset += lens;
+
+    return lens;
+}
+
+/**
+ *  @brief  kserial_replay_flush
+ *  Keep the recording intact, command helpers flush before every request.
+ */
+static void kserial_replay_flush(void *handle)
+{
+    (void)handle;
+}
+
+/**
+ *  @brief  kserial_replay_wait
+ *  KS_ERROR once the capture is exhausted, no more input will arrive.
+ */
+static uint32_t kserial_replay_wait(void *handle, uint32_t timeout)
+{
+    kserial_replay_t *rp = (kserial_replay_t *)handle;
+    const kserial_capture_view_t *view = rp->view;
+    uint64_t now = kserial_replay_now(NULL);
+    uint64_t deadline = now + (uint64_t)timeout * 1000000ULL;
+    uint64_t next;
+    struct timespec ts;
+
+    if (rp->realtime)
+    {
+        kserial_replay_advance(rp);
+    }
+    if (rp->offset != rp->release)
+    {
+        return KS_OK;
+    }
+    if (rp->record == view->count)
+    {
+        return KS_ERROR;
+    }
+
+    // sleep until the next frame is due or the timeout expires
+    next = rp->start + (view->index[rp->record].time - rp->origin);
+    if (next > deadline)
+    {
+        next = deadline;
+    }
+    if (next > now)
+    {
+        ts.tv_sec = (time_t)((next - now) / 1000000000ULL);
+        ts.tv_nsec = (long)((next - now) % 1000000000ULL);
+        nanosleep(&ts, NULL);
+    }
+    kserial_replay_advance(rp);
+
+    return (rp->offset != rp->release) ? KS_OK : KS_TIMEOUT;
+}
+
+#endif
+
+/*************************************** END OF FILE ****************************************/
@@ -0,0 +1,142 @@
+/**
+ *      __            ____
+ *     / /__ _  __   / __/                      __  
+ *    / //_/(_)/ /_ / /  ___   ____ ___  __ __ / /_ 
+ *   / ,<  / // __/_\ \ / _ \ / __// _ \/ // // __/ 
+ *  /_/|_|/_/ \__//___// .__//_/   \___/\_,_/ \__/  
+ *                    /_/   github.com/KitSprout    
+ * 
+ *  @file    kserial_capture.h
+ *  @author  KitSprout
+ *  @brief   memory mappable packet capture
+ * 
+ */
+
+/* Define to prevent recursive inclusion ---------------------------------------------------*/
+#ifndef __KSERIAL_CAPTURE_H
+#define __KSERIAL_CAPTURE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes --------------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stddef.h>
+#include "kserial.h"
+
+/* Define ----------------------------------------------------------------------------------*/
+
+#define KSERIAL_CAPTURE_VERSION                         (2U)
+
+/* kserial_capture_index_t flags */
+#define KSERIAL_CAPTURE_STAMPED                         (0x01U) /* payload ends with the u16 sequence number */
+
+/* Macro -----------------------------------------------------------------------------------*/
+/* Typedef ---------------------------------------------------------------------------------*/
+
+/* <path>.idx, fields are stored little endian in this order without padding */
+typedef struct
+{
+    uint8_t magic[4];           // 'K', 'S', 'I', 'X'
+    uint16_t version;
+    uint16_t recsize;           // sizeof(kserial_capture_index_t)
+    uint64_t count;             // records, 0 until the capture is closed
+    uint64_t channel;           // file offset of the per channel order, 0 if none
+
+} kserial_capture_header_t;
+
+typedef struct
+{
+    uint64_t offset;            // frame offset in <path>
+    uint64_t time;              // receive time, ns, non-decreasing
+    uint16_t nbyte;             // payload bytes on the wire, the stamp included
+    uint8_t type;
+    uint8_t param[2];
+    uint8_t flags;              // KSERIAL_CAPTURE_xxx
+    uint8_t reserved[2];
+
+} kserial_capture_index_t;
+
+typedef struct
+{
+    FILE *data;
+    FILE *index;
+    uint64_t offset;
+    uint64_t count;
+    uint32_t *key;              // channel of every record, for the order written on close
+    uint64_t size;
+
+#if KSERIAL_TAP_ENABLE
+    // recording a context
+    kserial_ctx_t *ctx;
+    kserial_tap_t tap;
+    uint64_t base;              // offset when attached
+    uint64_t time;              // latest read
+#endif
+    uint64_t last;              // time of the latest record
+    uint32_t status;            // KS_ERROR after a failed write of the tap
+
+} kserial_capture_t;
+
+typedef struct
+{
+    const uint8_t *data;
+    size_t datasize;
+    const kserial_capture_index_t *index;   // host order
+    uint64_t count;
+    const uint32_t *channel;    // record numbers sorted by (type, P1, P2), then time, NULL if none
+
+    void *map[2];
+    size_t mapsize[2];
+    void *copy[2];              // index and channel in host order on a big endian host
+
+} kserial_capture_view_t;
+
+typedef struct
+{
+    const kserial_capture_view_t *view;
+    uint32_t realtime;          // 1 : original timing, 0 : as fast as possible
+    uint64_t record;            // next record to release
+    uint64_t offset;            // next byte to deliver
+    uint64_t release;           // bytes released so far
+    uint64_t start;             // host time of the first record, ns
+    uint64_t origin;            // capture time of the first record, ns
+
+} kserial_replay_t;
+
+/* Extern ----------------------------------------------------------------------------------*/
+
+#if KSERIAL_POSIX_ENABLE
+extern const kserial_transport_t kserial_transport_replay;     // handle : kserial_replay_t *
+#endif
+
+/* Functions -------------------------------------------------------------------------------*/
+
+#if KSERIAL_POSIX_ENABLE
+uint32_t    kserial_capture_open(kserial_capture_t *cap, const char *path);
+#if KSERIAL_TAP_ENABLE
+uint32_t    kserial_capture_attach(kserial_capture_t *cap, kserial_ctx_t *ctx);
+void        kserial_capture_detach(kserial_capture_t *cap);
+#endif
+uint32_t    kserial_capture_write(kserial_capture_t *cap, const kserial_packet_t *pk, uint64_t time);
+uint32_t    kserial_capture_close(kserial_capture_t *cap);
+
+uint32_t    kserial_capture_map(kserial_capture_view_t *view, const char *path);
+void        kserial_capture_unmap(kserial_capture_view_t *view);
+uint64_t    kserial_capture_seek(const kserial_capture_view_t *view, uint64_t time);
+uint32_t    kserial_capture_channel(const kserial_capture_view_t *view, uint32_t type, uint32_t param1, uint32_t param2, const uint32_t **record, uint64_t *count);
+uint64_t    kserial_capture_channel_seek(const kserial_capture_view_t *view, const uint32_t *record, uint64_t count, uint64_t time);
+uint32_t    kserial_capture_packet(const kserial_capture_view_t *view, uint64_t record, kserial_packet_t *pk);
+
+void        kserial_replay_init(kserial_replay_t *rp, const kserial_capture_view_t *view, uint32_t realtime);
+uint32_t    kserial_replay_done(const kserial_replay_t *rp);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/*************************************** END OF FILE ****************************************/
@@ -22,51 +22,165 @@ extern "C" {
 
 /* Define ----------------------------------------------------------------------------------*/
 
+#ifndef KSERIAL_SERIAL_ENABLE
+#define KSERIAL_SERIAL_ENABLE                           (1U)    /* serial.h transport */
+#endif
+
+#ifndef KSERIAL_POSIX_ENABLE
+#define KSERIAL_POSIX_ENABLE                            (1U)    /* fd, pty and loopback transports */
+#endif
+
 #ifndef KSERIAL_SEND_ENABLE
 #define KSERIAL_SEND_ENABLE                             (1U)
 #ifndef KS_MAX_SEND_BUFFER_SIZE
 #define KS_MAX_SEND_BUFFER_SIZE                         (4096 + 32)
 #endif
 #endif
+#ifndef KSERIAL_SEND_BATCH_LENS
+#define KSERIAL_SEND_BATCH_LENS                         (128)   /* packets per vectored write */
+#endif
 
 #ifndef KSERIAL_RECV_ENABLE
 #define KSERIAL_RECV_ENABLE                             (1U)
 #ifndef KS_MAX_RECV_BUFFER_SIZE
-#define KS_MAX_RECV_BUFFER_SIZE                         (4096 + 1024 + 32)
+#define KS_MAX_RECV_BUFFER_SIZE                         (8 * 1024)     /* power of two */
 #endif
 #endif
 
 #ifndef KSERIAL_RECV_TREAD_ENABLE
 #define KSERIAL_RECV_TREAD_ENABLE                       (1U)
+#endif
+#ifndef KSERIAL_RECV_STATIC_ENABLE
+#define KSERIAL_RECV_STATIC_ENABLE                      (1U)    /* global ks, 0 when every context uses a pool */
+#endif
+#ifndef KSERIAL_MAX_PACKET_LENS
 #define KSERIAL_MAX_PACKET_LENS                         (4096)
+#endif
+#ifndef KSERIAL_RECV_PACKET_BUFFER_LENS
 #define KSERIAL_RECV_PACKET_BUFFER_LENS                 (64 * 1024)
 #endif
+#ifndef KSERIAL_RECV_PACKET_MODE
+#define KSERIAL_RECV_PACKET_MODE                        KSERIAL_PACKET_COPY
+#endif
+
+#ifndef KSERIAL_TIMESTAMP_ENABLE
+#define KSERIAL_TIMESTAMP_ENABLE                        (0U)    /* packet arrival time and latency histogram */
+#endif
+#ifndef KSERIAL_TIME_MARKS
+#define KSERIAL_TIME_MARKS                              (16)    /* reads with pending bytes, power of two */
+#endif
+
+#ifndef KSERIAL_SEQUENCE_ENABLE
+#define KSERIAL_SEQUENCE_ENABLE                         (0U)    /* sequence numbers on numeric frames */
+#endif
+
+#ifndef KSERIAL_CREDIT_ENABLE
+#define KSERIAL_CREDIT_ENABLE                           (1U)    /* credit flow control of numeric frames */
+#endif
+#ifndef KSERIAL_CREDIT_IDLE
+#define KSERIAL_CREDIT_IDLE                             (100)   /* ms without numeric frames before the limit is sent again and resynced */
+#endif
+
+#ifndef KSERIAL_TAP_ENABLE
+#define KSERIAL_TAP_ENABLE                              (1U)    /* raw input hook of captures */
+#endif
+
+#ifndef KSERIAL_HUB_ENABLE
+#define KSERIAL_HUB_ENABLE                              (1U)    /* epoll, linux only */
+#endif
+#ifndef KSERIAL_HUB_READS
+#define KSERIAL_HUB_READS                               (4)     /* reads of one port per poll */
+#endif
+
+#ifndef KSERIAL_BULK_WINDOW
+#define KSERIAL_BULK_WINDOW                             (16)    /* R3 chunks in flight, 1 ~ 128 */
+#endif
+#ifndef KSERIAL_BULK_TIMEOUT
+#define KSERIAL_BULK_TIMEOUT                            (200)   /* ms without acknowledgement */
+#endif
+#ifndef KSERIAL_BULK_RETRY
+#define KSERIAL_BULK_RETRY                              (5)
+#endif
+
+#ifndef KSERIAL_BAUD_BURST
+#define KSERIAL_BAUD_BURST                              (32)    /* echo frames of a probe */
+#endif
+#ifndef KSERIAL_BAUD_CONFIRM
+#define KSERIAL_BAUD_CONFIRM                            (500)   /* ms without a commit or probe frame before the device reverts a new rate */
+#endif
+#ifndef KSERIAL_BAUD_SILENCE
+#define KSERIAL_BAUD_SILENCE                            (1000)  /* ms watch period of the device, see kserial_baud_poll */
+#endif
+#ifndef KSERIAL_BAUD_ERRORS
+#define KSERIAL_BAUD_ERRORS                             (8)     /* receive errors per watch period before the device reverts */
+#endif
+
+#ifndef KSERIAL_SIMD_ENABLE
+#define KSERIAL_SIMD_ENABLE                             (1U)
+#endif
 
 #ifndef KSERIAL_CMD_ENABLE
 #define KSERIAL_CMD_ENABLE                              (1U)
 #endif
+#ifndef KSCMD_RESPONSE_TIMEOUT
+#define KSCMD_RESPONSE_TIMEOUT                          (100)   /* ms */
+#endif
 
+#if KSERIAL_SEND_ENABLE
+#if ((KSERIAL_SEND_BATCH_LENS * 8) > KS_MAX_SEND_BUFFER_SIZE)
+#error "Send buffer too small for a batch of headers"
+#endif
+#endif
+#if KSERIAL_RECV_ENABLE
+#if (KS_MAX_RECV_BUFFER_SIZE & (KS_MAX_RECV_BUFFER_SIZE - 1))
+#error "Recv buffer size must be a power of two"
+#endif
+#endif
 #if KSERIAL_RECV_TREAD_ENABLE
 #if !(KSERIAL_RECV_ENABLE)
 #error "Need to enable recv"
 #endif
 #endif
+#if KSERIAL_RECV_STATIC_ENABLE
+#if (KSERIAL_RECV_PACKET_BUFFER_LENS & (KSERIAL_RECV_PACKET_BUFFER_LENS - 1))
+#error "Packet buffer lens must be a power of two"
+#endif
+#endif
+#if KSERIAL_TIMESTAMP_ENABLE
+#if (KSERIAL_TIME_MARKS & (KSERIAL_TIME_MARKS - 1))
+#error "Time marks must be a power of two"
+#endif
+#endif
+#if ((KSERIAL_BULK_WINDOW < 1) || (KSERIAL_BULK_WINDOW > 128))
+#error "Bulk window must fit the 8-bit sequence"
+#endif
+#if KSERIAL_HUB_ENABLE
+#if !(KSERIAL_RECV_ENABLE)
+#error "Need to enable recv"
+#endif
+#endif
 #if KSERIAL_CMD_ENABLE
 #if !(KSERIAL_SEND_ENABLE && KSERIAL_RECV_ENABLE)
 #error "Need to enable send and recv"
 #endif
 #endif
+#if KSERIAL_CREDIT_ENABLE
+#if !(KSERIAL_SEND_ENABLE && KSERIAL_RECV_ENABLE)
+#error "Need to enable send and recv"
+#endif
+#endif
 
 #define KSERIAL_TYPE_LENS                               (16)
 
 /* Includes --------------------------------------------------------------------------------*/
 
-#if (KSERIAL_SEND_ENABLE || KSERIAL_RECV_ENABLE)
+#if KSERIAL_SERIAL_ENABLE && (KSERIAL_SEND_ENABLE || KSERIAL_RECV_ENABLE)
 #include "serial.h"
 #endif
 
 /* Macro -----------------------------------------------------------------------------------*/
 
+#if KSERIAL_SERIAL_ENABLE
 #if KSERIAL_SEND_ENABLE
 #ifndef kserial_send
 #define kserial_send(__DATA, __LENS)                    serial_send_data(&s, __DATA, __LENS)
@@ -81,6 +195,7 @@ extern "C" {
 #if (KSERIAL_SEND_ENABLE || KSERIAL_RECV_ENABLE)
 #define kserial_delay(__MS)                             serial_delay(__MS)
 #endif
+#endif
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,439 @@
+/**
+ *      __            ____
+ *     / /__ _  __   / __/                      __  
+ *    / //_/(_)/ /_ / /  ___   ____ ___  __ __ / /_ 
+ *   / ,<  / // __/_\ \ / _ \ / __// _ \/ // // __/ 
+ *  /_/|_|/_/ \__//___// .__//_/   \___/\_,_/ \__/  
+ *                    /_/   github.com/KitSprout    
+ * 
+ *  @file    kserial_coro.hpp
+ *  @author  KitSprout
+ *  @brief   header-only C++20 coroutine layer on top of kserial_hub and kscmd_async
+ *           kserial::coro::loop waits on the hub and resumes coroutines from readiness events,
+ *           a port awaits unmatched packets with next_packet() and responses with command().
+ *           Coroutines are resumed by the loop after the hub returns, never from a handler.
+ */
+
+/* Define to prevent recursive inclusion ---------------------------------------------------*/
+#ifndef __KSERIAL_CORO_HPP
+#define __KSERIAL_CORO_HPP
+
+#if (__cplusplus < 202002L)
+#error "kserial_coro.hpp needs C++20 coroutines"
+#endif
+
+/* Includes --------------------------------------------------------------------------------*/
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <deque>
+#include <utility>
+#include <vector>
+#include "kserial.hpp"
+#include "kserial_hub.h"
+#include "kscmd_async.h"
+
+#if KSERIAL_HUB_ENABLE && KSERIAL_CMD_ENABLE
+
+namespace kserial::coro
+{
+
+/* Typedef ---------------------------------------------------------------------------------*/
+
+/**
+ *  @brief  packet
+ *  Owned copy of a received packet, raw() gives a kserial_packet_t for kserial::view.
+ */
+struct packet
+{
+    param_t param{};
+    uint32_t type = 0;
+    uint32_t lens = 0;
+    std::vector<uint8_t> data;
+#if KSERIAL_TIMESTAMP_ENABLE
+    uint64_t tfirst = 0;
+    uint64_t tlast = 0;
+#endif
+#if KSERIAL_SEQUENCE_ENABLE
+    uint16_t seq = 0;
+#endif
+
+    packet() = default;
+    packet(const kserial_packet_t &pk, uint32_t nbyte)
+        : param{pk.param[0], pk.param[1]}, type(pk.type), lens(pk.lens),
+          data(static_cast<const uint8_t *>(pk.data), static_cast<const uint8_t *>(pk.data) + ((pk.data != nullptr) ? nbyte : 0))
+#if KSERIAL_TIMESTAMP_ENABLE
+        , tfirst(pk.tfirst), tlast(pk.tlast)
+#endif
+#if KSERIAL_SEQUENCE_ENABLE
+        , seq(pk.seq)
+#endif
+    {}
+    explicit packet(const kserial_packet_t &pk) : packet(pk, pk.nbyte) {}
+
+    kserial_packet_t raw() const noexcept
+    {
+        kserial_packet_t pk{};
+        pk.param[0] = param[0];
+        pk.param[1] = param[1];
+        pk.type = type;
+        pk.lens = lens;
+        pk.nbyte = static_cast<uint32_t>(data.size());
+        pk.data = const_cast<uint8_t *>(data.data());
+#if KSERIAL_TIMESTAMP_ENABLE
+        pk.tfirst = tfirst;
+        pk.tlast = tlast;
+#endif
+#if KSERIAL_SEQUENCE_ENABLE
+        pk.seq = seq;
+#endif
+        return pk;
+    }
+};
+
+/**
+ *  @brief  response
+ *  status is KS_OK, KS_TIMEOUT, or KS_BUSY when the command could not be submitted.
+ */
+struct response
+{
+    uint32_t status = KS_BUSY;
+    packet pk;
+
+    explicit operator bool() const noexcept { return status == KS_OK; }
+};
+
+class port;
+
+/**
+ *  @brief  loop
+ *  Owns the hub, every port of the loop must be driven by the same thread.
+ */
+class loop
+{
+public:
+    explicit loop(uint32_t size = 8) : slots(size)
+    {
+        if (kserial_hub_init(&hub, slots.data(), size) != KS_OK)
+        {
+            hub.epfd = -1;
+        }
+    }
+    ~loop()
+    {
+        if (hub.epfd >= 0)
+        {
+            kserial_hub_deinit(&hub);
+        }
+    }
+    loop(const loop &) = delete;
+    loop &operator=(const loop &) = delete;
+
+    bool valid() const noexcept { return hub.epfd >= 0; }
+
+    /**
+     *  @brief  now
+     *  Millisecond clock of the kscmd deadlines.
+     */
+    static uint32_t now() noexcept
+    {
+        using namespace std::chrono;
+        return static_cast<uint32_t>(duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count());
+    }
+
+    /**
+     *  @brief  schedule
+     *  Queue h to be resumed by the loop.
+     */
+    void schedule(std::coroutine_handle<> h) { ready.push_back(h); }
+
+    /**
+     *  @brief  run_once
+     *  Wait up to timeout ms, or less when a command deadline comes first, then expire commands
+     *  and resume every coroutine made ready.
+     */
+    void run_once(uint32_t timeout);
+
+    /**
+     *  @brief  run_until
+     *  Run until done() returns true.
+     */
+    template <typename Pred>
+    void run_until(Pred done, uint32_t timeout = 100)
+    {
+        resume();
+        while (!done())
+        {
+            run_once(timeout);
+        }
+    }
+
+private:
+    friend class port;
+
+    void resume()
+    {
+        while (!ready.empty())
+        {
+            std::coroutine_handle<> h = ready.front();
+            ready.pop_front();
+            h.resume();
+        }
+    }
+
+    kserial_hub_t hub{};
+    std::vector<kserial_hub_port_t> slots;
+    std::vector<port *> ports;
+    std::deque<std::coroutine_handle<>> ready;
+};
+
+/**
+ *  @brief  port
+ *  One context on the loop, the transport must have an fd (serial, fd or pty).
+ *  Packets matching an outstanding command complete it, the others go to next_packet()
+ *  waiters in order, or to a backlog of up to backlog packets that drops the oldest.
+ *  Coroutines still suspended on the port when it is destroyed are never resumed.
+ */
+class port
+{
+public:
+    class packet_awaiter
+    {
+    public:
+        explicit packet_awaiter(port &p) noexcept : owner(&p) {}
+
+        bool await_ready()
+        {
+            if (owner->queue.empty())
+            {
+                return false;
+            }
+            result = std::move(owner->queue.front());
+            owner->queue.pop_front();
+            return true;
+        }
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            handle = h;
+            owner->waiters.push_back(this);
+        }
+        packet await_resume() { return std::move(result); }
+
+    private:
+        friend class port;
+
+        port *owner;
+        std::coroutine_handle<> handle;
+        packet result;
+    };
+
+    class command_awaiter
+    {
+    public:
+        command_awaiter(port &p, uint32_t type, param_t param, std::vector<uint8_t> payload, uint32_t match, uint32_t rsize, uint32_t timeout)
+            : owner(&p), payload(std::move(payload)), rdata(rsize)
+        {
+            uint32_t size = type_size(type);
+            req.type = type;
+            req.param[0] = param[0];
+            req.param[1] = param[1];
+            req.lens = static_cast<uint32_t>(this->payload.size()) / ((size > 1) ? size : 1);
+            req.match = match;
+            req.timeout = timeout;
+        }
+        command_awaiter(command_awaiter &&) = default;
+        command_awaiter(const command_awaiter &) = delete;
+        command_awaiter &operator=(const command_awaiter &) = delete;
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> h) noexcept
+        {
+            // pointers are taken here, the awaiter no longer moves once awaited
+            handle = h;
+            req.pdata = payload.empty() ? nullptr : payload.data();
+            req.rdata = rdata.empty() ? nullptr : rdata.data();
+            req.rsize = static_cast<uint32_t>(rdata.size());
+            req.callback = &command_awaiter::complete;
+            req.user = this;
+            return kscmd_async_submit(&owner->as, &req, loop::now()) == KS_OK;
+        }
+        response await_resume() { return std::move(result); }
+
+    private:
+        static void complete(void *user, uint32_t status, const kserial_packet_t *pk)
+        {
+            command_awaiter *aw = static_cast<command_awaiter *>(user);
+
+            aw->result.status = status;
+            if (pk != nullptr)
+            {
+                aw->result.pk = packet(*pk);
+            }
+            aw->owner->owner->schedule(aw->handle);
+        }
+
+        port *owner;
+        std::vector<uint8_t> payload;
+        std::vector<uint8_t> rdata;
+        kscmd_request_t req{};
+        std::coroutine_handle<> handle;
+        response result;
+    };
+
+    port(loop &lp, kserial_ctx_t *ctx, uint32_t pending = 64, std::size_t backlog = 256)
+        : owner(&lp), table(pending), backlog(backlog)
+    {
+        kscmd_async_init(&as, ctx, table.data(), pending);
+        if (lp.valid() && (kserial_hub_add(&lp.hub, ctx, &port::handler, this, &index) == KS_OK))
+        {
+            lp.ports.push_back(this);
+        }
+        else
+        {
+            index = invalid;
+        }
+    }
+    ~port()
+    {
+        if (index != invalid)
+        {
+            kserial_hub_remove(&owner->hub, index);
+            owner->ports.erase(std::find(owner->ports.begin(), owner->ports.end(), this));
+        }
+    }
+    port(const port &) = delete;
+    port &operator=(const port &) = delete;
+
+    bool valid() const noexcept { return index != invalid; }
+    kserial_ctx_t *context() const noexcept { return as.ctx; }
+    uint32_t dropped() const noexcept { return lost; }
+
+    /**
+     *  @brief  next_packet
+     *  Next packet not taken by a command.
+     */
+    packet_awaiter next_packet() noexcept { return packet_awaiter(*this); }
+
+    /**
+     *  @brief  command
+     *  Send an R0 ~ R4 command without payload and await the response matching type and params,
+     *  at most rsize bytes of the response payload are kept.
+     */
+    command_awaiter command(uint32_t type, uint8_t param1, uint8_t param2, uint32_t rsize = 8, uint32_t timeout = KSCMD_RESPONSE_TIMEOUT)
+    {
+        return command_awaiter(*this, type, {param1, param2}, {}, KSCMD_MATCH_ALL, rsize, timeout);
+    }
+
+    /**
+     *  @brief  request
+     *  Send payload bytes with type and param, await the response selected by match.
+     */
+    command_awaiter request(uint32_t type, param_t param, std::vector<uint8_t> payload, uint32_t match, uint32_t rsize, uint32_t timeout = KSCMD_RESPONSE_TIMEOUT)
+    {
+        return command_awaiter(*this, type, param, std::move(payload), match, rsize, timeout);
+    }
+
+private:
+    friend class loop;
+
+    static constexpr uint32_t invalid = static_cast<uint32_t>(-1);
+
+    static void handler(void *user, const kserial_packet_t *pk)
+    {
+        port *self = static_cast<port *>(user);
+
+        if (kscmd_async_dispatch(&self->as, pk) == KS_OK)
+        {
+            return;
+        }
+        if (!self->waiters.empty())
+        {
+            packet_awaiter *aw = self->waiters.front();
+            self->waiters.pop_front();
+            aw->result = packet(*pk);
+            self->owner->schedule(aw->handle);
+            return;
+        }
+        if (self->queue.size() >= self->backlog)
+        {
+            self->queue.pop_front();
+            self->lost++;
+        }
+        self->queue.emplace_back(*pk);
+    }
+
+    loop *owner;
+    kscmd_async_t as{};
+    std::vector<kscmd_request_t *> table;
+    uint32_t index = invalid;
+    std::size_t backlog;
+    uint32_t lost = 0;
+    std::deque<packet> queue;
+    std::deque<packet_awaiter *> waiters;
+};
+
+/**
+ *  @brief  twi
+ *  TWI register access through the R1 command of a port.
+ */
+class twi
+{
+public:
+    explicit twi(port &p) noexcept : owner(&p) {}
+
+    /**
+     *  @brief  read_regs
+     *  Response payload holds the lens register bytes, empty on timeout.
+     */
+    port::command_awaiter read_regs(uint8_t slaveaddr, uint8_t regaddr, uint8_t lens, uint32_t timeout = KSCMD_RESPONSE_TIMEOUT)
+    {
+        return owner->request(KS_R1, {static_cast<uint8_t>((slaveaddr << 1) + 1), regaddr}, {lens}, KSCMD_MATCH_ALL, lens, timeout);
+    }
+
+    /**
+     *  @brief  write_regs
+     *  Fire and forget, like kscmd_twi_writeregs_ctx without the flush of the receive side.
+     */
+    uint32_t write_regs(uint8_t slaveaddr, uint8_t regaddr, const uint8_t *regdata, uint8_t lens)
+    {
+        uint8_t param[2] = {static_cast<uint8_t>(slaveaddr << 1), regaddr};
+        return kserial_send_packet_ctx(owner->context(), param, const_cast<uint8_t *>(regdata), lens, KS_R1);
+    }
+
+private:
+    port *owner;
+};
+
+/* Functions -------------------------------------------------------------------------------*/
+
+inline void loop::run_once(uint32_t timeout)
+{
+    uint32_t t = now();
+    int32_t left;
+
+    resume();
+    for (port *p : ports)
+    {
+        for (uint32_t i = 0; i < p->as.count; i++)
+        {
+            left = static_cast<int32_t>(p->as.pending[i]->deadline - t);
+            left = (left > 0) ? left : 0;
+            timeout = std::min(timeout, static_cast<uint32_t>(left));
+        }
+    }
+    kserial_hub_poll(&hub, timeout);
+    t = now();
+    for (port *p : ports)
+    {
+        kscmd_async_expire(&p->as, t);
+    }
+    resume();
+}
+
+}   // namespace kserial::coro
+
+#endif
+
+#endif
+
+/*************************************** END OF FILE ****************************************/
@@ -0,0 +1,318 @@
+/**
+ *      __            ____
+ *     / /__ _  __   / __/                      __  
+ *    / //_/(_)/ /_ / /  ___   ____ ___  __ __ / /_ 
+ *   / ,<  / // __/_\ \ / _ \ / __// _ \/ // // __/ 
+ *  /_/|_|/_/ \__//___// .__//_/   \___/\_,_/ \__/  
+ *                    /_/   github.com/KitSprout    
+ * 
+ *  @file    kserial_demux.c
+ *  @author  KitSprout
+ *  @brief   per channel columnar demultiplexer
+ *           Packets are sorted by (type, P1, P2) into columns. A column keeps one contiguous
+ *           array per payload element (x[], y[], z[] for a three element packet), so a
+ *           consumer reads a field of every packet of a channel as one slice. Raw types
+ *           (R0 ~ R4) have no element layout and are appended as one byte stream.
+ */
+
+/* Includes --------------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <string.h>
+#include "kserial_demux.h"
+
+/* Define ----------------------------------------------------------------------------------*/
+
+#define KSERIAL_DEMUX_MIN_SLOTS         (16)
+#define KSERIAL_DEMUX_MIN_ROWS          (64)
+
+/* Macro -----------------------------------------------------------------------------------*/
+/* Typedef ---------------------------------------------------------------------------------*/
+/* Variables -------------------------------------------------------------------------------*/
+/* Prototypes ------------------------------------------------------------------------------*/
+/* Functions -------------------------------------------------------------------------------*/
+
+/**
+ *  @brief  kserial_demux_hash
+ */
+static inline uint32_t kserial_demux_hash(uint32_t key)
+{
+    return key * 0x9E3779B1U;
+}
+
+/**
+ *  @brief  kserial_demux_init
+ */
+uint32_t kserial_demux_init(kserial_demux_t *dm)
+{
+    memset(dm, 0, sizeof(kserial_demux_t));
+    dm->slot = (uint32_t *)calloc(KSERIAL_DEMUX_MIN_SLOTS, sizeof(uint32_t));
+    if (dm->slot == NULL)
+    {
+        return KS_ERROR;
+    }
+    dm->slotsize = KSERIAL_DEMUX_MIN_SLOTS;
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_demux_free
+ */
+void kserial_demux_free(kserial_demux_t *dm)
+{
+    for (uint32_t i = 0; i < dm->count; i++)
+    {
+        free(dm->column[i].data);
+    }
+    free(dm->column);
+    free(dm->slot);
+    memset(dm, 0, sizeof(kserial_demux_t));
+}
+
+/**
+ *  @brief  kserial_demux_clear
+ *  Empty every column, keep channels and capacity.
+ */
+void kserial_demux_clear(kserial_demux_t *dm)
+{
+    for (uint32_t i = 0; i < dm->count; i++)
+    {
+        dm->column[i].rows = 0;
+        dm->column[i].dropped = 0;
+    }
+}
+
+/**
+ *  @brief  kserial_demux_lookup
+ *  Return the slot of key, or the empty slot where it belongs.
+ */
+static uint32_t kserial_demux_lookup(const kserial_demux_t *dm, uint32_t key)
+{
+    uint32_t mask = dm->slotsize - 1;
+    uint32_t index = kserial_demux_hash(key) & mask;
+
+    while ((dm->slot[index] != 0) && (dm->column[dm->slot[index] - 1].key != key))
+    {
+        index = (index + 1) & mask;
+    }
+    return index;
+}
+
+/**
+ *  @brief  kserial_demux_rehash
+ */
+static uint32_t kserial_demux_rehash(kserial_demux_t *dm, uint32_t slotsize)
+{
+    uint32_t *slot = (uint32_t *)calloc(slotsize, sizeof(uint32_t));
+
+    if (slot == NULL)
+    {
+        return KS_ERROR;
+    }
+    free(dm->slot);
+    dm->slot = slot;
+    dm->slotsize = slotsize;
+    for (uint32_t i = 0; i < dm->count; i++)
+    {
+        dm->slot[kserial_demux_lookup(dm, dm->column[i].key)] = i + 1;
+    }
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_demux_create
+ *  New column for the channel of pk, return its index or dm->count on failure.
+ */
+static uint32_t kserial_demux_create(kserial_demux_t *dm, const kserial_packet_t *pk, uint32_t key)
+{
+    kserial_column_t *column;
+    uint32_t typesize = KS_TYPE_SIZE[pk->type];
+    uint32_t size;
+
+    if (((dm->count + 1) * 2) > dm->slotsize)
+    {
+        if (kserial_demux_rehash(dm, dm->slotsize * 2) != KS_OK)
+        {
+            return dm->count;
+        }
+    }
+    if (dm->count == dm->size)
+    {
+        size = (dm->size == 0) ? 8 : (dm->size * 2);
+        column = (kserial_column_t *)realloc(dm->column, size * sizeof(kserial_column_t));
+        if (column == NULL)
+        {
+            return dm->count;
+        }
+        dm->column = column;
+        dm->size = size;
+    }
+
+    column = &dm->column[dm->count];
+    memset(column, 0, sizeof(kserial_column_t));
+    column->key = key;
+    column->type = pk->type;
+    column->param[0] = pk->param[0];
+    column->param[1] = pk->param[1];
+    column->esize = (typesize == 0) ? 1 : typesize;
+    column->width = (typesize == 0) ? 1 : (pk->nbyte / typesize);
+    dm->slot[kserial_demux_lookup(dm, key)] = dm->count + 1;
+
+    return dm->count++;
+}
+
+/**
+ *  @brief  kserial_demux_reserve
+ */
+static uint32_t kserial_demux_reserve(kserial_column_t *col, uint32_t rows)
+{
+    uint32_t capacity = (col->capacity == 0) ? KSERIAL_DEMUX_MIN_ROWS : col->capacity;
+    uint32_t fieldsize;
+    uint8_t *data;
+
+    if (rows <= col->capacity)
+    {
+        return KS_OK;
+    }
+    while (capacity < rows)
+    {
+        capacity *= 2;
+    }
+    data = (uint8_t *)malloc((size_t)capacity * col->width * col->esize + 1);
+    if (data == NULL)
+    {
+        return KS_ERROR;
+    }
+    fieldsize = col->rows * col->esize;
+    for (uint32_t j = 0; (j < col->width) && (col->data != NULL); j++)
+    {
+        memcpy(&data[(size_t)j * capacity * col->esize], &col->data[(size_t)j * col->capacity * col->esize], fieldsize);
+    }
+    free(col->data);
+    col->data = data;
+    col->capacity = capacity;
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_demux_push
+ *  Append the payload of pk to the column of its channel.
+ */
+uint32_t kserial_demux_push(kserial_demux_t *dm, const kserial_packet_t *pk)
+{
+    uint32_t key = KSERIAL_DEMUX_KEY(pk->type, pk->param[0], pk->param[1]);
+    const uint8_t *src = (const uint8_t *)pk->data;
+    kserial_column_t *col;
+    uint32_t index = dm->last;
+    uint32_t stride;
+    uint8_t *dst;
+
+    if ((index >= dm->count) || (dm->column[index].key != key))
+    {
+        index = dm->slot[kserial_demux_lookup(dm, key)];
+        index = (index != 0) ? (index - 1) : kserial_demux_create(dm, pk, key);
+        if (index == dm->count)
+        {
+            return KS_ERROR;
+        }
+        dm->last = index;
+    }
+    col = &dm->column[index];
+
+    if (KS_TYPE_SIZE[col->type] == 0)
+    {
+        // raw, one byte stream
+        if (kserial_demux_reserve(col, col->rows + pk->nbyte) != KS_OK)
+        {
+            return KS_ERROR;
+        }
+        if (pk->nbyte != 0)
+        {
+            memcpy(&col->data[col->rows], src, pk->nbyte);
+        }
+        col->rows += pk->nbyte;
+        return KS_OK;
+    }
+    if ((pk->nbyte != (col->width * col->esize)) || (kserial_demux_reserve(col, col->rows + 1) != KS_OK))
+    {
+        col->dropped++;
+        return KS_ERROR;
+    }
+
+    stride = col->capacity * col->esize;
+    dst = &col->data[col->rows * col->esize];
+    switch (col->esize)
+    {
+        case 1:
+            for (uint32_t j = 0; j < col->width; j++, dst += stride)
+            {
+                dst[0] = src[j];
+            }
+            break;
+        case 2:
+            for (uint32_t j = 0; j < col->width; j++, dst += stride)
+            {
+                memcpy(dst, &src[2 * j], 2);
+            }
+            break;
+        case 4:
+            for (uint32_t j = 0; j < col->width; j++, dst += stride)
+            {
+                memcpy(dst, &src[4 * j], 4);
+            }
+            break;
+        default:
+            for (uint32_t j = 0; j < col->width; j++, dst += stride)
+            {
+                memcpy(dst, &src[8 * j], 8);
+            }
+            break;
+    }
+    col->rows++;
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_demux_push_packets
+ *  Return the number of packets appended.
+ */
+uint32_t kserial_demux_push_packets(kserial_demux_t *dm, const kserial_packet_t *pks, uint32_t count)
+{
+    uint32_t total = 0;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (kserial_demux_push(dm, &pks[i]) == KS_OK)
+        {
+            total++;
+        }
+    }
+    return total;
+}
+
+/**
+ *  @brief  kserial_demux_find
+ */
+kserial_column_t *kserial_demux_find(const kserial_demux_t *dm, uint32_t type, uint32_t param1, uint32_t param2)
+{
+    uint32_t index = dm->slot[kserial_demux_lookup(dm, KSERIAL_DEMUX_KEY(type, param1, param2))];
+    return (index != 0) ? &dm->column[index - 1] : NULL;
+}
+
+/**
+ *  @brief  kserial_demux_field
+ *  Element field of every row, col->rows values of col->esize bytes.
+ */
+void *kserial_demux_field(const kserial_column_t *col, uint32_t field)
+{
+    if ((field >= col->width) || (col->data == NULL))
+    {
+        return NULL;
+    }
+    return &col->data[(size_t)field * col->capacity * col->esize];
+}
+
+/*************************************** END OF FILE ****************************************/
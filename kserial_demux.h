@@ -0,0 +1,76 @@
+/**
+ *      __            ____
+ *     / /__ _  __   / __/                      __  
+ *    / //_/(_)/ /_ / /  ___   ____ ___  __ __ / /_ 
+ *   / ,<  / // __/_\ \ / _ \ / __// _ \/ // // __/ 
+ *  /_/|_|/_/ \__//___// .__//_/   \___/\_,_/ \__/  
+ *                    /_/   github.com/KitSprout    
+ * 
+ *  @file    kserial_demux.h
+ *  @author  KitSprout
+ *  @brief   per channel columnar demultiplexer
+ * 
+ */
+
+/* Define to prevent recursive inclusion ---------------------------------------------------*/
+#ifndef __KSERIAL_DEMUX_H
+#define __KSERIAL_DEMUX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes --------------------------------------------------------------------------------*/
+#include "kserial.h"
+
+/* Define ----------------------------------------------------------------------------------*/
+/* Macro -----------------------------------------------------------------------------------*/
+
+#define KSERIAL_DEMUX_KEY(__TYPE, __P1, __P2)           ((((__TYPE) & 0x0F) << 16) | (((__P1) & 0xFF) << 8) | ((__P2) & 0xFF))
+
+/* Typedef ---------------------------------------------------------------------------------*/
+
+typedef struct
+{
+    uint32_t key;               // KSERIAL_DEMUX_KEY(type, P1, P2)
+    uint32_t type;
+    uint8_t param[2];
+    uint32_t width;             // elements per packet, fixed by the first packet, 1 for raw types
+    uint32_t esize;             // bytes per element
+    uint32_t rows;              // packets appended (bytes for raw types)
+    uint32_t capacity;          // rows
+    uint32_t dropped;           // packets whose element count differs from width
+    uint8_t *data;              // field j is capacity * esize bytes at data + j * capacity * esize
+
+} kserial_column_t;
+
+typedef struct
+{
+    kserial_column_t *column;
+    uint32_t count;
+    uint32_t size;
+
+    uint32_t *slot;             // open addressing, column index + 1, 0 when empty
+    uint32_t slotsize;          // power of two
+    uint32_t last;              // column of the previous packet
+
+} kserial_demux_t;
+
+/* Extern ----------------------------------------------------------------------------------*/
+/* Functions -------------------------------------------------------------------------------*/
+
+uint32_t            kserial_demux_init(kserial_demux_t *dm);
+void                kserial_demux_free(kserial_demux_t *dm);
+void                kserial_demux_clear(kserial_demux_t *dm);
+uint32_t            kserial_demux_push(kserial_demux_t *dm, const kserial_packet_t *pk);
+uint32_t            kserial_demux_push_packets(kserial_demux_t *dm, const kserial_packet_t *pks, uint32_t count);
+kserial_column_t   *kserial_demux_find(const kserial_demux_t *dm, uint32_t type, uint32_t param1, uint32_t param2);
+void               *kserial_demux_field(const kserial_column_t *col, uint32_t field);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/*************************************** END OF FILE ****************************************/
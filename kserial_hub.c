@@ -0,0 +1,251 @@
+/**
+ *      __            ____
+ *     / /__ _  __   / __/                      __  
+ *    / //_/(_)/ /_ / /  ___   ____ ___  __ __ / /_ 
+ *   / ,<  / // __/_\ \ / _ \ / __// _ \/ // // __/ 
+ *  /_/|_|/_/ \__//___// .__//_/   \___/\_,_/ \__/  
+ *                    /_/   github.com/KitSprout    
+ * 
+ *  @file    kserial_hub.c
+ *  @author  KitSprout
+ *  @brief   many ports serviced from one thread
+ *           Every port context is registered with one epoll instance by the descriptor its
+ *           transport exposes. kserial_hub_poll sleeps until any port is readable, then reads
+ *           and parses only those ports and hands each packet to the port handler, so idle
+ *           devices cost nothing. A port that keeps filling its packet array is read at most
+ *           KSERIAL_HUB_READS times per poll, level triggering brings it back while the
+ *           transport has data and a backlog flag while only its ring has.
+ */
+
+/* Includes --------------------------------------------------------------------------------*/
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "kserial_hub.h"
+
+#if KSERIAL_HUB_ENABLE
+
+/* Define ----------------------------------------------------------------------------------*/
+
+#define KSERIAL_HUB_MAX_EVENTS          (64)
+
+/* Macro -----------------------------------------------------------------------------------*/
+/* Typedef ---------------------------------------------------------------------------------*/
+/* Variables -------------------------------------------------------------------------------*/
+/* Prototypes ------------------------------------------------------------------------------*/
+/* Functions -------------------------------------------------------------------------------*/
+
+/**
+ *  @brief  kserial_hub_init
+ *  port : caller storage for up to size ports.
+ */
+uint32_t kserial_hub_init(kserial_hub_t *hub, kserial_hub_port_t *port, uint32_t size)
+{
+    hub->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (hub->epfd < 0)
+    {
+        return KS_ERROR;
+    }
+    hub->size = size;
+    hub->port = port;
+    hub->backlog = 0;
+    memset(port, 0, size * sizeof(kserial_hub_port_t));
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_hub_deinit
+ *  Port contexts are left open.
+ */
+void kserial_hub_deinit(kserial_hub_t *hub)
+{
+    if (hub->epfd >= 0)
+    {
+        close(hub->epfd);
+        hub->epfd = -1;
+    }
+    hub->size = 0;
+}
+
+/**
+ *  @brief  kserial_hub_add
+ *  The context transport must expose a descriptor, index returns the port slot.
+ */
+uint32_t kserial_hub_add(kserial_hub_t *hub, kserial_ctx_t *ctx, pkserial_handler_t handler, void *user, uint32_t *index)
+{
+    struct epoll_event ev;
+    uint32_t slot;
+    int fd;
+
+    if ((ctx->transport == NULL) || (ctx->transport->fd == NULL) || ((fd = ctx->transport->fd(ctx->handle)) < 0))
+    {
+        return KS_ERROR;
+    }
+    for (slot = 0; slot < hub->size; slot++)
+    {
+        if (hub->port[slot].ctx == NULL)
+        {
+            break;
+        }
+    }
+    if (slot == hub->size)
+    {
+        return KS_BUSY;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = slot;
+    if (epoll_ctl(hub->epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+        return KS_ERROR;
+    }
+    hub->port[slot].ctx = ctx;
+    hub->port[slot].handler = handler;
+    hub->port[slot].user = user;
+    hub->port[slot].state = KS_OPEN;
+    if (index != NULL)
+    {
+        *index = slot;
+    }
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_hub_detach
+ */
+static void kserial_hub_detach(kserial_hub_t *hub, kserial_hub_port_t *port)
+{
+    int fd = port->ctx->transport->fd(port->ctx->handle);
+
+    if (fd >= 0)
+    {
+        epoll_ctl(hub->epfd, EPOLL_CTL_DEL, fd, NULL);
+    }
+    hub->backlog -= port->backlog;
+    port->backlog = 0;
+    port->state = KS_CLOSE;
+}
+
+/**
+ *  @brief  kserial_hub_remove
+ */
+uint32_t kserial_hub_remove(kserial_hub_t *hub, uint32_t index)
+{
+    kserial_hub_port_t *port;
+
+    if ((index >= hub->size) || (hub->port[index].ctx == NULL))
+    {
+        return KS_ERROR;
+    }
+    port = &hub->port[index];
+    if (port->state == KS_OPEN)
+    {
+        kserial_hub_detach(hub, port);
+    }
+    memset(port, 0, sizeof(kserial_hub_port_t));
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_hub_service
+ *  Read and dispatch one port, return the number of packets handled.
+ */
+uint32_t kserial_hub_service(kserial_hub_t *hub, uint32_t index)
+{
+    kserial_hub_port_t *port = &hub->port[index];
+    kserial_t *ks = &port->ctx->ks;
+    uint32_t total = 0;
+    uint32_t reads = 0;
+    uint32_t backlog;
+    uint32_t count;
+
+    do
+    {
+        count = kserial_read_ctx(port->ctx);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (port->handler != NULL)
+            {
+                port->handler(port->user, &ks->packet[i]);
+            }
+            kserial_release_packet(ks, &ks->packet[i]);
+        }
+        total += count;
+        reads++;
+    }
+    while ((count == ks->pksize) && (reads < KSERIAL_HUB_READS));
+
+    // whole frames may be left in the ring with nothing to wake epoll
+    backlog = ((count == ks->pksize) && (port->state == KS_OPEN)) ? 1 : 0;
+    hub->backlog += backlog - port->backlog;
+    port->backlog = backlog;
+
+    return total;
+}
+
+/**
+ *  @brief  kserial_hub_poll
+ *  Wait up to timeout ms for any port, return the number of packets handled.
+ */
+uint32_t kserial_hub_poll(kserial_hub_t *hub, uint32_t timeout)
+{
+    struct epoll_event ev[KSERIAL_HUB_MAX_EVENTS];
+    kserial_hub_port_t *port;
+    uint32_t total = 0;
+    uint32_t bytes;
+    int nev;
+
+    if (hub->backlog != 0)
+    {   // ports left with packets by the previous poll, do not sleep
+        for (uint32_t i = 0; i < hub->size; i++)
+        {
+            if (hub->port[i].backlog && (hub->port[i].state == KS_OPEN))
+            {
+                total += kserial_hub_service(hub, i);
+            }
+        }
+        if ((total != 0) || (hub->backlog != 0))
+        {
+            timeout = 0;
+        }
+    }
+    do
+    {
+        nev = epoll_wait(hub->epfd, ev, KSERIAL_HUB_MAX_EVENTS, (int)timeout);
+    }
+    while ((nev < 0) && (errno == EINTR));
+
+    for (int i = 0; i < nev; i++)
+    {
+        if (ev[i].data.u32 >= hub->size)
+        {
+            continue;
+        }
+        port = &hub->port[ev[i].data.u32];
+        if ((port->ctx == NULL) || (port->state != KS_OPEN))
+        {
+            continue;
+        }
+        bytes = atomic_load_explicit(&port->ctx->ks.stats.bytes, memory_order_relaxed);
+        if (ev[i].events & EPOLLIN)
+        {
+            total += kserial_hub_service(hub, ev[i].data.u32);
+        }
+        if ((ev[i].events & (EPOLLHUP | EPOLLERR)) &&
+            (atomic_load_explicit(&port->ctx->ks.stats.bytes, memory_order_relaxed) == bytes))
+        {   // hang-up comes with EPOLLIN, detach once a read finds nothing left
+            kserial_hub_detach(hub, port);
+        }
+    }
+
+    return total;
+}
+
+#endif
+
+/*************************************** END OF FILE ****************************************/
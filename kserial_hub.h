@@ -0,0 +1,67 @@
+/**
+ *      __            ____
+ *     / /__ _  __   / __/                      __  
+ *    / //_/(_)/ /_ / /  ___   ____ ___  __ __ / /_ 
+ *   / ,<  / // __/_\ \ / _ \ / __// _ \/ // // __/ 
+ *  /_/|_|/_/ \__//___// .__//_/   \___/\_,_/ \__/  
+ *                    /_/   github.com/KitSprout    
+ * 
+ *  @file    kserial_hub.h
+ *  @author  KitSprout
+ *  @brief   many ports serviced from one thread
+ * 
+ */
+
+/* Define to prevent recursive inclusion ---------------------------------------------------*/
+#ifndef __KSERIAL_HUB_H
+#define __KSERIAL_HUB_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes --------------------------------------------------------------------------------*/
+#include "kserial.h"
+
+/* Define ----------------------------------------------------------------------------------*/
+/* Macro -----------------------------------------------------------------------------------*/
+/* Typedef ---------------------------------------------------------------------------------*/
+
+typedef struct
+{
+    kserial_ctx_t *ctx;         // NULL when the slot is free
+    pkserial_handler_t handler;
+    void *user;
+    uint32_t state;             // KS_OPEN, KS_CLOSE after hang-up or error
+    uint32_t backlog;           // stopped at KSERIAL_HUB_READS with packets left
+
+} kserial_hub_port_t;
+
+typedef struct
+{
+    int epfd;
+    uint32_t size;
+    kserial_hub_port_t *port;
+    uint32_t backlog;           // ports with backlog
+
+} kserial_hub_t;
+
+/* Extern ----------------------------------------------------------------------------------*/
+/* Functions -------------------------------------------------------------------------------*/
+
+#if KSERIAL_HUB_ENABLE
+uint32_t    kserial_hub_init(kserial_hub_t *hub, kserial_hub_port_t *port, uint32_t size);
+void        kserial_hub_deinit(kserial_hub_t *hub);
+uint32_t    kserial_hub_add(kserial_hub_t *hub, kserial_ctx_t *ctx, pkserial_handler_t handler, void *user, uint32_t *index);
+uint32_t    kserial_hub_remove(kserial_hub_t *hub, uint32_t index);
+uint32_t    kserial_hub_service(kserial_hub_t *hub, uint32_t index);
+uint32_t    kserial_hub_poll(kserial_hub_t *hub, uint32_t timeout);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/*************************************** END OF FILE ****************************************/
@@ -0,0 +1,257 @@
+/**
+ *      __            ____
+ *     / /__ _  __   / __/                      __  
+ *    / //_/(_)/ /_ / /  ___   ____ ___  __ __ / /_ 
+ *   / ,<  / // __/_\ \ / _ \ / __// _ \/ // // __/ 
+ *  /_/|_|/_/ \__//___// .__//_/   \___/\_,_/ \__/  
+ *                    /_/   github.com/KitSprout    
+ * 
+ *  @file    kserial_thread.c
+ *  @author  KitSprout
+ *  @brief   background receive thread
+ *           The thread owns kserial_read_ctx of the context and publishes packets through a
+ *           single-producer / single-consumer queue. Packet descriptors and payload bytes
+ *           live in two power-of-two rings, both released in order by kserial_thread_read.
+ *           A full queue holds the thread back instead of dropping packets.
+ *           kserial_send_packet_ctx and kscmd writes may still be used from the caller.
+ */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+/* Includes --------------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "kserial_thread.h"
+
+#if KSERIAL_RECV_TREAD_ENABLE
+
+/* Define ----------------------------------------------------------------------------------*/
+#define KSERIAL_THREAD_NAP_NS           (100000)
+
+/* Macro -----------------------------------------------------------------------------------*/
+/* Typedef ---------------------------------------------------------------------------------*/
+
+typedef struct
+{
+    kserial_packet_t packet;    // data points into the payload ring
+    uint32_t end;               // payload ring position behind this packet
+
+} kserial_entry_t;
+
+struct kserial_thread
+{
+    kserial_ctx_t *ctx;
+    pthread_t thread;
+    atomic_uint running;
+    atomic_uint dropped;
+
+    uint32_t pksize;
+    kserial_entry_t *entry;
+    atomic_uint head;           // consumer
+    atomic_uint tail;           // producer
+    uint32_t hold;              // consumer holds entry[head]
+
+    uint32_t bytesize;
+    uint8_t *payload;
+    atomic_uint payhead;        // consumer
+    uint32_t paytail;           // producer
+};
+
+/* Variables -------------------------------------------------------------------------------*/
+/* Prototypes ------------------------------------------------------------------------------*/
+/* Functions -------------------------------------------------------------------------------*/
+
+/**
+ *  @brief  kserial_thread_push
+ */
+static uint32_t kserial_thread_push(kserial_thread_t *kt, const kserial_packet_t *pk)
+{
+    uint32_t tail = atomic_load_explicit(&kt->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&kt->head, memory_order_acquire);
+    uint32_t pos = kt->paytail;
+    uint32_t offset = pos & (kt->bytesize - 1);
+    kserial_entry_t *entry;
+
+    if ((tail - head) >= kt->pksize)
+    {
+        return KS_BUSY;
+    }
+    if ((offset + pk->nbyte) > kt->bytesize)
+    {   // keep payload contiguous, skip the rest of the ring
+        pos += kt->bytesize - offset;
+        offset = 0;
+    }
+    if (((pos + pk->nbyte) - atomic_load_explicit(&kt->payhead, memory_order_acquire)) > kt->bytesize)
+    {
+        return KS_BUSY;
+    }
+    memcpy(&kt->payload[offset], pk->data, pk->nbyte);
+    entry = &kt->entry[tail & (kt->pksize - 1)];
+    entry->packet = *pk;
+    entry->packet.data = &kt->payload[offset];
+    entry->end = pos + pk->nbyte;
+    kt->paytail = entry->end;
+    atomic_store_explicit(&kt->tail, tail + 1, memory_order_release);
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_thread_nap
+ */
+static void kserial_thread_nap(void)
+{
+    struct timespec ts = {0, KSERIAL_THREAD_NAP_NS};
+
+    nanosleep(&ts, NULL);
+}
+
+/**
+ *  @brief  kserial_thread_loop
+ *  Packets of a read are pushed before the next read, while the queue is full the thread
+ *  stops reading and the bytes wait in the receive ring or the transport.
+ */
+static void *kserial_thread_loop(void *arg)
+{
+    kserial_thread_t *kt = (kserial_thread_t *)arg;
+    kserial_t *ks = &kt->ctx->ks;
+    uint32_t count = 0;
+    uint32_t next = 0;
+    uint32_t overflow;
+
+    while (atomic_load_explicit(&kt->running, memory_order_relaxed))
+    {
+        if (next == count)
+        {
+            overflow = atomic_load_explicit(&ks->stats.overflow, memory_order_relaxed);
+            count = kserial_read_ctx(kt->ctx);
+            next = 0;
+            overflow = atomic_load_explicit(&ks->stats.overflow, memory_order_relaxed) - overflow;
+            if (overflow != 0)
+            {
+                atomic_fetch_add_explicit(&kt->dropped, overflow, memory_order_relaxed);
+            }
+            if ((count == 0) && (kserial_wait_ctx(kt->ctx, 1) == KS_ERROR))
+            {   // no transport wait, poll
+                kserial_thread_nap();
+            }
+            continue;
+        }
+        while ((next < count) && (kserial_thread_push(kt, &ks->packet[next]) == KS_OK))
+        {
+            next++;
+        }
+        if (next < count)
+        {   // queue full, let the consumer catch up
+            kserial_thread_nap();
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ *  @brief  kserial_thread_create
+ *  Start a receive thread on ctx, the context is switched to view mode and must not be read
+ *  by the caller until kserial_thread_destroy.
+ *  pksize   : queue depth in packets, power of two
+ *  bytesize : payload ring bytes, power of two and at least 2 * (KSERIAL_MAX_DATA_BYTES + 1)
+ */
+kserial_thread_t *kserial_thread_create(kserial_ctx_t *ctx, uint32_t pksize, uint32_t bytesize)
+{
+    kserial_thread_t *kt;
+
+    if ((pksize == 0) || (pksize & (pksize - 1)) ||
+        (bytesize < (2 * (KSERIAL_MAX_DATA_BYTES + 1))) || (bytesize & (bytesize - 1)))
+    {
+        return NULL;
+    }
+    kt = (kserial_thread_t *)calloc(1, sizeof(kserial_thread_t));
+    if (kt == NULL)
+    {
+        return NULL;
+    }
+    kt->ctx = ctx;
+    kt->pksize = pksize;
+    kt->bytesize = bytesize;
+    kt->entry = (kserial_entry_t *)malloc(pksize * sizeof(kserial_entry_t));
+    kt->payload = (uint8_t *)malloc(bytesize);
+    if ((kt->entry == NULL) || (kt->payload == NULL))
+    {
+        free(kt->entry);
+        free(kt->payload);
+        free(kt);
+        return NULL;
+    }
+
+    ctx->ks.mode = KSERIAL_PACKET_VIEW;
+    atomic_store(&kt->running, 1);
+    if (pthread_create(&kt->thread, NULL, kserial_thread_loop, kt) != 0)
+    {
+        free(kt->entry);
+        free(kt->payload);
+        free(kt);
+        return NULL;
+    }
+
+    return kt;
+}
+
+/**
+ *  @brief  kserial_thread_destroy
+ */
+void kserial_thread_destroy(kserial_thread_t *kt)
+{
+    if (kt == NULL)
+    {
+        return;
+    }
+    atomic_store(&kt->running, 0);
+    pthread_join(kt->thread, NULL);
+    free(kt->entry);
+    free(kt->payload);
+    free(kt);
+}
+
+/**
+ *  @brief  kserial_thread_read
+ *  Never blocks, return KS_ERROR when the queue is empty.
+ *  Packet data stays valid until the next kserial_thread_read.
+ */
+uint32_t kserial_thread_read(kserial_thread_t *kt, kserial_packet_t *ksp)
+{
+    uint32_t head = atomic_load_explicit(&kt->head, memory_order_relaxed);
+
+    if (kt->hold)
+    {   // release the packet of the previous read
+        atomic_store_explicit(&kt->payhead, kt->entry[head & (kt->pksize - 1)].end, memory_order_release);
+        atomic_store_explicit(&kt->head, ++head, memory_order_release);
+        kt->hold = 0;
+    }
+    if (head == atomic_load_explicit(&kt->tail, memory_order_acquire))
+    {
+        return KS_ERROR;
+    }
+    *ksp = kt->entry[head & (kt->pksize - 1)].packet;
+    kt->hold = 1;
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_thread_dropped
+ *  Reads stopped by a full receive ring, the transport may have discarded bytes meanwhile.
+ */
+uint32_t kserial_thread_dropped(kserial_thread_t *kt)
+{
+    return atomic_load_explicit(&kt->dropped, memory_order_relaxed);
+}
+
+#endif
+
+/*************************************** END OF FILE ****************************************/
@@ -0,0 +1,48 @@
+/**
+ *      __            ____
+ *     / /__ _  __   / __/                      __  
+ *    / //_/(_)/ /_ / /  ___   ____ ___  __ __ / /_ 
+ *   / ,<  / // __/_\ \ / _ \ / __// _ \/ // // __/ 
+ *  /_/|_|/_/ \__//___// .__//_/   \___/\_,_/ \__/  
+ *                    /_/   github.com/KitSprout    
+ * 
+ *  @file    kserial_thread.h
+ *  @author  KitSprout
+ *  @brief   background receive thread
+ * 
+ */
+
+/* Define to prevent recursive inclusion ---------------------------------------------------*/
+#ifndef __KSERIAL_THREAD_H
+#define __KSERIAL_THREAD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes --------------------------------------------------------------------------------*/
+#include "kserial.h"
+
+/* Define ----------------------------------------------------------------------------------*/
+/* Macro -----------------------------------------------------------------------------------*/
+/* Typedef ---------------------------------------------------------------------------------*/
+
+typedef struct kserial_thread kserial_thread_t;
+
+/* Extern ----------------------------------------------------------------------------------*/
+/* Functions -------------------------------------------------------------------------------*/
+
+#if KSERIAL_RECV_TREAD_ENABLE
+kserial_thread_t   *kserial_thread_create(kserial_ctx_t *ctx, uint32_t pksize, uint32_t bytesize);
+void                kserial_thread_destroy(kserial_thread_t *kt);
+uint32_t            kserial_thread_read(kserial_thread_t *kt, kserial_packet_t *ksp);
+uint32_t            kserial_thread_dropped(kserial_thread_t *kt);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/*************************************** END OF FILE ****************************************/
@@ -0,0 +1,616 @@
+/**
+ *      __            ____
+ *     / /__ _  __   / __/                      __  
+ *    / //_/(_)/ /_ / /  ___   ____ ___  __ __ / /_ 
+ *   / ,<  / // __/_\ \ / _ \ / __// _ \/ // // __/ 
+ *  /_/|_|/_/ \__//___// .__//_/   \___/\_,_/ \__/  
+ *                    /_/   github.com/KitSprout    
+ * 
+ *  @file    kserial_transport.c
+ *  @author  KitSprout
+ *  @brief   posix fd, pty and in-memory loopback transports
+ *           kserial_transport_fd drives any non-blocking file descriptor, tty or pty.
+ *           kserial_transport_loopback connects two contexts through a pair of lock-free
+ *           byte rings, one writer and one reader per direction, so both sides may run
+ *           on different threads without a device.
+ */
+
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+/* Includes --------------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/uio.h>
+#include "kserial_transport.h"
+
+#if KSERIAL_POSIX_ENABLE
+
+/* Define ----------------------------------------------------------------------------------*/
+
+#define KSERIAL_FD_MAX_IOVEC            (64)
+#define KSERIAL_LOOPBACK_SPIN_NS        (20000)
+#define KSERIAL_LOOPBACK_WAIT_NS        (50000)
+
+/* Macro -----------------------------------------------------------------------------------*/
+/* Typedef ---------------------------------------------------------------------------------*/
+
+typedef struct
+{
+    uint8_t *buffer;
+    uint32_t size;              // power of two
+    atomic_uint head;           // reader
+    atomic_uint tail;           // writer
+
+} kserial_bytering_t;
+
+typedef struct
+{
+    kserial_bytering_t *tx;
+    kserial_bytering_t *rx;
+
+} kserial_loopback_port_t;
+
+struct kserial_loopback
+{
+    kserial_bytering_t ring[2];
+    kserial_loopback_port_t port[2];
+};
+
+/* Variables -------------------------------------------------------------------------------*/
+/* Prototypes ------------------------------------------------------------------------------*/
+
+static uint32_t kserial_fd_send(void *handle, const void *data, uint32_t lens);
+static uint32_t kserial_fd_sendv(void *handle, const kserial_iovec_t *iov, uint32_t count);
+static uint32_t kserial_fd_recv(void *handle, void *data, uint32_t lens);
+static void     kserial_fd_flush(void *handle);
+static uint32_t kserial_fd_wait(void *handle, uint32_t timeout);
+static uint64_t kserial_posix_now(void *handle);
+static int      kserial_fd_fd(void *handle);
+static uint32_t kserial_fd_setbaud(void *handle, uint32_t baudrate);
+
+static uint32_t kserial_loopback_send(void *handle, const void *data, uint32_t lens);
+static uint32_t kserial_loopback_recv(void *handle, void *data, uint32_t lens);
+static void     kserial_loopback_flush(void *handle);
+static uint32_t kserial_loopback_wait(void *handle, uint32_t timeout);
+
+const kserial_transport_t kserial_transport_fd =
+{
+    .send = kserial_fd_send,
+    .sendv = kserial_fd_sendv,
+    .recv = kserial_fd_recv,
+    .flush = kserial_fd_flush,
+    .wait = kserial_fd_wait,
+    .now = kserial_posix_now,
+    .fd = kserial_fd_fd,
+    .setbaud = kserial_fd_setbaud
+};
+
+const kserial_transport_t kserial_transport_loopback =
+{
+    .send = kserial_loopback_send,
+    .sendv = NULL,
+    .recv = kserial_loopback_recv,
+    .flush = kserial_loopback_flush,
+    .wait = kserial_loopback_wait,
+    .now = kserial_posix_now,
+    .fd = NULL,
+    .setbaud = NULL
+};
+
+/* Functions -------------------------------------------------------------------------------*/
+
+/**
+ *  @brief  kserial_posix_now
+ */
+static uint64_t kserial_posix_now(void *handle)
+{
+    struct timespec ts;
+    (void)handle;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ *  @brief  kserial_fd_fd
+ */
+static int kserial_fd_fd(void *handle)
+{
+    return ((kserial_fd_t *)handle)->fd;
+}
+
+/**
+ *  @brief  kserial_fd_writable
+ */
+static int kserial_fd_writable(int fd)
+{
+    struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+    return poll(&pfd, 1, -1);
+}
+
+/**
+ *  @brief  kserial_fd_send
+ *  Block until every byte is written or the descriptor fails.
+ */
+static uint32_t kserial_fd_send(void *handle, const void *data, uint32_t lens)
+{
+    kserial_fd_t *port = (kserial_fd_t *)handle;
+    const uint8_t *pdata = (const uint8_t *)data;
+    uint32_t nbyte = 0;
+    ssize_t ret;
+
+    while (nbyte < lens)
+    {
+        ret = write(port->fd, pdata + nbyte, lens - nbyte);
+        if (ret > 0)
+        {
+            nbyte += (uint32_t)ret;
+        }
+        else if ((ret < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        else if ((ret < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+        {
+            if (kserial_fd_writable(port->fd) < 0)
+            {
+                break;
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return nbyte;
+}
+
+/**
+ *  @brief  kserial_fd_sendv
+ *  One writev per KSERIAL_FD_MAX_IOVEC segments, a short write finishes segment by segment.
+ */
+static uint32_t kserial_fd_sendv(void *handle, const kserial_iovec_t *iov, uint32_t count)
+{
+    kserial_fd_t *port = (kserial_fd_t *)handle;
+    struct iovec vec[KSERIAL_FD_MAX_IOVEC];
+    uint32_t nbyte = 0;
+    uint32_t n, lens;
+    ssize_t ret;
+
+    while (count > 0)
+    {
+        n = (count > KSERIAL_FD_MAX_IOVEC) ? KSERIAL_FD_MAX_IOVEC : count;
+        lens = 0;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            vec[i].iov_base = (void *)iov[i].data;
+            vec[i].iov_len = iov[i].lens;
+            lens += iov[i].lens;
+        }
+        do
+        {
+            ret = writev(port->fd, vec, (int)n);
+        } while ((ret < 0) && (errno == EINTR));
+        if (ret < 0)
+        {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+            {
+                return nbyte;
+            }
+            ret = 0;
+        }
+        nbyte += (uint32_t)ret;
+        if ((uint32_t)ret < lens)
+        {
+            // skip the written part and push the rest with plain writes
+            for (uint32_t i = 0; i < n; i++)
+            {
+                if ((uint32_t)ret >= iov[i].lens)
+                {
+                    ret -= iov[i].lens;
+                    continue;
+                }
+                nbyte += kserial_fd_send(handle, (const uint8_t *)iov[i].data + ret, iov[i].lens - (uint32_t)ret);
+                ret = 0;
+            }
+        }
+        iov += n;
+        count -= n;
+    }
+
+    return nbyte;
+}
+
+/**
+ *  @brief  kserial_fd_recv
+ */
+static uint32_t kserial_fd_recv(void *handle, void *data, uint32_t lens)
+{
+    kserial_fd_t *port = (kserial_fd_t *)handle;
+    ssize_t ret;
+
+    do
+    {
+        ret = read(port->fd, data, lens);
+    } while ((ret < 0) && (errno == EINTR));
+
+    return (ret > 0) ? (uint32_t)ret : 0;
+}
+
+/**
+ *  @brief  kserial_fd_flush
+ */
+static void kserial_fd_flush(void *handle)
+{
+    kserial_fd_t *port = (kserial_fd_t *)handle;
+    uint8_t dump[256];
+
+    if (isatty(port->fd))
+    {
+        tcflush(port->fd, TCIFLUSH);
+    }
+    while (kserial_fd_recv(handle, dump, sizeof(dump)) != 0);
+}
+
+/**
+ *  @brief  kserial_fd_wait
+ */
+static uint32_t kserial_fd_wait(void *handle, uint32_t timeout)
+{
+    kserial_fd_t *port = (kserial_fd_t *)handle;
+    struct pollfd pfd = {.fd = port->fd, .events = POLLIN};
+    int ret;
+
+    do
+    {
+        ret = poll(&pfd, 1, (int)timeout);
+    } while ((ret < 0) && (errno == EINTR));
+
+    if (ret < 0)
+    {
+        return KS_ERROR;
+    }
+    return (ret > 0) ? KS_OK : KS_TIMEOUT;
+}
+
+/**
+ *  @brief  kserial_fd_speed
+ */
+static speed_t kserial_fd_speed(uint32_t baudrate)
+{
+    switch (baudrate)
+    {
+        case 9600:      return B9600;
+        case 19200:     return B19200;
+        case 38400:     return B38400;
+        case 57600:     return B57600;
+        case 115200:    return B115200;
+        case 230400:    return B230400;
+#ifdef B460800
+        case 460800:    return B460800;
+#endif
+#ifdef B921600
+        case 921600:    return B921600;
+#endif
+#ifdef B1000000
+        case 1000000:   return B1000000;
+#endif
+#ifdef B2000000
+        case 2000000:   return B2000000;
+#endif
+#ifdef B3000000
+        case 3000000:   return B3000000;
+#endif
+        default:        return B0;
+    }
+}
+
+/**
+ *  @brief  kserial_fd_setbaud
+ *  Pending output is sent at the old speed first.
+ */
+static uint32_t kserial_fd_setbaud(void *handle, uint32_t baudrate)
+{
+    kserial_fd_t *port = (kserial_fd_t *)handle;
+    speed_t speed = kserial_fd_speed(baudrate);
+    struct termios tio;
+
+    if ((speed == B0) || (tcgetattr(port->fd, &tio) != 0))
+    {
+        return KS_ERROR;
+    }
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (tcsetattr(port->fd, TCSADRAIN, &tio) != 0)
+    {
+        return KS_ERROR;
+    }
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_fd_attach
+ *  Take over an open descriptor and switch it to non-blocking mode.
+ */
+uint32_t kserial_fd_attach(kserial_fd_t *port, int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+
+    if ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0))
+    {
+        return KS_ERROR;
+    }
+    port->fd = fd;
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_fd_open
+ *  Open a tty in raw 8N1 mode, baudrate 0 keeps the current speed.
+ */
+uint32_t kserial_fd_open(kserial_fd_t *port, const char *path, uint32_t baudrate)
+{
+    struct termios tio;
+    speed_t speed = kserial_fd_speed(baudrate);
+    int fd;
+
+    if ((baudrate != 0) && (speed == B0))
+    {
+        return KS_ERROR;
+    }
+    fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0)
+    {
+        return KS_ERROR;
+    }
+    if (tcgetattr(fd, &tio) == 0)
+    {
+        cfmakeraw(&tio);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tio.c_cc[VMIN] = 0;
+        tio.c_cc[VTIME] = 0;
+        if (baudrate != 0)
+        {
+            cfsetispeed(&tio, speed);
+            cfsetospeed(&tio, speed);
+        }
+        if (tcsetattr(fd, TCSANOW, &tio) != 0)
+        {
+            close(fd);
+            return KS_ERROR;
+        }
+    }
+    port->fd = fd;
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_pty_open
+ *  Create a raw pseudo terminal pair, one port for each end.
+ */
+uint32_t kserial_pty_open(kserial_fd_t *master, kserial_fd_t *slave)
+{
+    struct termios tio;
+    const char *name;
+    int mfd, sfd;
+
+    mfd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (mfd < 0)
+    {
+        return KS_ERROR;
+    }
+    if ((grantpt(mfd) != 0) || (unlockpt(mfd) != 0) || ((name = ptsname(mfd)) == NULL))
+    {
+        close(mfd);
+        return KS_ERROR;
+    }
+    sfd = open(name, O_RDWR | O_NOCTTY);
+    if (sfd < 0)
+    {
+        close(mfd);
+        return KS_ERROR;
+    }
+    if (tcgetattr(sfd, &tio) == 0)
+    {
+        cfmakeraw(&tio);
+        tcsetattr(sfd, TCSANOW, &tio);
+    }
+    if ((kserial_fd_attach(master, mfd) != KS_OK) || (kserial_fd_attach(slave, sfd) != KS_OK))
+    {
+        close(mfd);
+        close(sfd);
+        return KS_ERROR;
+    }
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_fd_close
+ */
+void kserial_fd_close(kserial_fd_t *port)
+{
+    if (port->fd >= 0)
+    {
+        close(port->fd);
+        port->fd = -1;
+    }
+}
+
+/**
+ *  @brief  kserial_loopback_send
+ *  Bytes that do not fit are dropped, like an overrun uart.
+ */
+static uint32_t kserial_loopback_send(void *handle, const void *data, uint32_t lens)
+{
+    kserial_bytering_t *ring = ((kserial_loopback_port_t *)handle)->tx;
+    uint32_t mask = ring->size - 1;
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t space = ring->size - (tail - head);
+    uint32_t index = tail & mask;
+    uint32_t first;
+
+    if (lens > space)
+    {
+        lens = space;
+    }
+    first = ring->size - index;
+    if (first > lens)
+    {
+        first = lens;
+    }
+    memcpy(&ring->buffer[index], data, first);
+    memcpy(ring->buffer, (const uint8_t *)data + first, lens - first);
+    atomic_store_explicit(&ring->tail, tail + lens, memory_order_release);
+
+    return lens;
+}
+
+/**
+ *  @brief  kserial_loopback_recv
+ */
+static uint32_t kserial_loopback_recv(void *handle, void *data, uint32_t lens)
+{
+    kserial_bytering_t *ring = ((kserial_loopback_port_t *)handle)->rx;
+    uint32_t mask = ring->size - 1;
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t index = head & mask;
+    uint32_t first;
+
+    if (lens > (tail - head))
+    {
+        lens = tail - head;
+    }
+    first = ring->size - index;
+    if (first > lens)
+    {
+        first = lens;
+    }
+    memcpy(data, &ring->buffer[index], first);
+    memcpy((uint8_t *)data + first, ring->buffer, lens - first);
+    atomic_store_explicit(&ring->head, head + lens, memory_order_release);
+
+    return lens;
+}
+
+/**
+ *  @brief  kserial_loopback_flush
+ */
+static void kserial_loopback_flush(void *handle)
+{
+    kserial_bytering_t *ring = ((kserial_loopback_port_t *)handle)->rx;
+    atomic_store_explicit(&ring->head, atomic_load_explicit(&ring->tail, memory_order_acquire), memory_order_release);
+}
+
+/**
+ *  @brief  kserial_loopback_wait
+ *  Yield for the first KSERIAL_LOOPBACK_SPIN_NS so a peer on the same core can run, then sleep.
+ */
+static uint32_t kserial_loopback_wait(void *handle, uint32_t timeout)
+{
+    kserial_bytering_t *ring = ((kserial_loopback_port_t *)handle)->rx;
+    struct timespec ts = {.tv_sec = 0, .tv_nsec = KSERIAL_LOOPBACK_WAIT_NS};
+    uint64_t start = kserial_posix_now(NULL);
+    uint64_t deadline = start + (uint64_t)timeout * 1000000ULL;
+    uint64_t now;
+
+    while (atomic_load_explicit(&ring->tail, memory_order_acquire) == atomic_load_explicit(&ring->head, memory_order_relaxed))
+    {
+        now = kserial_posix_now(NULL);
+        if (now >= deadline)
+        {
+            return KS_TIMEOUT;
+        }
+        if ((now - start) < KSERIAL_LOOPBACK_SPIN_NS)
+        {
+            sched_yield();
+        }
+        else
+        {
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    return KS_OK;
+}
+
+/**
+ *  @brief  kserial_loopback_create
+ *  size : bytes per direction, power of two.
+ */
+kserial_loopback_t *kserial_loopback_create(uint32_t size)
+{
+    kserial_loopback_t *lb;
+
+    if ((size == 0) || ((size & (size - 1)) != 0))
+    {
+        return NULL;
+    }
+    lb = (kserial_loopback_t *)calloc(1, sizeof(kserial_loopback_t));
+    if (lb == NULL)
+    {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        lb->ring[i].buffer = (uint8_t *)malloc(size);
+        lb->ring[i].size = size;
+        atomic_init(&lb->ring[i].head, 0);
+        atomic_init(&lb->ring[i].tail, 0);
+        if (lb->ring[i].buffer == NULL)
+        {
+            kserial_loopback_destroy(lb);
+            return NULL;
+        }
+    }
+    lb->port[0].tx = &lb->ring[0];
+    lb->port[0].rx = &lb->ring[1];
+    lb->port[1].tx = &lb->ring[1];
+    lb->port[1].rx = &lb->ring[0];
+
+    return lb;
+}
+
+/**
+ *  @brief  kserial_loopback_port
+ *  Handle for kserial_transport_loopback, side 0 or 1.
+ */
+void *kserial_loopback_port(kserial_loopback_t *lb, uint32_t side)
+{
+    return &lb->port[side & 1];
+}
+
+/**
+ *  @brief  kserial_loopback_destroy
+ */
+void kserial_loopback_destroy(kserial_loopback_t *lb)
+{
+    if (lb == NULL)
+    {
+        return;
+    }
+    free(lb->ring[0].buffer);
+    free(lb->ring[1].buffer);
+    free(lb);
+}
+
+#endif
+
+/*************************************** END OF FILE ****************************************/
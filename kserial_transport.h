@@ -0,0 +1,64 @@
+/**
+ *      __            ____
+ *     / /__ _  __   / __/                      __  
+ *    / //_/(_)/ /_ / /  ___   ____ ___  __ __ / /_ 
+ *   / ,<  / // __/_\ \ / _ \ / __// _ \/ // // __/ 
+ *  /_/|_|/_/ \__//___// .__//_/   \___/\_,_/ \__/  
+ *                    /_/   github.com/KitSprout    
+ * 
+ *  @file    kserial_transport.h
+ *  @author  KitSprout
+ *  @brief   posix fd, pty and in-memory loopback transports
+ * 
+ */
+
+/* Define to prevent recursive inclusion ---------------------------------------------------*/
+#ifndef __KSERIAL_TRANSPORT_H
+#define __KSERIAL_TRANSPORT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Includes --------------------------------------------------------------------------------*/
+#include "kserial.h"
+
+/* Define ----------------------------------------------------------------------------------*/
+/* Macro -----------------------------------------------------------------------------------*/
+/* Typedef ---------------------------------------------------------------------------------*/
+
+typedef struct
+{
+    int fd;
+
+} kserial_fd_t;
+
+typedef struct kserial_loopback kserial_loopback_t;
+
+/* Extern ----------------------------------------------------------------------------------*/
+
+#if KSERIAL_POSIX_ENABLE
+extern const kserial_transport_t kserial_transport_fd;          // handle : kserial_fd_t *
+extern const kserial_transport_t kserial_transport_loopback;    // handle : kserial_loopback_port
+#endif
+
+/* Functions -------------------------------------------------------------------------------*/
+
+#if KSERIAL_POSIX_ENABLE
+uint32_t            kserial_fd_open(kserial_fd_t *port, const char *path, uint32_t baudrate);
+uint32_t            kserial_fd_attach(kserial_fd_t *port, int fd);
+uint32_t            kserial_pty_open(kserial_fd_t *master, kserial_fd_t *slave);
+void                kserial_fd_close(kserial_fd_t *port);
+
+kserial_loopback_t *kserial_loopback_create(uint32_t size);
+void               *kserial_loopback_port(kserial_loopback_t *lb, uint32_t side);
+void                kserial_loopback_destroy(kserial_loopback_t *lb);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/*************************************** END OF FILE ****************************************/